@@ -10,7 +10,9 @@ typedef enum {
 
 // Forward pass
 Matrix *relu(const Matrix *Z);
+void relu_into(Matrix *A, const Matrix *Z); // A may alias Z
 // Backward pass
 Matrix* drelu(const Matrix *Z, const Matrix *dZ);
+void drelu_into(Matrix *dA, const Matrix *Z, const Matrix *dZ); // dA may alias dZ
 
 #endif // ACT_H
\ No newline at end of file
@@ -2,10 +2,12 @@
 #define DATA_H
 
 #include "la/linalg.h"
+#include "la/sparse.h"
 
 // Dataset structure
 typedef struct {
-    Matrix *X;      // Features matrix (n_samples, n_features)
+    Matrix *X;      // Features matrix (n_samples, n_features), NULL when Xs is set
+    CsrMatrix *Xs;  // Sparse features from load_csv_sparse, or NULL
     Matrix *Y;      // Target matrix (n_samples, n_outputs)
     int n_samples;
     int n_features;
@@ -21,6 +23,16 @@ typedef struct {
  */
 Dataset* load_csv(const char *filepath, int n_outputs, int has_header);
 
+/**
+ * Load CSV file into a Dataset with CSR features (Xs), keeping only non-zero
+ * fields so memory and first-layer cost scale with the number of non-zeros
+ * @param filepath path to CSV file
+ * @param n_outputs number of output columns (from the end)
+ * @param has_header 1 if CSV has header row, 0 otherwise
+ * @return pointer to Dataset, or NULL on failure
+ */
+Dataset* load_csv_sparse(const char *filepath, int n_outputs, int has_header);
+
 /**
  * Free dataset memory
  * @param data pointer to Dataset
@@ -36,18 +48,22 @@ void dataset_info(const Dataset *data, const char *name);
 
 /**
  * Normalize features using min-max scaling to [0, 1]
+ * (sparse features are scaled in place and shifted through Xs->center)
  * @param data pointer to Dataset (modified in place)
  */
 void normalize_minmax(Dataset *data);
 
 /**
  * Normalize features using z-score (mean=0, std=1)
+ * (sparse features are scaled in place and shifted through Xs->center)
  * @param data pointer to Dataset (modified in place)
  */
 void normalize_zscore(Dataset *data);
 
 /**
- * Split dataset into train and validation sets
+ * Split dataset into train and validation sets. Both are views of data's
+ * rows, so nothing is copied: data must outlive them, changes made through
+ * either reach data, and dataset_free on a split releases only the views.
  * @param data source dataset
  * @param train output pointer for training dataset
  * @param val output pointer for validation dataset
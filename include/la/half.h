@@ -0,0 +1,146 @@
+#ifndef LA_HALF_H
+#define LA_HALF_H
+
+#include <stdint.h>
+#include <string.h>
+#include "precision.h"
+
+// 16-bit storage formats. Values are converted to real_t when packed for
+// GEMM or read by an elementwise kernel, so arithmetic and accumulation
+// always happen at full precision.
+typedef enum {
+    HALF_NONE = 0, // full-precision real_t storage
+    HALF_BF16, // bfloat16: float32 range, 8-bit mantissa
+    HALF_FP16, // IEEE binary16: 11-bit mantissa, max 65504
+} HalfFormat;
+
+// Matrix (row, col) stored as 16-bit values
+typedef struct {
+    int row, col;
+    HalfFormat fmt;
+    uint16_t* data;
+    int view; // data belongs to someone else; free_half leaves it alone
+} HalfMatrix;
+
+// Read-only matrix operand at either precision; exactly one of data/half is set
+typedef struct {
+    int row, col;
+    int ld; // row stride in elements (>= col)
+    const real_t* data;
+    const uint16_t* half;
+    HalfFormat fmt;
+} MatRef;
+
+static inline MatRef half_ref(const HalfMatrix* h) {
+    MatRef r = { .row = h->row, .col = h->col, .ld = h->col, .half = h->data, .fmt = h->fmt };
+    return r;
+}
+
+/**
+ * Create HalfMatrix (row, col), zero-filled
+ * @param row number of rows
+ * @param col number of columns
+ * @param fmt HALF_BF16 or HALF_FP16
+ * @return pointer to created HalfMatrix, or NULL on failure
+ */
+HalfMatrix* create_half(int row, int col, HalfFormat fmt);
+
+/**
+ * Free half matrix (a view frees only the header)
+ * @param h pointer to HalfMatrix to free
+ */
+void free_half(HalfMatrix* h);
+
+/**
+ * Round a full-precision matrix into existing half storage of the same shape
+ * @param dst destination HalfMatrix
+ * @param src source values
+ */
+void half_store(HalfMatrix* dst, const real_t* src);
+
+/**
+ * Parse a storage format name ("bf16", "fp16"); anything else is HALF_NONE
+ */
+HalfFormat half_format(const char* name);
+
+/**
+ * Name of a storage format for logs
+ */
+const char* half_format_name(HalfFormat fmt);
+
+static inline float bf16_to_float(uint16_t h) {
+    uint32_t u = (uint32_t) h << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_bf16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    if((u & 0x7fffffffu) > 0x7f800000u)
+        return (uint16_t) ((u >> 16) | 0x40); // keep NaNs quiet
+    // round to nearest even on the dropped 16 bits
+    u += 0x7fffu + ((u >> 16) & 1u);
+    return (uint16_t) (u >> 16);
+}
+
+static inline float fp16_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000u) << 16;
+    uint32_t exp = (h >> 10) & 0x1fu;
+    uint32_t man = h & 0x3ffu;
+    uint32_t u;
+    if(exp == 0x1f) {
+        u = sign | 0x7f800000u | (man << 13); // inf / NaN
+    } else if(exp != 0) {
+        u = sign | ((exp + 112) << 23) | (man << 13);
+    } else if(man == 0) {
+        u = sign; // signed zero
+    } else {
+        // subnormal: shift the mantissa up until it is normalized
+        exp = 113;
+        while(!(man & 0x400u)) {
+            man <<= 1;
+            exp--;
+        }
+        u = sign | (exp << 23) | ((man & 0x3ffu) << 13);
+    }
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_fp16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    uint16_t sign = (uint16_t) ((u >> 16) & 0x8000u);
+    uint32_t abs = u & 0x7fffffffu;
+    if(abs > 0x7f800000u)
+        return sign | 0x7e00u; // NaN
+    if(abs >= 0x477ff000u)
+        return sign | 0x7c00u; // rounds past 65504: inf
+    if(abs < 0x33000001u)
+        return sign; // below half the smallest subnormal
+    uint32_t exp = abs >> 23;
+    uint32_t man = (abs & 0x7fffffu) | 0x800000u;
+    int shift = (exp < 113) ? (int) (126 - exp) : 13; // subnormals drop more bits
+    uint32_t half_man = man >> shift;
+    uint32_t rem = man & ((1u << shift) - 1);
+    uint32_t mid = 1u << (shift - 1);
+    if(rem > mid || (rem == mid && (half_man & 1u)))
+        half_man++;
+    if(exp < 113)
+        return sign | (uint16_t) half_man; // a carry lands in the exponent field correctly
+    return sign | (uint16_t) (((exp - 112) << 10) + (half_man - 0x400u));
+}
+
+// one element of 16-bit storage as real_t
+static inline real_t half_get(HalfFormat fmt, uint16_t h) {
+    return (real_t) (fmt == HALF_FP16 ? fp16_to_float(h) : bf16_to_float(h));
+}
+
+static inline uint16_t half_put(HalfFormat fmt, real_t x) {
+    return fmt == HALF_FP16 ? float_to_fp16((float) x) : float_to_bf16((float) x);
+}
+
+#endif // LA_HALF_H
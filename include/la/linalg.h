@@ -6,15 +6,66 @@
 #include <string.h>
 #include <assert.h>
 #include "../poolla/thread_pool.h"
+#include "precision.h"
+#include "half.h"
 
-// Matrix structure
+// Matrix structure. Row i starts at data + i * ld; ld == col unless the
+// matrix was created padded or is a window of a wider one. Allocated data is
+// 64-byte aligned.
 typedef struct {
     int row, col;
-    double* data;
+    int ld; // leading dimension (row stride in elements), >= col
+    real_t* data;
+    int view; // data belongs to another Matrix; free_matrix leaves it alone
 } Matrix;
 
+// bytes every Matrix allocation and padded row is aligned to
+#define LA_ALIGN 64
+
+// Window of rows [row0, row0 + rows) and columns [col0, col0 + cols) of A,
+// sharing A's storage. Nothing is copied or allocated; writes go to A, and A
+// must outlive the view.
+static inline Matrix mat_view(const Matrix* A, int row0, int rows, int col0, int cols) {
+    assert(row0 >= 0 && rows >= 0 && row0 + rows <= A->row && "view rows out of range");
+    assert(col0 >= 0 && cols >= 0 && col0 + cols <= A->col && "view columns out of range");
+    Matrix v = { .row = rows, .col = cols, .ld = A->ld,
+                 .data = A->data + (size_t) row0 * A->ld + col0, .view = 1 };
+    return v;
+}
+
+// full-precision Matrix as a read-only operand
+static inline MatRef mat_ref(const Matrix* m) {
+    MatRef r = { .row = m->row, .col = m->col, .ld = m->ld, .data = m->data, .fmt = HALF_NONE };
+    return r;
+}
+
+// start of row i
+static inline real_t* mat_row(const Matrix* m, int i) {
+    return m->data + (size_t) i * m->ld;
+}
+
+// no padding between rows, so the elements form one run of row * col
+static inline int mat_dense(const Matrix* m) {
+    return m->ld == m->col || m->row <= 1;
+}
+
+// Elementwise kernels walk the logical elements k = i * col + j in runs of
+// contiguous memory: the whole matrix when every operand is dense, else one
+// row. mat_run picks the run length for up to three operands (NULLs ignored)
+// and mat_at finds element k given that run.
+static inline int mat_run(const Matrix* a, const Matrix* b, const Matrix* c) {
+    int dense = mat_dense(a) && (!b || mat_dense(b)) && (!c || mat_dense(c));
+    return dense ? a->row * a->col : a->col;
+}
+
+static inline real_t* mat_at(const Matrix* m, int run, int k) {
+    return m->data + (size_t) (k / run) * m->ld + k % run;
+}
+
 /**
  * Initialize Linear Algebra library (Thread Pool)
+ * Only matrices created after this are first-touched from the pool
+ * (NNC_FIRST_TOUCH); call it before loading data.
  */
 void la_init();
 
@@ -37,7 +88,42 @@ ThreadPool* get_la_pool();
 Matrix* create_matrix(int row, int col);
 
 /**
- * Free matrix
+ * Create Matrix (row, col) without zeroing it, for outputs that are
+ * overwritten in full (every *_into function writes each element)
+ * @param row number of rows
+ * @param col number of columns
+ * @return pointer to created Matrix, or NULL on failure
+ */
+Matrix* create_matrix_uninit(int row, int col);
+
+/**
+ * Create Matrix (row, col), zero-filled, with each row padded to a multiple
+ * of LA_ALIGN bytes so every row starts on a cache line and SIMD loads never
+ * straddle one. Elementwise kernels then walk it row by row.
+ * @param row number of rows
+ * @param col number of columns
+ * @return pointer to created Matrix, or NULL on failure
+ */
+Matrix* create_matrix_padded(int row, int col);
+
+/**
+ * create_matrix_padded without zeroing
+ */
+Matrix* create_matrix_padded_uninit(int row, int col);
+
+/**
+ * mat_view on the heap, for APIs that hand out Matrix pointers
+ * @param A pointer to the Matrix to look into (must outlive the view)
+ * @param row0 first row
+ * @param rows number of rows
+ * @param col0 first column
+ * @param cols number of columns
+ * @return pointer to a view Matrix (free with free_matrix), or NULL on failure
+ */
+Matrix* matrix_view(const Matrix* A, int row0, int rows, int col0, int cols);
+
+/**
+ * Free matrix (a view frees only itself, never the storage it looks into)
  * @param matrix pointer to Matrix to free
  */
 void free_matrix(Matrix* matrix);
@@ -50,7 +136,7 @@ void free_matrix(Matrix* matrix);
  * @param array pointer to array of size n
  * @return pointer to created Matrix, or NULL on failure
  */
-Matrix* matrix_from_array(int row, int col, int n, double* array);
+Matrix* matrix_from_array(int row, int col, int n, real_t* array);
 
 /**
  * Print matrix to stdout
@@ -66,6 +152,125 @@ void print_matrix(const Matrix* matrix);
  */
 Matrix* matmul(const Matrix* A, const Matrix* B);
 
+/**
+ * matmul into an existing C (A.row, B.col)
+ */
+void matmul_into(Matrix* C, const Matrix* A, const Matrix* B);
+
+/**
+ * matrix multiplication C = A^T * B, reading A in place
+ * @param A pointer to Matrix A (k, m)
+ * @param B pointer to Matrix B (k, n)
+ * @return pointer to Matrix C (m, n), or NULL on failure
+ */
+Matrix* matmul_tn(const Matrix* A, const Matrix* B);
+
+/**
+ * matmul_tn into an existing C (A.col, B.col)
+ */
+void matmul_tn_into(Matrix* C, const Matrix* A, const Matrix* B);
+
+/**
+ * matmul_tn for operands at either precision (16-bit ones are widened while packing)
+ */
+Matrix* matmul_tn_ref(MatRef A, MatRef B);
+
+/**
+ * matmul_tn_ref into an existing C (A.col, B.col)
+ */
+void matmul_tn_ref_into(Matrix* C, MatRef A, MatRef B);
+
+/**
+ * matrix multiplication C = A * B^T, reading B in place
+ * @param A pointer to Matrix A (m, k)
+ * @param B pointer to Matrix B (n, k)
+ * @return pointer to Matrix C (m, n), or NULL on failure
+ */
+Matrix* matmul_nt(const Matrix* A, const Matrix* B);
+
+/**
+ * matmul_nt into an existing C (A.row, B.row)
+ */
+void matmul_nt_into(Matrix* C, const Matrix* A, const Matrix* B);
+
+// activation fused into gemm_bias_act
+typedef enum {
+    LA_ACT_NONE = 0,
+    LA_ACT_RELU,
+} LaAct;
+
+/**
+ * fused layer forward act(A * B + bias), computed in one pass over the output
+ * @param A pointer to Matrix A (m, k)
+ * @param B pointer to Matrix B (k, n)
+ * @param bias pointer to row vector (1, n), or NULL
+ * @param act activation applied after the bias
+ * @param Z if not NULL, receives a new Matrix with the pre-activation A * B + bias
+ *          (only used when act is not LA_ACT_NONE)
+ * @return pointer to act(A * B + bias), or NULL on failure
+ */
+Matrix* gemm_bias_act(const Matrix* A, const Matrix* B, const Matrix* bias, LaAct act, Matrix** Z);
+
+/**
+ * gemm_bias_act into existing outputs
+ * @param Y receives act(A * B + bias) (A.row, B.col)
+ * @param Z if not NULL, receives the pre-activation (only used when act is not LA_ACT_NONE)
+ */
+void gemm_bias_act_into(Matrix* Y, Matrix* Z, const Matrix* A, const Matrix* B, const Matrix* bias, LaAct act);
+
+/**
+ * gemm_bias_act for operands at either precision
+ */
+Matrix* gemm_bias_act_ref(MatRef A, MatRef B, const Matrix* bias, LaAct act, Matrix** Z);
+
+/**
+ * gemm_bias_act_ref into existing outputs (see gemm_bias_act_into)
+ */
+void gemm_bias_act_ref_into(Matrix* Y, Matrix* Z, MatRef A, MatRef B, const Matrix* bias, LaAct act);
+
+/**
+ * gemm_bias_act with 16-bit outputs: accumulates at full precision and rounds
+ * each finished tile into fmt, so no full-precision copy outlives the call
+ * @param fmt storage format of the outputs
+ * @param Z if not NULL, receives the pre-activation (only used when act is not LA_ACT_NONE)
+ * @return pointer to act(A * B + bias) in fmt, or NULL on failure
+ */
+HalfMatrix* gemm_bias_act_half(MatRef A, MatRef B, const Matrix* bias, LaAct act,
+                               HalfFormat fmt, HalfMatrix** Z);
+
+/**
+ * gemm_bias_act_half into existing outputs in Y's format
+ * @param Y receives act(A * B + bias) (A.row, B.col)
+ * @param Z if not NULL, receives the pre-activation (only used when act is not LA_ACT_NONE)
+ * @return 0 on success, -1 if the full-precision accumulator can't be allocated
+ */
+int gemm_bias_act_half_into(HalfMatrix* Y, HalfMatrix* Z, MatRef A, MatRef B, const Matrix* bias, LaAct act);
+
+/**
+ * fused ReLU backward dZ = (A * B^T) ⊙ (Z > 0), reading B in place
+ * @param A pointer to Matrix A (m, k), the gradient of the next layer's pre-activation
+ * @param B pointer to Matrix B (n, k), the next layer's weights
+ * @param Z pointer to Matrix Z (m, n), this layer's pre-activation
+ * @return pointer to Matrix dZ (m, n), or NULL on failure
+ */
+Matrix* matmul_nt_drelu(const Matrix* A, const Matrix* B, const Matrix* Z);
+
+/**
+ * matmul_nt_drelu into an existing C (A.row, B.row)
+ */
+void matmul_nt_drelu_into(Matrix* C, const Matrix* A, const Matrix* B, const Matrix* Z);
+
+/**
+ * matmul_nt_drelu for operands and mask at either precision
+ */
+Matrix* matmul_nt_drelu_ref(MatRef A, MatRef B, MatRef Z);
+
+/**
+ * matmul_nt_drelu_ref into an existing C (A.row, B.row); an empty Z (no data)
+ * leaves the product unmasked
+ */
+void matmul_nt_drelu_ref_into(Matrix* C, MatRef A, MatRef B, MatRef Z);
+
 /**
  * matrix addition C = A + B
  * @param A pointer to Matrix A
@@ -74,6 +279,11 @@ Matrix* matmul(const Matrix* A, const Matrix* B);
  */
 Matrix* matadd(const Matrix* A, const Matrix* B);
 
+/**
+ * matadd into an existing C of A's shape (C may alias A or B)
+ */
+void matadd_into(Matrix* C, const Matrix* A, const Matrix* B);
+
 /**
  * scaling matrix C = A .* B (element-wise multiplication)
  * @param A pointer to Matrix A
@@ -82,6 +292,11 @@ Matrix* matadd(const Matrix* A, const Matrix* B);
  */
 Matrix* matscale(const Matrix* A, const Matrix* B);
 
+/**
+ * matscale into an existing C of A's shape (C may alias A or B)
+ */
+void matscale_into(Matrix* C, const Matrix* A, const Matrix* B);
+
 /**
  * transpose matrix At = A^T
  * @param A pointer to Matrix A
@@ -89,6 +304,17 @@ Matrix* matscale(const Matrix* A, const Matrix* B);
  */
 Matrix* transpose(const Matrix* A);
 
+/**
+ * transpose into an existing At (A.col, A.row); At must not alias A
+ */
+void transpose_into(Matrix* At, const Matrix* A);
+
+/**
+ * transpose a square matrix in place, A = A^T
+ * @param A pointer to Matrix A (n, n)
+ */
+void transpose_inplace(Matrix* A);
+
 /**
  * Hadamard product C = A ⊙ B (element-wise multiplication)
  * @param A pointer to Matrix A
@@ -97,16 +323,71 @@ Matrix* transpose(const Matrix* A);
  */
 Matrix* hadamard(const Matrix* A, const Matrix* B);
 
+/**
+ * hadamard into an existing C of A's shape (C may alias A or B)
+ */
+void hadamard_into(Matrix* C, const Matrix* A, const Matrix* B);
+
 /**
  * Add row vector b to every row of Z (broadcasting)
  * Z = Z + b
  */
 void mat_add_bias(Matrix *Z, const Matrix *b);
 
+// adds the contribution of rows [start, end) into acc (width doubles)
+typedef void (*la_reduce_fn)(void* ctx, int start, int end, double* acc);
+
+// Per-thread scratch for temporaries that live only within one call, one slot
+// per kind. Slots grow on demand and are released at thread exit, so
+// steady-state calls don't allocate; a slot already in use on this thread
+// falls back to a fresh allocation.
+enum {
+    LA_SCRATCH_ACC, // full-precision GEMM accumulator
+    LA_SCRATCH_REDUCE, // la_reduce_rows partials
+    LA_SCRATCH_WIDE, // 16-bit operand widened to real_t
+    LA_SCRATCH_ROW, // one dense row
+    LA_SCRATCH_ACT, // activations of an inference pass
+    LA_SCRATCH_SPLIT, // GEMM k-split partial products
+    LA_SCRATCH_VEC, // gathered gemv operand or accumulator
+    LA_SCRATCH_SLOTS
+};
+
+/**
+ * LA_ALIGN-aligned room for bytes from this thread's scratch slot
+ * @param which slot (LA_SCRATCH_*)
+ * @param bytes size needed
+ * @return pointer to hand back with la_scratch_put, or NULL on failure
+ */
+void* la_scratch_get(int which, size_t bytes);
+
+/**
+ * Return memory from la_scratch_get
+ */
+void la_scratch_put(int which, void* p);
+
+/**
+ * Parallel sum over rows [0, n). The rows are cut into blocks whose bounds
+ * depend only on n and grain; each block accumulates into its own zeroed,
+ * cache-line aligned partial, and the partials are added in block order,
+ * so the result is the same for any number of threads.
+ * @param n number of rows
+ * @param width number of doubles accumulated
+ * @param grain smallest block worth its own partial, in rows
+ * @param fn block body, called as fn(ctx, start, end, acc)
+ * @param ctx shared arguments for fn
+ * @param out receives the width sums
+ */
+void la_reduce_rows(int n, int width, int grain, la_reduce_fn fn, void* ctx, double* out);
+
 /**
  * Sum rows of dA to produce a row vector db
  * db[j] = sum_i(dA[i][j])
  */
 Matrix* mat_sum_rows(const Matrix *dA);
 
+/**
+ * mat_sum_rows into an existing row vector db (1, dA.col)
+ */
+void mat_sum_rows_into(Matrix *db, const Matrix *dA);
+
 #endif // LA_LINALG_H
\ No newline at end of file
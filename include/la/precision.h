@@ -0,0 +1,16 @@
+#ifndef LA_PRECISION_H
+#define LA_PRECISION_H
+
+// Element type of every Matrix. The default build is float64; building with
+// -DNNC_FLOAT32 (make PRECISION=float) switches the whole library to float32,
+// doubling SIMD width and halving memory traffic. Scalars passed to the API
+// (learning rates, BLAS alpha/beta, losses) stay double either way.
+#ifdef NNC_FLOAT32
+typedef float real_t;
+#define REAL_NAME "float32"
+#else
+typedef double real_t;
+#define REAL_NAME "float64"
+#endif
+
+#endif // LA_PRECISION_H
@@ -0,0 +1,129 @@
+#ifndef LA_SPARSE_H
+#define LA_SPARSE_H
+
+#include "linalg.h"
+
+// Compressed sparse row Matrix (row, col). The represented matrix is
+// S - 1 * center, where S holds the stored values and center is a dense row
+// subtracted from every row, so shifting features (z-scoring) keeps the
+// zeros of S implicit. Products against it cost O(nnz * n) plus one dense
+// row, never O(row * col * n).
+typedef struct {
+    int row, col;
+    int nnz;
+    int* row_ptr; // (row + 1) start of each row in col_idx / val (row_ptr[0] is 0 unless a view)
+    int* col_idx; // (nnz) column of each stored value, ascending within a row
+    real_t* val; // (nnz)
+    // column index over the same values, for products with A^T: column j holds
+    // entries col_ptr[j] .. col_ptr[j + 1] - 1, at row col_row[k] with value val[col_pos[k]]
+    int *col_ptr, *col_row, *col_pos;
+    real_t* center; // (col) dense row subtracted from every row, or NULL
+    int view; // row_ptr / col_idx / val belong to another CsrMatrix
+} CsrMatrix;
+
+/**
+ * Create CsrMatrix (row, col) with room for nnz values. Fill row_ptr,
+ * col_idx and val, then call csr_finish.
+ * @param row number of rows
+ * @param col number of columns
+ * @param nnz number of stored values
+ * @return pointer to created CsrMatrix, or NULL on failure
+ */
+CsrMatrix* create_csr(int row, int col, int nnz);
+
+/**
+ * Build the column index once row_ptr / col_idx are filled in
+ * @param A pointer to CsrMatrix
+ * @return 0 on success, -1 on allocation failure
+ */
+int csr_finish(CsrMatrix* A);
+
+/**
+ * Rows [row0, row0 + n) of A without copying the stored values: the view
+ * shares A's row_ptr, col_idx and val (writes go to A) and holds its own
+ * column index and center. A must outlive the view.
+ * @param A pointer to CsrMatrix A
+ * @param row0 first row
+ * @param n number of rows
+ * @return pointer to CsrMatrix (n, A->col), or NULL on failure
+ */
+CsrMatrix* csr_view_rows(const CsrMatrix* A, int row0, int n);
+
+/**
+ * Free sparse matrix (a view frees only what it owns)
+ * @param A pointer to CsrMatrix to free
+ */
+void free_csr(CsrMatrix* A);
+
+/**
+ * CsrMatrix holding the non-zero entries of a dense Matrix
+ * @param A pointer to Matrix A
+ * @return pointer to CsrMatrix, or NULL on failure
+ */
+CsrMatrix* csr_from_dense(const Matrix* A);
+
+/**
+ * Dense copy of a sparse matrix (center applied)
+ * @param A pointer to CsrMatrix A
+ * @return pointer to Matrix, or NULL on failure
+ */
+Matrix* csr_to_dense(const CsrMatrix* A);
+
+/**
+ * Expand one row of A (center applied) into out (A->col)
+ */
+void csr_row_dense(const CsrMatrix* A, int i, real_t* out);
+
+/**
+ * CsrMatrix made of rows[0..n) of A, in that order
+ * @param A pointer to CsrMatrix A
+ * @param rows row indices into A
+ * @param n number of rows to take
+ * @return pointer to CsrMatrix (n, A->col), or NULL on failure
+ */
+CsrMatrix* csr_select_rows(const CsrMatrix* A, const int* rows, int n);
+
+/**
+ * sparse-dense product act(A * B + bias), computed one output row at a time
+ * @param A pointer to CsrMatrix A (m, k)
+ * @param B dense operand (k, n) at either precision
+ * @param bias pointer to row vector (1, n), or NULL
+ * @param act activation applied after the bias
+ * @param Z if not NULL, receives a new Matrix with the pre-activation A * B + bias
+ *          (only used when act is not LA_ACT_NONE)
+ * @return pointer to act(A * B + bias), or NULL on failure
+ */
+Matrix* spmm_bias_act(const CsrMatrix* A, MatRef B, const Matrix* bias, LaAct act, Matrix** Z);
+
+/**
+ * spmm_bias_act into existing outputs
+ * @param Y receives act(A * B + bias) (A.row, B.col)
+ * @param Z if not NULL, receives the pre-activation (only used when act is not LA_ACT_NONE)
+ * @return 0 on success, -1 if scratch space can't be allocated
+ */
+int spmm_bias_act_into(Matrix* Y, Matrix* Z, const CsrMatrix* A, MatRef B, const Matrix* bias, LaAct act);
+
+/**
+ * sparse-dense product C = A * B
+ * @param A pointer to CsrMatrix A (m, k)
+ * @param B pointer to Matrix B (k, n)
+ * @return pointer to Matrix C (m, n), or NULL on failure
+ */
+Matrix* spmm(const CsrMatrix* A, const Matrix* B);
+
+/**
+ * sparse-dense product C = A^T * B through the column index, one output row
+ * per column of A
+ * @param A pointer to CsrMatrix A (k, m)
+ * @param B pointer to Matrix B (k, n)
+ * @return pointer to Matrix C (m, n), or NULL on failure
+ */
+Matrix* spmm_tn(const CsrMatrix* A, const Matrix* B);
+
+/**
+ * spmm_tn into an existing C (A.col, B.col)
+ * @return 0 on success, -1 if scratch space can't be allocated
+ */
+int spmm_tn_into(Matrix* C, const CsrMatrix* A, const Matrix* B);
+
+#endif // LA_SPARSE_H
@@ -2,43 +2,200 @@
 #define NN_H
 
 #include "la/linalg.h"
+#include "la/sparse.h"
 #include "optax.h"
 #include "act.h"
 
+// One dense layer: A = act(A_prev * W + b)
 typedef struct {
-    Matrix *W1, *b1;
-    Matrix *W2, *b2;
-    Matrix *W3, *b3;
-    Matrix *W4, *b4;
+    Matrix *W, *b; // (in, out) and (1, out), views into NN.params
+    Activation act;
+    HalfMatrix *Wh; // 16-bit shadow of W in storage mode, else NULL
+} Layer;
+
+typedef struct {
+    int n_layers;
+    Layer *layer; // input to output
+    // every W and b back to back in one (1, n) arena, each starting on a cache
+    // line, so an optimizer step is a single pass over the parameters
+    Matrix *params;
+    // 16-bit storage mode (NNC_STORAGE); W stays the full-precision master copy
+    // and Wh is the rounded shadow the forward and backward GEMMs read from
+    HalfFormat storage;
 } NN;
 
 typedef struct {
-    Matrix *Z1, *A1;
-    Matrix *Z2, *A2;
-    Matrix *Z3, *A3;
-    Matrix *Z4, *A4;
+    int n_layers;
+    // per layer activation A; hidden layers use Ah instead in 16-bit storage
+    // mode, and the output layer is always full precision. No pre-activation
+    // is kept: the ReLU backward masks with A > 0, which is exactly Z > 0
+    Matrix **A;
+    HalfMatrix **Ah;
+    // forward_sparse in 16-bit mode: layer 1 at full precision before rounding
+    Matrix *A0f;
 } Cache;
 
 typedef struct {
-    Matrix *dW1, *db1;
-    Matrix *dW2, *db2;
-    Matrix *dW3, *db3;
-    Matrix *dW4, *db4;
+    int n_layers;
+    Matrix **dW, **db; // per layer, views into params
+    Matrix *params; // arena laid out like NN.params
 } Grad;
 
+// Every buffer of a training step for up to max_batch rows, allocated once.
+// Buffers whose lifetimes within a step don't overlap share storage (e.g. a
+// dZ reuses the slot of an activation the backward pass is done with), so
+// steady-state steps allocate nothing. Only each layer's output is kept: the
+// ReLU backward masks with A > 0, which matches Z > 0 exactly. Under a memory
+// budget only some hidden activations are kept (checkpoints); the backward
+// pass recomputes the rest from the nearest one below. Each run of dropped
+// layers is recomputed into its own block that lives only while that run's
+// gradients are formed, apart from the block its forward pass wrote.
+typedef struct {
+    int n_layers, max_batch;
+    Cache *cache; // views into arena, bound to a batch by workspace_cache
+    Grad *grad;
+    Matrix **dZ; // per layer gradient of Z, views into arena
+    Matrix *arena;
+    size_t bytes, unshared_bytes; // arena size, and what separate buffers would take
+    char *keep; // per layer: activation kept through the step (always the output)
+    // per layer, then the sparse layer 1 output at [n_layers]: where a dropped
+    // activation is written by the forward pass and where the backward pass
+    // recomputes it (NULL for kept ones)
+    void **drop_at, **redo_at;
+    size_t full_bytes; // arena size keeping every activation
+    double recompute; // forward work redone per step, as a fraction of a forward pass
+} Workspace;
+
 // Initialization
+/**
+ * Create a network from a list of layers
+ * @param input width of the input
+ * @param n_layers number of layers, the last one being the output
+ * @param width output width of each layer (n_layers)
+ * @param act activation of each layer (n_layers)
+ * @return pointer to NN, or NULL on failure
+ */
+NN* net_create_layers(int input, int n_layers, const int *width, const Activation *act);
+
+/**
+ * Three ReLU hidden layers and a linear output layer
+ */
 NN* net_create(int input, int hidden1, int hidden2, int hidden3, int output);
 void net_free(NN *net);
 
+/**
+ * Switch the weights and hidden activations used by forward/backward to
+ * 16-bit storage (HALF_NONE restores full precision). Accumulation and the
+ * master weights remain full precision.
+ * @return 0, or -1 if the weight shadows cannot be allocated; the network is
+ *         then left in full precision
+ */
+int net_set_storage(NN *net, HalfFormat fmt);
+
+/**
+ * Refresh the 16-bit weight shadows from the master weights; call after
+ * any optimizer step that bypasses sgd_update
+ */
+void net_sync_storage(NN *net);
+
 // Forward Pass
 Cache* forward(NN *net, const Matrix *X);
+
+/**
+ * Empty Cache for forward_into; buffers are sized on first use
+ */
+Cache* cache_create(void);
+
+/**
+ * Forward pass into an existing Cache, reusing its buffers when the batch
+ * shape matches the previous call and (re)allocating only those that don't
+ */
+void forward_into(NN *net, const Matrix *X, Cache *cache);
+
+/**
+ * Forward pass from CSR input: layer 1 is a sparse-dense product, so its
+ * cost scales with X->nnz instead of n_samples * n_features
+ */
+Cache* forward_sparse(NN *net, const CsrMatrix *X);
+void forward_sparse_into(NN *net, const CsrMatrix *X, Cache *cache);
 void cache_free(Cache *cache);
 
+/**
+ * Network output of a forward pass, (n_samples, output)
+ */
+Matrix* cache_output(const Cache *cache);
+
+/**
+ * Inference-only forward pass: the network output for X, written into Y. Rows
+ * go through in fixed-size chunks, in parallel, each chunk holding just two
+ * activation buffers, so memory stays bounded however many rows X has.
+ * Matches cache_output of forward in every storage mode.
+ * @param net pointer to neural network
+ * @param X input (n_samples, input)
+ * @param Y receives the predictions (n_samples, output)
+ */
+void predict(NN *net, const Matrix *X, Matrix *Y);
+
+/**
+ * predict from CSR input
+ */
+void predict_sparse(NN *net, const CsrMatrix *X, Matrix *Y);
+
+/**
+ * Plan and allocate a Workspace for net in its current storage mode
+ * @param net network the workspace is for (its layer shapes and storage mode)
+ * @param max_batch largest number of rows a step will see
+ * @return pointer to Workspace, or NULL on failure
+ */
+Workspace* workspace_create(const NN *net, int max_batch);
+
+/**
+ * workspace_create within a memory budget: when keeping every activation
+ * would take more than budget bytes, checkpoints are chosen to fit it with
+ * the least recomputation (or, if nothing fits, to use the least memory).
+ * A plan saving less than the smallest activation it drops is not taken;
+ * every activation is kept and the budget is left unmet.
+ * Losses and gradients are the same as with every activation kept.
+ * @param budget arena size limit in bytes, 0 for none
+ */
+Workspace* workspace_create_budget(const NN *net, int max_batch, size_t budget);
+
+/**
+ * Bind the workspace to a batch of m <= max_batch rows
+ * @return its Cache, for forward_into / forward_sparse_into
+ */
+Cache* workspace_cache(Workspace *ws, int m);
+
+/**
+ * Backward pass into ws->grad for the batch last run through workspace_cache,
+ * with every dZ in the workspace; X or Xs is the network input
+ */
+void workspace_backward(NN *net, const Matrix *X, const CsrMatrix *Xs, const Matrix *Y_true, Workspace *ws);
+
+void workspace_free(Workspace *ws);
+
 // Loss
 double mse(const Matrix *Y_pred, const Matrix *Y_true);
 
 // Backward Pass
 Grad* backward(NN *net, const Matrix *X, const Matrix *Y_true, Cache *cache);
+
+/**
+ * Empty Grad for backward_into; buffers are sized on first use
+ */
+Grad* grad_create(void);
+
+/**
+ * Backward pass into an existing Grad, reusing its buffers
+ */
+void backward_into(NN *net, const Matrix *X, const Matrix *Y_true, Cache *cache, Grad *grads);
+
+/**
+ * Backward pass for a cache from forward_sparse; dW1 = X^T dZ1 is a
+ * sparse-dense product
+ */
+Grad* backward_sparse(NN *net, const CsrMatrix *X, const Matrix *Y_true, Cache *cache);
+void backward_sparse_into(NN *net, const CsrMatrix *X, const Matrix *Y_true, Cache *cache, Grad *grads);
 void grad_free(Grad *grads);
 
 // Update
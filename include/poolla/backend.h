@@ -0,0 +1,63 @@
+#ifndef POOLLA_BACKEND_H
+#define POOLLA_BACKEND_H
+
+#include "poolla/blas.h"
+
+// A BLAS implementation behind one interface. Matrices are row-major with
+// row stride ld; vectors are column vectors (n, 1), element i at data[i * ld]. Scalars are double and rounded to real_t
+// by the implementation.
+typedef struct {
+    const char *name;
+    // C := alpha * op(A) * op(B) + beta * C
+    void (*gemm)(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+                 double alpha, const Matrix *A, const Matrix *B, double beta, Matrix *C);
+    // y := alpha * op(A) * x + beta * y
+    void (*gemv)(ThreadPool *pool, BlasTrans transA,
+                 double alpha, const Matrix *A, const Matrix *x, double beta, Matrix *y);
+    // y := alpha * x + y
+    void (*axpy)(ThreadPool *pool, double alpha, const Matrix *x, Matrix *y);
+    // x := alpha * x
+    void (*scal)(ThreadPool *pool, double alpha, Matrix *x);
+} BlasBackend;
+
+/**
+ * @brief Straightforward loops accumulating in double; the conformance oracle.
+ */
+const BlasBackend* blas_backend_reference(void);
+
+/**
+ * @brief The in-house blocked and SIMD kernels (poolla/blas.h).
+ */
+const BlasBackend* blas_backend_native(void);
+
+/**
+ * @brief A system CBLAS loaded at runtime, or NULL if none is installed.
+ * NNC_CBLAS_LIB names the shared library to try first.
+ */
+const BlasBackend* blas_backend_cblas(void);
+
+/**
+ * @brief Backend by name ("reference", "native", "cblas"), or NULL.
+ */
+const BlasBackend* blas_backend_find(const char *name);
+
+/**
+ * @brief Backend used by matmul and friends: NNC_BLAS if set and available,
+ * else native. Chosen on first call.
+ */
+const BlasBackend* blas_backend(void);
+
+/**
+ * @brief Switch the active backend; call while no linear algebra is running.
+ */
+void blas_set_backend(const BlasBackend *backend);
+
+/**
+ * @brief Check every available backend against the reference on fixed and
+ * random shapes and print max error and GFLOP/s per shape.
+ * @param seed seed for the random shapes and data
+ * @return number of failed checks
+ */
+int blas_conformance(unsigned seed);
+
+#endif // POOLLA_BACKEND_H
@@ -5,9 +5,63 @@
 #include "la/linalg.h"
 // Note: All functions now take a ThreadPool pointer as the first argument.
 
+typedef enum {
+    BLAS_NO_TRANS = 0,
+    BLAS_TRANS = 1,
+} BlasTrans;
+
+// work fused into GEMM's write-back, applied in this order to each finished element of C
+typedef struct {
+    const Matrix *bias; // (1, n) row added to every row of C, or NULL
+    HalfMatrix *z_half; // (m, n): also round the pre-activation into 16-bit storage, or NULL
+    int relu; // apply max(x, 0) after the bias
+    Matrix *relu_out; // with relu: activations go here and C keeps the pre-activation; NULL is in place
+    HalfMatrix *relu_half; // with relu: activations rounded here instead of relu_out
+    MatRef mask; // (m, n) at either precision: zero C wherever mask <= 0 (ReLU backward); unset if empty
+} BlasEpilogue;
+
+// int8 weights packed for qgemm: column tiles of the kernel's qnr outputs, each
+// holding 4 consecutive depths per output so one 32-bit lane meets one broadcast quad
+typedef struct {
+    int k, n; // depth and output columns
+    int kq; // depth in groups of 4 (zero padded)
+    int nr; // column tile the panel was packed for
+    int8_t *data;
+} QPackedB;
+
+// requantization fused into qgemm's write-back; t = acc + bias[j], then either
+// out[i][j] = clamp(round(t * mult[j] / 2^shift[j]), 0, 127), where the clamp also
+// applies the ReLU, or y[i][j] = relu?(t) * scale[j]
+typedef struct {
+    const int32_t *bias; // per output column, or NULL
+    int relu; // apply max(t, 0) to y
+    const int32_t *mult; // fixed-point multipliers for u8 output, with shift
+    const int *shift; // each >= 1
+    uint8_t *out; // u8 output (row stride ldo), or NULL
+    size_t ldo;
+    const double *scale; // dequantization scales for real output, with y
+    real_t *y; // real output (row stride ldy), or NULL
+    size_t ldy;
+} QgemmEpilogue;
+
 void dsv(ThreadPool *pool, double a, Matrix *x, double b);
 void dvv(ThreadPool *pool, double a, const Matrix *A, double b, Matrix *B);
 void dmv(ThreadPool *pool, double a, const Matrix *A, const Matrix *B, double b, Matrix *C);
+void dmtv(ThreadPool *pool, double a, const Matrix *A, const Matrix *x, double b, Matrix *y);
 void* dmm(ThreadPool *pool, double a, const Matrix *A, const Matrix *B, double b, Matrix *C);
+void dgemm(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+           double a, const Matrix *A, const Matrix *B, double b, Matrix *C);
+void dgemm_ep(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+              double a, const Matrix *A, const Matrix *B, double b, Matrix *C,
+              const BlasEpilogue *ep);
+void dgemm_ref(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+               double a, MatRef A, MatRef B, double b, Matrix *C,
+               const BlasEpilogue *ep);
+void dgemm_epilogue(ThreadPool *pool, Matrix *C, const BlasEpilogue *ep);
+
+QPackedB* qgemm_pack(int k, int n, const int8_t *W, size_t ldw);
+void qpacked_free(QPackedB *B);
+void qgemm(ThreadPool *pool, int m, const uint8_t *A, size_t lda, const QPackedB *B,
+           int32_t *C, size_t ldc, const QgemmEpilogue *ep);
 
 #endif // LA_BLAS_H
\ No newline at end of file
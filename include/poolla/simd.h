@@ -0,0 +1,68 @@
+#ifndef POOLLA_SIMD_H
+#define POOLLA_SIMD_H
+
+#include <stddef.h>
+#include "la/precision.h"
+#include "la/half.h"
+
+typedef enum {
+    ISA_SCALAR = 0,
+    ISA_AVX2, // AVX2 + FMA + F16C (+ AVX-VNNI for int8 when present)
+    ISA_AVX512, // AVX-512F (+ BW / VNNI for int8 when present)
+} SimdIsa;
+
+#define SIMD_TR_MAX 16 // largest transpose tile of any ISA
+
+// Vector kernels for one instruction set. All take contiguous arrays of n real_t
+// elements; scalar arguments are double and rounded to real_t by the kernel.
+typedef struct {
+    SimdIsa isa;
+    const char *name;
+
+    // GEMM register tile: C[0:mr, 0:nr] = alpha * Ap * Bp + beta * C, where Ap holds
+    // kc columns of mr_max packed rows and Bp kc rows of nr_max packed columns
+    int mr, nr, mc; // tile height/width and rows per packed A block
+    void (*gemm_micro)(int kc, const real_t *Ap, const real_t *Bp, real_t *C, size_t ldc,
+                       int mr, int nr, double alpha, double beta);
+
+    double (*dot)(int n, const real_t *x, const real_t *y); // sum x[i] * y[i]
+    void (*axpby)(int n, double a, const real_t *x, double b, real_t *y); // y = a*x + b*y
+    void (*scal_add)(int n, double a, double b, real_t *x); // x = a*x + b
+    void (*add)(int n, const real_t *x, real_t *y); // y += x
+    void (*relu)(int n, const real_t *z, real_t *a); // a = max(z, 0)
+    void (*drelu)(int n, const real_t *z, const real_t *dz, real_t *out); // out = z > 0 ? dz : 0
+    // drelu with a 16-bit z of either format, tested without widening: as a signed
+    // 16-bit integer z is > 0 exactly when its value is (NaN aside)
+    void (*drelu_half)(int n, const uint16_t *z, const real_t *dz, real_t *out);
+    // Adam step with bias corrections c1 = 1 - b1^t, c2 = 1 - b2^t
+    void (*adam)(int n, double lr, double b1, double b2, double eps, double c1, double c2,
+                 const real_t *g, real_t *m, real_t *v, real_t *w);
+    // B[0:tr, 0:tr] = A[0:tr, 0:tr]^T for one square tile, done in registers (tr <= SIMD_TR_MAX)
+    int tr;
+    void (*transpose)(const real_t *A, size_t lda, real_t *B, size_t ldb);
+
+    // 16-bit storage (la/half.h): h = round(x) and x = widen(h)
+    void (*to_half)(int n, HalfFormat fmt, const real_t *x, uint16_t *h);
+    void (*from_half)(int n, HalfFormat fmt, const uint16_t *h, real_t *x);
+
+    // int8 GEMM tile (poolla/blas.h qgemm): T[0:qmr, 0:qnr] = A * Bp over kq groups of
+    // 4 depths. A holds u8 rows with values <= 127 (row stride lda); rows past mr repeat
+    // the last valid one. Bp is one qgemm_pack column tile of s8 weights.
+    int qmr, qnr;
+    void (*qgemm_micro)(int kq, const uint8_t *A, size_t lda, int mr, const int8_t *Bp, int32_t *T);
+    // out = clamp(round(t * mult / 2^shift), 0, 127) with shift >= 1
+    void (*requant)(int n, const int32_t *t, const int32_t *mult, const int *shift, uint8_t *out);
+} SimdKernels;
+
+/**
+ * @brief Kernels for the best ISA this CPU supports, chosen on first call.
+ * NNC_ISA=scalar|avx2|avx512 forces a specific one (if supported).
+ */
+const SimdKernels* simd_kernels(void);
+
+/**
+ * @brief Kernels for a specific ISA, or NULL if this CPU can't run them.
+ */
+const SimdKernels* simd_kernels_for(SimdIsa isa);
+
+#endif // POOLLA_SIMD_H
@@ -2,29 +2,98 @@
 #define THREADPOOLLA_BLAS_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "ws_deque.h"
+
+// completion latch for a set of tasks that can be waited on independently
+typedef struct TaskGroup {
+    atomic_int pending; // tasks submitted into the group and not yet finished
+} TaskGroup;
 
 typedef struct Task {
     void (*function) (void *arg);
     void *args;
+    TaskGroup *group; // latch to release on completion, or NULL
+    long submit_ns; // monotonic submit time, for wake latency
+    int heap; // allocated by the pool and freed once run; 0 for caller-owned tasks
     struct Task *next;
 } Task;
 
+// body of a parallel loop, called with a half-open index range [start, end)
+typedef void (*parallel_fn) (void *ctx, int start, int end);
+
+typedef struct ParallelJob {
+    parallel_fn fn;
+    void *ctx;
+    int n, grain; // index space and chunk size
+    atomic_int next; // next unclaimed index
+    atomic_int refs; // workers currently inside the job
+    long publish_ns; // monotonic publish time, for wake latency
+} ParallelJob;
+
+// scheduling modes for submitted tasks
+typedef enum {
+    TP_MODE_FIFO = 0, // one shared queue under pool->lock
+    TP_MODE_STEAL, // per-worker Chase-Lev deques, idle workers steal
+} ThreadPoolMode;
+
+// how idle workers and waiting callers wait for something to happen
+typedef enum {
+    TP_WAIT_PARK = 0, // sleep on the condition variable straight away
+    TP_WAIT_ADAPTIVE, // spin with pause, then sched_yield, then sleep
+} ThreadPoolWait;
+
+typedef struct ThreadPoolStats {
+    long executed; // tasks run by workers
+    long steals; // tasks taken from another worker's deque
+    long wakes; // work picked up by a worker that was idle (latency tracking only)
+    long parks; // times a thread fell through spinning into a condvar sleep
+    long wake_ns_total, wake_ns_max; // publish-to-pickup latency of those wakes
+} ThreadPoolStats;
+
 typedef struct ThreadPool {
     pthread_mutex_t lock; // Mutex for synchronizing access to the task queue
     pthread_cond_t notify; // Condition variable for notifying worker threads of new tasks
     pthread_cond_t working; // Condition variable for notifying when all tasks are done
     pthread_t *threads; // Array of worker threads
-    Task *head, *tail; // Head and tail of the task queue
-    int tcount, active, shutdown; // Thread count, active task count, and shutdown flag
+    Task *head, *tail; // Head and tail of the task queue (injection queue in steal mode)
+    int tcount; // Thread count
+    atomic_int shutdown; // shutdown flag
+    atomic_int active; // submitted tasks not yet finished
+    ThreadPoolMode mode;
+    WSDeque *deques; // one per worker in steal mode, NULL otherwise
+    atomic_int queued; // tasks sitting in the shared queue
+    atomic_int idle; // workers parked on notify
+    atomic_int waiters; // threads parked on working inside a group wait
+    atomic_int next_id; // hands out worker ids at startup
+    atomic_int wait_policy; // ThreadPoolWait
+    atomic_int spin_count, yield_count; // adaptive budgets before parking
+    atomic_int track_latency; // timestamp submits/jobs to measure wake latency
+    atomic_long executed, steals, wakes, parks, wake_ns_total, wake_ns_max;
+    ParallelJob *job; // parallel loop currently in flight, NULL if none
+    atomic_ulong job_seq; // bumped on every published job so workers join it once
 } ThreadPool;
 
 /**
  * @brief Initializes a thread pool with a specified number of threads.
- * @param nthreads Number of threads to create in the pool.
+ * @param nthreads Number of threads to create in the pool. With 0, tasks
+ *        and loops run on the threads that submit or wait for them.
  * @return pointer to the initialized ThreadPool structure, or NULL on failure.
  */
 ThreadPool* threadpool_init(int nthreads);
 
+/**
+ * @brief Initializes a thread pool with an explicit scheduling mode.
+ * In TP_MODE_STEAL, tasks submitted from a worker go to that worker's own
+ * deque and idle workers steal from the others; tasks submitted from
+ * outside the pool go through the shared queue.
+ * @param nthreads Number of threads to create in the pool.
+ * @param mode TP_MODE_FIFO or TP_MODE_STEAL.
+ * @return pointer to the initialized ThreadPool structure, or NULL on failure.
+ */
+ThreadPool* threadpool_init_mode(int nthreads, ThreadPoolMode mode);
+
 /**
  * @brief submits a new task to the thread pool.
  * @param pool Pointer to the ThreadPool structure.
@@ -33,13 +102,103 @@ ThreadPool* threadpool_init(int nthreads);
  */
 void threadpool_submit(ThreadPool *pool, void (*function)(void *), void *args);
 
+/**
+ * @brief Sets how idle workers, threadpool_wait and the other joins wait.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param policy TP_WAIT_PARK or TP_WAIT_ADAPTIVE.
+ * @param spins Busy-wait iterations (with a pause each) before yielding.
+ * @param yields sched_yield rounds before parking on the condition variable.
+ */
+void threadpool_set_wait(ThreadPool *pool, ThreadPoolWait policy, int spins, int yields);
+
+/**
+ * @brief Pins worker i to cpus[i % ncpus].
+ * @param pool Pointer to the ThreadPool structure.
+ * @param cpus CPU ids to pin to.
+ * @param ncpus Number of entries in cpus.
+ * @return 0 on success, -1 if any worker could not be pinned.
+ */
+int threadpool_pin(ThreadPool *pool, const int *cpus, int ncpus);
+
+/**
+ * @brief Turns wake-latency measurement on or off (off by default).
+ * While on, every submit and parallel loop is timestamped.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param on Non-zero to enable.
+ */
+void threadpool_track_latency(ThreadPool *pool, int on);
+
+/**
+ * @brief Initializes an empty task group.
+ * @param group Pointer to the group, usually on the caller's stack.
+ */
+void threadpool_group_init(TaskGroup *group);
+
+/**
+ * @brief submits a task whose completion is tracked by group.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param group Group to add the task to.
+ * @param function Function pointer representing the task to be executed.
+ * @param args Arguments to be passed to the task function.
+ */
+void threadpool_submit_group(ThreadPool *pool, TaskGroup *group, void (*function)(void *), void *args);
+
+/**
+ * @brief submits a task into group using storage owned by the caller, so no
+ * allocation is made. The task must stay valid until the group has been waited on.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param group Group to add the task to.
+ * @param task Task storage, usually on the caller's stack next to the group.
+ * @param function Function pointer representing the task to be executed.
+ * @param args Arguments to be passed to the task function.
+ */
+void threadpool_submit_task(ThreadPool *pool, TaskGroup *group, Task *task, void (*function)(void *), void *args);
+
+/**
+ * @brief waits until every task in group has finished.
+ * The waiting thread runs queued tasks while it waits, so it is safe to
+ * call from inside a task and other groups keep making progress.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param group Group to wait on.
+ */
+void threadpool_group_wait(ThreadPool *pool, TaskGroup *group);
+
+/**
+ * @brief Runs fn over [0, n) split into chunks of at least grain indices.
+ * Workers are woken once and claim chunks from a shared atomic counter; the
+ * calling thread takes chunks too and returns once every chunk is done.
+ * Small ranges, and calls made while another loop is in flight, run inline.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param n Number of indices.
+ * @param grain Smallest chunk worth handing to another thread (<= 0 for 1).
+ * @param fn Loop body, called as fn(ctx, start, end).
+ * @param ctx Shared, read-only arguments for fn.
+ */
+void threadpool_parallel_for(ThreadPool *pool, int n, int grain, parallel_fn fn, void *ctx);
+
 /** 
  * @brief waits for all tasks in the thread pool to complete.
+ * Called from inside a task, it waits only for the tasks that task
+ * submitted (they are joined automatically when it returns anyway).
  * @param pool Pointer to the ThreadPool structure.
  * @return void   
 */
 void threadpool_wait(ThreadPool *pool);
 
+/**
+ * @brief Snapshot of the pool counters.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param stats Output counters.
+ */
+void threadpool_stats(ThreadPool *pool, ThreadPoolStats *stats);
+
+/**
+ * @brief Prints the pool counters, including mean/max wake latency.
+ * @param pool Pointer to the ThreadPool structure.
+ * @param fp Stream to print to.
+ */
+void threadpool_print_stats(ThreadPool *pool, FILE *fp);
+
 /**
  * @brief Destroys the thread pool, freeing all associated resources.
  * @param pool Pointer to the ThreadPool structure.
@@ -47,4 +206,4 @@ void threadpool_wait(ThreadPool *pool);
  */
 void threadpool_destroy(ThreadPool *pool);
 
-#endif //THREADPOOLLA_BLAS_H
\ No newline at end of file
+#endif //THREADPOOLLA_BLAS_H
@@ -0,0 +1,34 @@
+#ifndef POOLLA_TOPOLOGY_H
+#define POOLLA_TOPOLOGY_H
+
+// CPUs this process may run on, as seen through sched_getaffinity and sysfs
+typedef struct {
+    int ncpus; // logical CPUs in the affinity mask
+    int ncores; // distinct physical cores among them
+    int npackages; // distinct sockets among them
+    int nnodes; // NUMA nodes among them
+    int *order; // ncpus CPU ids: one per physical core first, sockets interleaved, then SMT siblings
+} CpuTopology;
+
+/**
+ * @brief Discovers the CPUs available to the process.
+ * Falls back to treating every allowed CPU as its own core when sysfs is unreadable.
+ * @param topo Output topology, release with topology_free.
+ * @return 0 on success, -1 on failure.
+ */
+int topology_discover(CpuTopology *topo);
+
+/**
+ * @brief Frees the CPU order list.
+ * @param topo Topology filled by topology_discover.
+ */
+void topology_free(CpuTopology *topo);
+
+/**
+ * @brief Pins the calling thread to a single CPU.
+ * @param cpu CPU id.
+ * @return 0 on success, -1 on failure.
+ */
+int topology_pin_self(int cpu);
+
+#endif // POOLLA_TOPOLOGY_H
@@ -0,0 +1,59 @@
+#ifndef POOLLA_WS_DEQUE_H
+#define POOLLA_WS_DEQUE_H
+
+#include <stdatomic.h>
+
+// Chase-Lev work-stealing deque of opaque pointers.
+// The owning thread pushes and takes at the bottom; any thread steals from the top.
+
+typedef struct WSArray {
+    long size; // capacity, always a power of two
+    struct WSArray *prev; // retired buffers, freed with the deque
+    _Atomic(void*) buf[];
+} WSArray;
+
+typedef struct WSDeque {
+    atomic_long top, bottom;
+    _Atomic(WSArray*) array;
+} WSDeque;
+
+// returned by ws_deque_steal when it lost a race and the caller may retry
+#define WS_ABORT ((void*) -1)
+
+/**
+ * @brief Initializes an empty deque.
+ * @param dq Pointer to the deque.
+ * @param capacity Initial capacity, rounded up to a power of two.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int ws_deque_init(WSDeque *dq, long capacity);
+
+/**
+ * @brief Pushes an item at the bottom. Owner thread only; grows as needed.
+ * @return 0 on success, -1 if growing the buffer failed.
+ */
+int ws_deque_push(WSDeque *dq, void *item);
+
+/**
+ * @brief Pops the most recently pushed item. Owner thread only.
+ * @return the item, or NULL if the deque is empty.
+ */
+void* ws_deque_take(WSDeque *dq);
+
+/**
+ * @brief Steals the oldest item. Safe from any thread.
+ * @return the item, NULL if empty, or WS_ABORT if another thread won the race.
+ */
+void* ws_deque_steal(WSDeque *dq);
+
+/**
+ * @brief Approximate number of items, for idle checks.
+ */
+long ws_deque_size(WSDeque *dq);
+
+/**
+ * @brief Frees the deque buffers. Items still inside are not touched.
+ */
+void ws_deque_destroy(WSDeque *dq);
+
+#endif // POOLLA_WS_DEQUE_H
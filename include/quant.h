@@ -0,0 +1,70 @@
+#ifndef QUANT_H
+#define QUANT_H
+
+#include "nn.h"
+#include "data.h"
+#include "poolla/blas.h"
+
+// One int8 layer. Inputs are u8 codes q in [0, 127] standing for
+// in_scale * (q - in_zero); weights are s8 with one scale per output channel.
+typedef struct {
+    int in, out;
+    size_t ld; // bytes per input row (in rounded up to groups of 4)
+    double in_scale;
+    int in_zero;
+    QPackedB *W;
+    double *w_scale;
+    int32_t *bias; // bias at scale in_scale * w_scale[j], zero-point correction folded in
+    int32_t *mult; // hidden layers: fixed-point requantization to the next layer's codes
+    int *shift;
+    double *out_scale; // output layer: in_scale * w_scale[j]
+} QLayer;
+
+// Post-training int8 copy of an NN for scoring
+typedef struct {
+    int n_layers;
+    QLayer *layer;
+} QNN;
+
+// Quantized vs reference pass on the same data
+typedef struct {
+    double r2_ref, r2_quant; // R² of predict() and quant_forward()
+    double ms_ref, ms_quant; // wall time of one pass each
+} QuantReport;
+
+/**
+ * Quantize a trained network to int8. Hidden layers must be ReLU and the
+ * output layer linear, since the u8 codes between layers can't hold negatives.
+ * @param net trained network (weights are read, not modified)
+ * @param calib data to calibrate activation ranges on (dense or sparse), typically the training set
+ * @param n_samples rows of calib to use, spread evenly over it (<= 0 uses all)
+ * @return pointer to QNN, or NULL on failure or an unsupported activation
+ */
+QNN* quant_create(NN *net, const Dataset *calib, int n_samples);
+
+/**
+ * Int8 forward pass: bias and ReLU are applied to the int32 sums and requantized
+ * in fixed point; only the output layer is scaled back to real_t
+ * @param q quantized network
+ * @param X input data (n_samples, in)
+ * @return predictions (n_samples, out), or NULL if a buffer cannot be allocated
+ */
+Matrix* quant_forward(const QNN *q, const Matrix *X);
+
+/**
+ * Score X with both predict() and quant_forward()
+ * @param net reference network
+ * @param q its quantized copy
+ * @param X input data
+ * @param Y target data
+ * @return QuantReport with R² and timing for both
+ */
+QuantReport quant_evaluate(NN *net, const QNN *q, const Matrix *X, const Matrix *Y);
+
+/**
+ * Free quantized network
+ * @param q pointer to QNN
+ */
+void quant_free(QNN *q);
+
+#endif // QUANT_H
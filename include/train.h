@@ -61,9 +61,22 @@ void metrics_print(const MetricList *list, const char *label);
  * @param X_train training input data
  * @param Y_train training target data
  * @param lr learning rate
+ * @param ws workspace for at least X_train->row rows, or NULL to allocate for this call
  * @return TrainResult with loss and metrics
  */
-TrainResult train_epoch(NN *net, const Matrix *X_train, const Matrix *Y_train, double lr);
+TrainResult train_epoch(NN *net, const Matrix *X_train, const Matrix *Y_train, double lr, Workspace *ws);
+
+/**
+ * Train for one epoch on CSR input
+ * @param net pointer to neural network
+ * @param X_train sparse training input data
+ * @param Y_train training target data
+ * @param lr learning rate
+ * @param ws workspace for at least X_train->row rows, or NULL to allocate for this call
+ * @return TrainResult with loss and metrics
+ */
+TrainResult train_epoch_sparse(NN *net, const CsrMatrix *X_train, const Matrix *Y_train, double lr,
+                               Workspace *ws);
 
 /**
  * Compute RMSE from MSE loss
@@ -80,6 +93,15 @@ double compute_rmse(double mse_loss);
  */
 double compute_r_squared(const Matrix *Y_pred, const Matrix *Y_true);
 
+/**
+ * MSE and R-squared together, in one parallel pass over the rows
+ * @param Y_pred predicted values
+ * @param Y_true true values
+ * @param mse_loss receives the MSE, or NULL
+ * @param r_squared receives R-squared, or NULL
+ */
+void compute_metrics(const Matrix *Y_pred, const Matrix *Y_true, double *mse_loss, double *r_squared);
+
 /**
  * Generate synthetic regression data for testing
  * @param X output pointer for input matrix
@@ -89,4 +111,15 @@ double compute_r_squared(const Matrix *Y_pred, const Matrix *Y_true);
  */
 void generate_synthetic_data(Matrix **X, Matrix **Y, int n_samples, int n_features);
 
+/**
+ * Generate synthetic regression data from a fixed seed, so runs can be repeated
+ * @param X output pointer for input matrix
+ * @param Y output pointer for target matrix
+ * @param n_samples number of samples
+ * @param n_features number of features
+ * @param seed seed for rand()
+ */
+void generate_synthetic_data_seeded(Matrix **X, Matrix **Y, int n_samples, int n_features,
+                                    unsigned seed);
+
 #endif // TRAIN_H
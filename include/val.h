@@ -21,7 +21,17 @@ typedef struct {
 ValResult validate(NN *net, const Matrix *X_val, const Matrix *Y_val);
 
 /**
- * Split data into train and validation sets
+ * Validate the model on CSR input
+ * @param net pointer to neural network
+ * @param X_val sparse validation input data
+ * @param Y_val validation target data
+ * @return ValResult with loss and metrics
+ */
+ValResult validate_sparse(NN *net, const CsrMatrix *X_val, const Matrix *Y_val);
+
+/**
+ * Split data into train and validation sets, returned as views of X and Y's
+ * rows (free with free_matrix; X and Y must outlive them)
  * @param X input data
  * @param Y target data
  * @param X_train output pointer for training input
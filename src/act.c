@@ -1,72 +1,67 @@
 #include <math.h>
 #include <stdlib.h>
 #include "act.h"
+#include "poolla/simd.h"
 
 typedef struct {
     const Matrix* Z;
     const Matrix* dZ; // For backward
     Matrix* A;
-    int s, e;
+    int run; // contiguous run length (see mat_run)
 } act_args;
 
-static void relu_task(void *args) {
+// smallest chunk worth shipping to another thread, in elements
+#define ACT_MIN_GRAIN 4096
+
+static void relu_task(void *args, int s, int e) {
     act_args *a = (act_args*) args;
-    for(int i=a->s; i < a->e; i++) {
-        a->A->data[i] = fmax(0.0, a->Z->data[i]);
+    const SimdKernels *K = simd_kernels();
+    for(int k = s; k < e; ) {
+        int w = a->run - k % a->run;
+        if(w > e - k) w = e - k;
+        K->relu(w, mat_at(a->Z, a->run, k), mat_at(a->A, a->run, k));
+        k += w;
     }
-    free(a);
 }
 
-Matrix *relu(const Matrix *Z) {
-    Matrix *A = create_matrix(Z->row, Z->col);
-    if(!A) return NULL;    
+void relu_into(Matrix *A, const Matrix *Z) {
+    assert(A->row == Z->row && A->col == Z->col && "output dim != Z");
 
-    ThreadPool *tp = get_la_pool();
-    int total = Z->row * Z->col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
+    act_args args = { .Z = Z, .A = A, .run = mat_run(Z, A, NULL) };
+    threadpool_parallel_for(get_la_pool(), Z->row * Z->col, ACT_MIN_GRAIN, relu_task, &args);
+}
 
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
+Matrix *relu(const Matrix *Z) {
+    Matrix *A = create_matrix_uninit(Z->row, Z->col);
+    if(!A) return NULL;    
 
-        act_args *args = malloc(sizeof(act_args));
-        args->Z = Z; args->A = A;
-        args->s = start; args->e = end;
-        threadpool_submit(tp, relu_task, args);
-    }
-    threadpool_wait(tp);
+    relu_into(A, Z);
     return A;
 }
 
-static void drelu_task(void *args) {
+static void drelu_task(void *args, int s, int e) {
     act_args *a = (act_args*) args;
-    for(int i=a->s; i < a->e; i++) {
-        a->A->data[i] = (a->Z->data[i] > 0.0) ? a->dZ->data[i] : 0.0;
+    const SimdKernels *K = simd_kernels();
+    for(int k = s; k < e; ) {
+        int w = a->run - k % a->run;
+        if(w > e - k) w = e - k;
+        K->drelu(w, mat_at(a->Z, a->run, k), mat_at(a->dZ, a->run, k), mat_at(a->A, a->run, k));
+        k += w;
     }
-    free(a);
 }
 
-Matrix* drelu(const Matrix *Z, const Matrix *dZ) {
-    Matrix *dA = create_matrix(Z->row, Z->col);
-    if(!dA) return NULL;
+void drelu_into(Matrix *dA, const Matrix *Z, const Matrix *dZ) {
+    assert(Z->row == dZ->row && Z->col == dZ->col && "matrix dim Z != dZ");
+    assert(dA->row == Z->row && dA->col == Z->col && "output dim != Z");
 
-    ThreadPool *tp = get_la_pool();
-    int total = Z->row * Z->col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
+    act_args args = { .Z = Z, .dZ = dZ, .A = dA, .run = mat_run(Z, dZ, dA) };
+    threadpool_parallel_for(get_la_pool(), Z->row * Z->col, ACT_MIN_GRAIN, drelu_task, &args);
+}
 
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
+Matrix* drelu(const Matrix *Z, const Matrix *dZ) {
+    Matrix *dA = create_matrix_uninit(Z->row, Z->col);
+    if(!dA) return NULL;
 
-        act_args *args = malloc(sizeof(act_args));
-        args->Z = Z; args->dZ = dZ; args->A = dA;
-        args->s = start; args->e = end;
-        threadpool_submit(tp, drelu_task, args);
-    }
-    threadpool_wait(tp);
+    drelu_into(dA, Z, dZ);
     return dA;
 }
\ No newline at end of file
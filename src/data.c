@@ -4,9 +4,11 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <limits.h>
 
 #define MAX_LINE_LENGTH 65536
 #define MAX_FIELD_LENGTH 256
+#define STATS_MIN_GRAIN 4096 // smallest block of elements worth its own partial sums
 
 int count_lines(const char *filepath) {
     FILE *fp = fopen(filepath, "r");
@@ -133,6 +135,7 @@ Dataset* load_csv(const char *filepath, int n_outputs, int has_header) {
     data->n_samples = n_samples;
     data->n_features = n_features;
     data->n_outputs = n_outputs;
+    data->Xs = NULL;
     
     data->X = create_matrix(n_samples, n_features);
     data->Y = create_matrix(n_samples, n_outputs);
@@ -208,9 +211,130 @@ Dataset* load_csv(const char *filepath, int n_outputs, int has_header) {
     return data;
 }
 
+Dataset* load_csv_sparse(const char *filepath, int n_outputs, int has_header) {
+    int total_lines = count_lines(filepath);
+    int total_cols = count_columns(filepath);
+    
+    if (total_lines <= 0 || total_cols <= 0) {
+        fprintf(stderr, "Error: Invalid CSV file '%s'\n", filepath);
+        return NULL;
+    }
+    
+    int n_samples = has_header ? total_lines - 1 : total_lines;
+    int n_features = total_cols - n_outputs;
+    
+    if (n_features <= 0 || n_outputs <= 0) {
+        fprintf(stderr, "Error: Invalid column configuration (features=%d, outputs=%d)\n", 
+                n_features, n_outputs);
+        return NULL;
+    }
+    
+    Dataset *data = calloc(1, sizeof(Dataset));
+    if (!data) return NULL;
+    
+    data->n_samples = n_samples;
+    data->n_features = n_features;
+    data->n_outputs = n_outputs;
+    data->Y = create_matrix(n_samples, n_outputs);
+    
+    // non-zeros are collected into growing arrays, so no dense row block is ever held
+    size_t cap = (size_t) n_samples + 16, nnz = 0;
+    int *row_ptr = calloc((size_t) n_samples + 1, sizeof(int));
+    int *col_idx = malloc(cap * sizeof(int));
+    real_t *val = malloc(cap * sizeof(real_t));
+    double *values = malloc(total_cols * sizeof(double));
+    FILE *fp = fopen(filepath, "r");
+    char line[MAX_LINE_LENGTH];
+    
+    int ok = data->Y && row_ptr && col_idx && val && values && fp;
+    if (ok && has_header && !fgets(line, sizeof(line), fp)) {
+        ok = 0;
+    }
+    
+    int row = 0;
+    while (ok && row < n_samples && fgets(line, sizeof(line), fp)) {
+        // Skip empty lines
+        if (line[0] == '\n' || line[0] == '\r' || line[0] == '\0') {
+            continue;
+        }
+        
+        int cols_parsed = parse_csv_line(line, values, total_cols);
+        
+        if (cols_parsed < total_cols) {
+            fprintf(stderr, "Warning: Row %d has fewer columns than expected (%d < %d)\n",
+                    row + 1, cols_parsed, total_cols);
+            for (int j = cols_parsed; j < total_cols; j++) {
+                values[j] = 0.0;
+            }
+        }
+        
+        for (int j = 0; j < n_features; j++) {
+            if (values[j] == 0.0) continue;
+            if (nnz == cap) {
+                cap *= 2;
+                int *ci = realloc(col_idx, cap * sizeof(int));
+                if (ci) col_idx = ci;
+                real_t *v = realloc(val, cap * sizeof(real_t));
+                if (v) val = v;
+                if (!ci || !v || cap > INT_MAX) {
+                    ok = 0;
+                    break;
+                }
+            }
+            col_idx[nnz] = j;
+            val[nnz++] = values[j];
+        }
+        row_ptr[row + 1] = (int) nnz;
+        
+        for (int j = 0; j < n_outputs; j++) {
+            data->Y->data[row * n_outputs + j] = values[n_features + j];
+        }
+        
+        row++;
+    }
+    
+    free(values);
+    if (fp) fclose(fp);
+    
+    if (ok) {
+        if (row < n_samples) {
+            fprintf(stderr, "Warning: Only read %d rows out of expected %d\n", row, n_samples);
+            data->n_samples = row;
+            data->Y->row = row;
+        }
+        // hand the collected arrays to the matrix instead of copying them
+        data->Xs = create_csr(row, n_features, 0);
+        if (data->Xs) {
+            free(data->Xs->row_ptr);
+            free(data->Xs->col_idx);
+            free(data->Xs->val);
+            data->Xs->row_ptr = row_ptr;
+            data->Xs->col_idx = col_idx;
+            data->Xs->val = val;
+            data->Xs->nnz = (int) nnz;
+            row_ptr = NULL;
+            col_idx = NULL;
+            val = NULL;
+            ok = csr_finish(data->Xs) == 0;
+        } else {
+            ok = 0;
+        }
+    }
+    
+    free(row_ptr);
+    free(col_idx);
+    free(val);
+    if (!ok) {
+        dataset_free(data);
+        return NULL;
+    }
+    return data;
+}
+
 void dataset_free(Dataset *data) {
     if (!data) return;
     
+    if (data->Xs) free_csr(data->Xs);
     if (data->X) free_matrix(data->X);
     if (data->Y) free_matrix(data->Y);
     free(data);
@@ -226,29 +350,100 @@ void dataset_info(const Dataset *data, const char *name) {
     printf("  Samples:  %d\n", data->n_samples);
     printf("  Features: %d\n", data->n_features);
     printf("  Outputs:  %d\n", data->n_outputs);
+    if (data->Xs) {
+        printf("  Sparse:   %d non-zeros (%.2f%% dense)\n", data->Xs->nnz,
+               100.0 * data->Xs->nnz / ((double) data->n_samples * data->n_features));
+    }
     
     // Print first few samples
     int preview = (data->n_samples < 3) ? data->n_samples : 3;
     printf("  First %d samples:\n", preview);
     
+    real_t *xrow = data->Xs ? malloc(data->n_features * sizeof(real_t)) : NULL;
     for (int i = 0; i < preview; i++) {
+        const real_t *x = data->X ? mat_row(data->X, i) : xrow;
+        if (data->Xs) {
+            if (!xrow) break;
+            csr_row_dense(data->Xs, i, xrow);
+        }
         printf("    X[%d]: [", i);
         int feat_preview = (data->n_features < 5) ? data->n_features : 5;
         for (int j = 0; j < feat_preview; j++) {
-            printf("%.4f", data->X->data[i * data->n_features + j]);
+            printf("%.4f", x[j]);
             if (j < feat_preview - 1) printf(", ");
         }
         if (data->n_features > 5) printf(", ...");
         printf("]  Y[%d]: [", i);
         for (int j = 0; j < data->n_outputs; j++) {
-            printf("%.4f", data->Y->data[i * data->n_outputs + j]);
+            printf("%.4f", mat_row(data->Y, i)[j]);
             if (j < data->n_outputs - 1) printf(", ");
         }
         printf("]\n");
     }
+    free(xrow);
+}
+
+// Center array of a sparse matrix, allocated (zeroed) on first use
+static real_t* csr_center(CsrMatrix *A) {
+    if (!A->center) {
+        A->center = calloc(A->col, sizeof(real_t));
+    }
+    return A->center;
+}
+
+// Column j of a sparse matrix is S[:, j] - center[j]; the implicit zeros of S
+// take part in every statistic without being stored, and the shift folds into center
+static void normalize_sparse(CsrMatrix *A, int zscore) {
+    real_t *center = csr_center(A);
+    if (!center) return;
+    int n = A->row;
+    
+    for (int j = 0; j < A->col; j++) {
+        int count = A->col_ptr[j + 1] - A->col_ptr[j];
+        double shift, scale;
+        
+        if (zscore) {
+            double mean = 0.0;
+            for (int k = A->col_ptr[j]; k < A->col_ptr[j + 1]; k++) {
+                mean += A->val[A->col_pos[k]];
+            }
+            mean /= n;
+            
+            double var = (double) (n - count) * mean * mean;
+            for (int k = A->col_ptr[j]; k < A->col_ptr[j + 1]; k++) {
+                double diff = A->val[A->col_pos[k]] - mean;
+                var += diff * diff;
+            }
+            shift = mean;
+            scale = sqrt(var / n);
+        } else {
+            double min_val = count < n ? 0.0 : INFINITY;
+            double max_val = count < n ? 0.0 : -INFINITY;
+            for (int k = A->col_ptr[j]; k < A->col_ptr[j + 1]; k++) {
+                double val = A->val[A->col_pos[k]];
+                if (val < min_val) min_val = val;
+                if (val > max_val) max_val = val;
+            }
+            shift = min_val;
+            scale = max_val - min_val;
+        }
+        
+        // stats of S - c are those of S shifted by c, so the old center cancels:
+        // (S - c - (shift - c)) / scale = S / scale - shift / scale
+        if (scale > 0) {
+            for (int k = A->col_ptr[j]; k < A->col_ptr[j + 1]; k++) {
+                A->val[A->col_pos[k]] /= scale;
+            }
+            center[j] = shift / scale;
+        }
+    }
 }
 
 void normalize_minmax(Dataset *data) {
+    if (data && data->Xs) {
+        normalize_sparse(data->Xs, 0);
+        return;
+    }
     if (!data || !data->X) return;
     
     int n = data->n_samples;
@@ -256,11 +451,11 @@ void normalize_minmax(Dataset *data) {
     
     for (int j = 0; j < f; j++) {
         // Find min and max for this feature
-        double min_val = data->X->data[j];
-        double max_val = data->X->data[j];
+        double min_val = mat_row(data->X, 0)[j];
+        double max_val = mat_row(data->X, 0)[j];
         
         for (int i = 1; i < n; i++) {
-            double val = data->X->data[i * f + j];
+            double val = mat_row(data->X, i)[j];
             if (val < min_val) min_val = val;
             if (val > max_val) max_val = val;
         }
@@ -269,41 +464,93 @@ void normalize_minmax(Dataset *data) {
         double range = max_val - min_val;
         if (range > 0) {
             for (int i = 0; i < n; i++) {
-                data->X->data[i * f + j] = (data->X->data[i * f + j] - min_val) / range;
+                mat_row(data->X, i)[j] = (mat_row(data->X, i)[j] - min_val) / range;
+            }
+        }
+    }
+}
+
+// per-feature sums for the z-score statistics, taken over row blocks so each
+// row is read contiguously
+typedef struct {
+    Matrix *X;
+    const double *mean; // NULL for the first pass (sum of x)
+    const double *inv_std; // for the scaling pass
+} ZscoreArgs;
+
+static void zscore_sum_block(void *arg, int start, int end, double *acc) {
+    ZscoreArgs *a = (ZscoreArgs*) arg;
+    int f = a->X->col;
+    for (int i = start; i < end; i++) {
+        const real_t *x = mat_row(a->X, i);
+        if (a->mean) {
+            for (int j = 0; j < f; j++) {
+                double diff = x[j] - a->mean[j];
+                acc[j] += diff * diff;
+            }
+        } else {
+            for (int j = 0; j < f; j++) {
+                acc[j] += x[j];
+            }
+        }
+    }
+}
+
+static void zscore_scale_task(void *arg, int start, int end) {
+    ZscoreArgs *a = (ZscoreArgs*) arg;
+    int f = a->X->col;
+    for (int i = start; i < end; i++) {
+        real_t *x = mat_row(a->X, i);
+        for (int j = 0; j < f; j++) {
+            // features with no spread are left as they are
+            if (a->inv_std[j] > 0) {
+                x[j] = (x[j] - a->mean[j]) * a->inv_std[j];
             }
         }
     }
 }
 
 void normalize_zscore(Dataset *data) {
+    if (data && data->Xs) {
+        normalize_sparse(data->Xs, 1);
+        return;
+    }
     if (!data || !data->X) return;
     
     int n = data->n_samples;
     int f = data->n_features;
+    if (n <= 0 || f <= 0) return;
+    int grain = (STATS_MIN_GRAIN + f - 1) / f;
+    
+    double *mean = malloc(f * sizeof(double));
+    double *stat = malloc(f * sizeof(double));
+    if (!mean || !stat) {
+        free(mean);
+        free(stat);
+        return;
+    }
+    ZscoreArgs args = { .X = data->X };
     
+    // Compute mean
+    la_reduce_rows(n, f, grain, zscore_sum_block, &args, mean);
     for (int j = 0; j < f; j++) {
-        // Compute mean
-        double mean = 0.0;
-        for (int i = 0; i < n; i++) {
-            mean += data->X->data[i * f + j];
-        }
-        mean /= n;
-        
-        // Compute std
-        double var = 0.0;
-        for (int i = 0; i < n; i++) {
-            double diff = data->X->data[i * f + j] - mean;
-            var += diff * diff;
-        }
-        double std = sqrt(var / n);
-        
-        // Normalize
-        if (std > 0) {
-            for (int i = 0; i < n; i++) {
-                data->X->data[i * f + j] = (data->X->data[i * f + j] - mean) / std;
-            }
-        }
+        mean[j] /= n;
     }
+    
+    // Compute std (as 1 / std, zero where a feature is constant)
+    args.mean = mean;
+    la_reduce_rows(n, f, grain, zscore_sum_block, &args, stat);
+    for (int j = 0; j < f; j++) {
+        double std = sqrt(stat[j] / n);
+        stat[j] = std > 0 ? 1.0 / std : 0.0;
+    }
+    
+    // Normalize
+    args.inv_std = stat;
+    threadpool_parallel_for(get_la_pool(), n, grain, zscore_scale_task, &args);
+    
+    free(mean);
+    free(stat);
 }
 
 void dataset_shuffle(Dataset *data) {
@@ -319,24 +566,49 @@ void dataset_shuffle(Dataset *data) {
     int f = data->n_features;
     int o = data->n_outputs;
     
+    // sparse rows can't be swapped in place: track the permutation and gather once
+    int *perm = NULL;
+    if (data->Xs) {
+        perm = malloc(n * sizeof(int));
+        if (!perm) return;
+        for (int i = 0; i < n; i++) perm[i] = i;
+    }
+    
     // Fisher-Yates shuffle
     for (int i = n - 1; i > 0; i--) {
         int j = rand() % (i + 1);
         
+        if (perm) {
+            int tmp = perm[i];
+            perm[i] = perm[j];
+            perm[j] = tmp;
+        }
+        
         // Swap rows i and j in X
-        for (int k = 0; k < f; k++) {
-            double tmp = data->X->data[i * f + k];
-            data->X->data[i * f + k] = data->X->data[j * f + k];
-            data->X->data[j * f + k] = tmp;
+        for (int k = 0; perm == NULL && k < f; k++) {
+            real_t tmp = mat_row(data->X, i)[k];
+            mat_row(data->X, i)[k] = mat_row(data->X, j)[k];
+            mat_row(data->X, j)[k] = tmp;
         }
         
         // Swap rows i and j in Y
         for (int k = 0; k < o; k++) {
-            double tmp = data->Y->data[i * o + k];
-            data->Y->data[i * o + k] = data->Y->data[j * o + k];
-            data->Y->data[j * o + k] = tmp;
+            real_t tmp = mat_row(data->Y, i)[k];
+            mat_row(data->Y, i)[k] = mat_row(data->Y, j)[k];
+            mat_row(data->Y, j)[k] = tmp;
         }
     }
+    
+    if (perm) {
+        CsrMatrix *Xs = csr_select_rows(data->Xs, perm, n);
+        if (Xs) {
+            free_csr(data->Xs);
+            data->Xs = Xs;
+        } else {
+            fprintf(stderr, "Error: Out of memory shuffling sparse features\n");
+        }
+        free(perm);
+    }
 }
 
 void dataset_split(const Dataset *data, Dataset **train, Dataset **val, double val_ratio) {
@@ -349,29 +621,22 @@ void dataset_split(const Dataset *data, Dataset **train, Dataset **val, double v
     int n_val = (int)(n * val_ratio);
     int n_train = n - n_val;
     
-    // Allocate train dataset
+    // Both halves are views: the first n_train rows and the rest
     *train = malloc(sizeof(Dataset));
     (*train)->n_samples = n_train;
     (*train)->n_features = f;
     (*train)->n_outputs = o;
-    (*train)->X = create_matrix(n_train, f);
-    (*train)->Y = create_matrix(n_train, o);
+    (*train)->X = data->X ? matrix_view(data->X, 0, n_train, 0, f) : NULL;
+    (*train)->Xs = data->Xs ? csr_view_rows(data->Xs, 0, n_train) : NULL;
+    (*train)->Y = matrix_view(data->Y, 0, n_train, 0, o);
     
-    // Allocate val dataset
     *val = malloc(sizeof(Dataset));
     (*val)->n_samples = n_val;
     (*val)->n_features = f;
     (*val)->n_outputs = o;
-    (*val)->X = create_matrix(n_val, f);
-    (*val)->Y = create_matrix(n_val, o);
-    
-    // Copy training data
-    memcpy((*train)->X->data, data->X->data, n_train * f * sizeof(double));
-    memcpy((*train)->Y->data, data->Y->data, n_train * o * sizeof(double));
-    
-    // Copy validation data
-    memcpy((*val)->X->data, data->X->data + n_train * f, n_val * f * sizeof(double));
-    memcpy((*val)->Y->data, data->Y->data + n_train * o, n_val * o * sizeof(double));
+    (*val)->X = data->X ? matrix_view(data->X, n_train, n_val, 0, f) : NULL;
+    (*val)->Xs = data->Xs ? csr_view_rows(data->Xs, n_train, n_val) : NULL;
+    (*val)->Y = matrix_view(data->Y, n_train, n_val, 0, o);
 }
 
 void create_sample_csv(const char *filepath, int n_samples, int n_features) {
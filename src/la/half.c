@@ -0,0 +1,58 @@
+#include "la/linalg.h"
+#include "poolla/simd.h"
+#include <strings.h>
+
+// smallest chunk worth shipping to another thread, in elements
+#define HALF_MIN_GRAIN 8192
+
+HalfMatrix* create_half(int row, int col, HalfFormat fmt) {
+    HalfMatrix* h = (HalfMatrix*) malloc(sizeof(HalfMatrix));
+    if(!h) return NULL;
+    h->row = row;
+    h->col = col;
+    h->fmt = fmt;
+    h->view = 0;
+    h->data = (uint16_t*) calloc((size_t) row * col, sizeof(uint16_t));
+    if(!h->data) {
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+void free_half(HalfMatrix* h) {
+    if(h) {
+        if(!h->view)
+            free(h->data);
+        free(h);
+    }
+}
+
+typedef struct {
+    HalfMatrix *h;
+    const real_t *x;
+} HalfArgs;
+
+static void half_store_task(void *arg, int start, int end) {
+    HalfArgs *a = (HalfArgs*) arg;
+    simd_kernels()->to_half(end - start, a->h->fmt, a->x + start, a->h->data + start);
+}
+
+void half_store(HalfMatrix* dst, const real_t* src) {
+    HalfArgs args = { .h = dst, .x = src };
+    threadpool_parallel_for(get_la_pool(), dst->row * dst->col, HALF_MIN_GRAIN, half_store_task, &args);
+}
+
+HalfFormat half_format(const char* name) {
+    if(name && strcasecmp(name, "bf16") == 0) return HALF_BF16;
+    if(name && strcasecmp(name, "fp16") == 0) return HALF_FP16;
+    return HALF_NONE;
+}
+
+const char* half_format_name(HalfFormat fmt) {
+    switch(fmt) {
+    case HALF_BF16: return "bf16";
+    case HALF_FP16: return "fp16";
+    default: return REAL_NAME;
+    }
+}
@@ -1,21 +1,82 @@
 #include "la/linalg.h"
 #include "poolla/blas.h"
+#include "poolla/backend.h"
 #include "poolla/thread_pool.h"
+#include "poolla/topology.h"
+#include "poolla/simd.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 
 static ThreadPool* pool = NULL;
+static int first_touch = 0; // zero large buffers from the pool so pages land near their users
+
+// matrices at least this big are first-touched in parallel
+#define LA_FIRST_TOUCH_BYTES (1 << 20)
 
 void la_init() {
     if(pool == NULL) {
-        int num_threads = 4;
+        CpuTopology topo;
+        int have_topo = topology_discover(&topo) == 0;
+
+        // one worker per physical core; the calling thread takes the last core
+        int num_threads = (have_topo && topo.ncores > 1) ? topo.ncores - 1 : 1;
         const char* thread_env = getenv("NNC_NUM_THREADS");
         if(thread_env) {
             num_threads = atoi(thread_env);
         }
-        pool = threadpool_init(num_threads > 0 ? num_threads : 1);
+        ThreadPoolMode mode = TP_MODE_FIFO;
+        const char* mode_env = getenv("NNC_POOL_MODE");
+        if(mode_env && strcmp(mode_env, "steal") == 0) {
+            mode = TP_MODE_STEAL;
+        }
+        // 0 workers: the calling thread computes alone
+        pool = threadpool_init_mode(num_threads > 0 ? num_threads : 0, mode);
+        if(!pool) {
+            if(have_topo) topology_free(&topo);
+            return;
+        }
+
+        if(have_topo) {
+            // NNC_PIN=1: caller on the first CPU, workers on the following ones
+            const char* pin_env = getenv("NNC_PIN");
+            if(pin_env && atoi(pin_env) != 0) {
+                topology_pin_self(topo.order[0]);
+                if(topo.ncpus > 1) {
+                    threadpool_pin(pool, topo.order + 1, topo.ncpus - 1);
+                } else {
+                    threadpool_pin(pool, topo.order, 1);
+                }
+            }
+            first_touch = topo.nnodes > 1;
+            topology_free(&topo);
+        }
+        const char* touch_env = getenv("NNC_FIRST_TOUCH");
+        if(touch_env) {
+            first_touch = atoi(touch_env) != 0;
+        }
+
+        // spin-then-park by default so back-to-back kernels find workers awake
+        ThreadPoolWait wait = TP_WAIT_ADAPTIVE;
+        const char* wait_env = getenv("NNC_WAIT_POLICY");
+        if(wait_env && strcmp(wait_env, "park") == 0) {
+            wait = TP_WAIT_PARK;
+        }
+        int spins = 2000, yields = 4;
+        const char* spin_env = getenv("NNC_SPIN_COUNT");
+        if(spin_env) {
+            spins = atoi(spin_env);
+        }
+        const char* yield_env = getenv("NNC_YIELD_COUNT");
+        if(yield_env) {
+            yields = atoi(yield_env);
+        }
+        threadpool_set_wait(pool, wait, spins, yields);
+        threadpool_track_latency(pool, getenv("NNC_POOL_STATS") != NULL);
+
+        // pick vector kernels now rather than on the first hot-loop call
+        simd_kernels();
     }
 }
 
@@ -26,39 +87,92 @@ ThreadPool* get_la_pool() {
 
 void la_destroy() {
     if(pool) {
+        if(getenv("NNC_POOL_STATS")) {
+            fprintf(stderr, "simd kernels: %s, %s\n", simd_kernels()->name, REAL_NAME);
+            threadpool_print_stats(pool, stderr);
+        }
         threadpool_destroy(pool);
         pool = NULL;
     }
 }
 
-Matrix* create_matrix(int row, int col) {
+static void first_touch_task(void *arg, int start, int end) {
+    Matrix *m = (Matrix*) arg;
+    memset(mat_row(m, start), 0, (size_t) (end - start) * m->ld * sizeof(real_t));
+}
+
+static Matrix* alloc_matrix(int row, int col, int zero, int pad) {
     Matrix* matrix = (Matrix*) malloc(sizeof(Matrix));
     if(!matrix) return NULL;
     matrix->row = row;
     matrix->col = col;
-    matrix->data = (double*) calloc(row * col, sizeof(double));
+    matrix->ld = col;
+    matrix->view = 0;
+    if(pad) {
+        int per_line = LA_ALIGN / (int) sizeof(real_t);
+        matrix->ld = (col + per_line - 1) / per_line * per_line;
+    }
+
+    // aligned_alloc wants a multiple of the alignment
+    size_t bytes = (size_t) row * matrix->ld * sizeof(real_t);
+    size_t alloc = (bytes + LA_ALIGN - 1) / LA_ALIGN * LA_ALIGN;
+    matrix->data = (real_t*) aligned_alloc(LA_ALIGN, alloc > 0 ? alloc : LA_ALIGN);
     if(!matrix->data) {
         free(matrix);
         return NULL;
     }
+    if(first_touch && pool && bytes >= LA_FIRST_TOUCH_BYTES) {
+        // zero row blocks from the pool so each block's pages are placed on
+        // the node of a thread that will later process rows of that block;
+        // never start a pool just for this, nor revive one after la_destroy
+        int blocks = pool->tcount + 1;
+        int grain = (row + blocks - 1) / blocks;
+        threadpool_parallel_for(pool, row, grain, first_touch_task, matrix);
+    } else if(zero) {
+        memset(matrix->data, 0, bytes);
+    }
     return matrix;
 }
 
+Matrix* create_matrix(int row, int col) {
+    return alloc_matrix(row, col, 1, 0);
+}
+
+Matrix* create_matrix_uninit(int row, int col) {
+    return alloc_matrix(row, col, 0, 0);
+}
+
+Matrix* create_matrix_padded(int row, int col) {
+    return alloc_matrix(row, col, 1, 1);
+}
+
+Matrix* create_matrix_padded_uninit(int row, int col) {
+    return alloc_matrix(row, col, 0, 1);
+}
+
+Matrix* matrix_view(const Matrix* A, int row0, int rows, int col0, int cols) {
+    Matrix* v = (Matrix*) malloc(sizeof(Matrix));
+    if(!v) return NULL;
+    *v = mat_view(A, row0, rows, col0, cols);
+    return v;
+}
+
 void free_matrix(Matrix* matrix) {
     if(matrix) {
-        free(matrix->data);
+        if(!matrix->view)
+            free(matrix->data);
         free(matrix);
     }
 }
 
-Matrix* matrix_from_array(int row, int col, int n, double* array) {
+Matrix* matrix_from_array(int row, int col, int n, real_t* array) {
     if(!array) return NULL;
     if(row * col <= 0) return NULL;
     // if array (n) != row * col, return NULL
     if(n != row * col) return NULL;
     Matrix* matrix = create_matrix(row, col);
     if(matrix) {
-        memcpy(matrix->data, array, row * col * sizeof(double));
+        memcpy(matrix->data, array, row * col * sizeof(real_t));
     }
     return matrix;
 }
@@ -71,206 +185,618 @@ void print_matrix(const Matrix* matrix) {
 
     for(int i = 0; i < matrix->row; i++) {
         for(int j = 0; j < matrix->col; j++) {
-            printf("%8.3f ", matrix->data[i * matrix->col + j]);
+            printf("%8.3f ", mat_row(matrix, i)[j]);
         }
         printf("\n");
     }
 }
 
-Matrix* matmul(const Matrix* A, const Matrix* B) {
+// this thread's scratch slots (see la_scratch_get)
+typedef struct {
+    void *data;
+    size_t cap;
+    int busy;
+} LaScratch;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_key_free(void *p) {
+    LaScratch *s = (LaScratch*) p;
+    for(int i = 0; i < LA_SCRATCH_SLOTS; i++)
+        free(s[i].data);
+    free(s);
+}
+
+static void scratch_key_init(void) {
+    pthread_key_create(&scratch_key, scratch_key_free);
+}
+
+void* la_scratch_get(int which, size_t bytes) {
+    bytes = (bytes + LA_ALIGN - 1) / LA_ALIGN * LA_ALIGN;
+    if(bytes == 0) bytes = LA_ALIGN;
+    pthread_once(&scratch_once, scratch_key_init);
+    LaScratch *s = (LaScratch*) pthread_getspecific(scratch_key);
+    if(!s) {
+        s = calloc(LA_SCRATCH_SLOTS, sizeof(LaScratch));
+        if(!s || pthread_setspecific(scratch_key, s) != 0) {
+            free(s);
+            return aligned_alloc(LA_ALIGN, bytes);
+        }
+    }
+    LaScratch *b = &s[which];
+    if(b->busy)
+        return aligned_alloc(LA_ALIGN, bytes);
+    if(bytes > b->cap) {
+        free(b->data);
+        b->data = aligned_alloc(LA_ALIGN, bytes);
+        b->cap = b->data ? bytes : 0;
+        if(!b->data) return NULL;
+    }
+    b->busy = 1;
+    return b->data;
+}
+
+void la_scratch_put(int which, void *p) {
+    LaScratch *s = (LaScratch*) pthread_getspecific(scratch_key);
+    if(s && s[which].busy && s[which].data == p)
+        s[which].busy = 0;
+    else
+        free(p);
+}
+
+// C := op(A) op(B) followed by ep. Full-precision operands go through the
+// selected BLAS backend; one that can't fuse the epilogue gets it as a second
+// pass. 16-bit operands only have in-house kernels.
+static void la_gemm(BlasTrans transA, BlasTrans transB, MatRef A, MatRef B, Matrix* C,
+                    const BlasEpilogue* ep) {
+    const BlasBackend* be = blas_backend();
+    if(!A.data || !B.data || (ep && be == blas_backend_native())) {
+        dgemm_ref(pool, transA, transB, 1.0, A, B, 0.0, C, ep);
+        return;
+    }
+    Matrix a = { .row = A.row, .col = A.col, .ld = A.ld, .data = (real_t*) A.data };
+    Matrix b = { .row = B.row, .col = B.col, .ld = B.ld, .data = (real_t*) B.data };
+    if(!transA && !transB && b.col == 1)
+        be->gemv(pool, BLAS_NO_TRANS, 1.0, &a, &b, 0.0, C);
+    else
+        be->gemm(pool, transA, transB, 1.0, &a, &b, 0.0, C);
+    if(ep)
+        dgemm_epilogue(pool, C, ep);
+}
+
+// zero an output whose product has an empty inner dimension
+static void zero_matrix(Matrix* C) {
+    for(int i = 0; i < C->row; i++)
+        memset(mat_row(C, i), 0, (size_t) C->col * sizeof(real_t));
+}
+
+void matmul_into(Matrix* C, const Matrix* A, const Matrix* B) {
     assert(A->col == B->row && "matrix dim A.col != B.row");
+    assert(C->row == A->row && C->col == B->col && "output dim != A.row x B.col");
 
     if(!pool) 
         la_init();
-    
-    Matrix* C = create_matrix(A->row, B->col);
-    if(!C) {
-        return NULL;
+
+    if (A->row == 0 || B->col == 0) {
+        return;
     }
-    if (A->row == 0 || A->col == 0 || B->col == 0) {
-        return C; // return zero matrix
+    if (A->col == 0) {
+        zero_matrix(C);
+        return;
     }
     if(A->row == 1 && A->col == 1 && B->row == 1 && B->col == 1) {
         C->data[0] = A->data[0] * B->data[0];
-        return C;
+        return;
+    }
+    la_gemm(BLAS_NO_TRANS, BLAS_NO_TRANS, mat_ref(A), mat_ref(B), C, NULL);
+}
+
+Matrix* matmul(const Matrix* A, const Matrix* B) {
+    assert(A->col == B->row && "matrix dim A.col != B.row");
+    Matrix* C = create_matrix_uninit(A->row, B->col);
+    if(!C) {
+        return NULL;
+    }
+    matmul_into(C, A, B);
+    return C;
+}
+
+void matmul_tn_ref_into(Matrix* C, MatRef A, MatRef B) {
+    assert(A.row == B.row && "matrix dim A.row != B.row");
+    assert(C->row == A.col && C->col == B.col && "output dim != A.col x B.col");
+
+    if(!pool)
+        la_init();
+
+    if (A.col == 0 || B.col == 0) {
+        return;
+    }
+    if (A.row == 0) {
+        zero_matrix(C);
+        return;
+    }
+    la_gemm(BLAS_TRANS, BLAS_NO_TRANS, A, B, C, NULL);
+}
+
+Matrix* matmul_tn_ref(MatRef A, MatRef B) {
+    assert(A.row == B.row && "matrix dim A.row != B.row");
+    Matrix* C = create_matrix_uninit(A.col, B.col);
+    if(!C) {
+        return NULL;
     }
-    if (B->col == 1) {
-        dmv(pool, 1.0, A, B, 0.0, C);
+    matmul_tn_ref_into(C, A, B);
+    return C;
+}
+
+void matmul_tn_into(Matrix* C, const Matrix* A, const Matrix* B) {
+    matmul_tn_ref_into(C, mat_ref(A), mat_ref(B));
+}
+
+Matrix* matmul_tn(const Matrix* A, const Matrix* B) {
+    return matmul_tn_ref(mat_ref(A), mat_ref(B));
+}
+
+void matmul_nt_into(Matrix* C, const Matrix* A, const Matrix* B) {
+    assert(A->col == B->col && "matrix dim A.col != B.col");
+    assert(C->row == A->row && C->col == B->row && "output dim != A.row x B.row");
+
+    if(!pool)
+        la_init();
+
+    if (A->row == 0 || B->row == 0) {
+        return;
+    }
+    if (A->col == 0) {
+        zero_matrix(C);
+        return;
+    }
+    la_gemm(BLAS_NO_TRANS, BLAS_TRANS, mat_ref(A), mat_ref(B), C, NULL);
+}
+
+Matrix* matmul_nt(const Matrix* A, const Matrix* B) {
+    assert(A->col == B->col && "matrix dim A.col != B.col");
+    Matrix* C = create_matrix_uninit(A->row, B->row);
+    if(!C) {
+        return NULL;
+    }
+    matmul_nt_into(C, A, B);
+    return C;
+}
+
+void gemm_bias_act_ref_into(Matrix* Y, Matrix* Z, MatRef A, MatRef B, const Matrix* bias, LaAct act) {
+    assert(A.col == B.row && "matrix dim A.col != B.row");
+    assert(Y->row == A.row && Y->col == B.col && "output dim != A.row x B.col");
+    assert((!Z || (Z->row == Y->row && Z->col == Y->col)) && "pre-activation dim != output dim");
+
+    if(!pool)
+        la_init();
+
+    BlasEpilogue ep = { .bias = bias, .relu = (act == LA_ACT_RELU) };
+    if(act == LA_ACT_NONE || !Z) {
+        // a single output: linear layers or activations written over the pre-activation
+        la_gemm(BLAS_NO_TRANS, BLAS_NO_TRANS, A, B, Y, &ep);
+        return;
+    }
+    ep.relu_out = Y;
+    la_gemm(BLAS_NO_TRANS, BLAS_NO_TRANS, A, B, Z, &ep);
+}
+
+Matrix* gemm_bias_act_ref(MatRef A, MatRef B, const Matrix* bias, LaAct act, Matrix** Z) {
+    assert(A.col == B.row && "matrix dim A.col != B.row");
+
+    Matrix* out = create_matrix_uninit(A.row, B.col);
+    Matrix* pre = (act != LA_ACT_NONE && Z) ? create_matrix_uninit(A.row, B.col) : NULL;
+    if(!out || (act != LA_ACT_NONE && Z && !pre)) {
+        free_matrix(out);
+        free_matrix(pre);
+        return NULL;
+    }
+    gemm_bias_act_ref_into(out, pre, A, B, bias, act);
+    if(pre)
+        *Z = pre;
+    return out;
+}
+
+void gemm_bias_act_into(Matrix* Y, Matrix* Z, const Matrix* A, const Matrix* B, const Matrix* bias, LaAct act) {
+    gemm_bias_act_ref_into(Y, Z, mat_ref(A), mat_ref(B), bias, act);
+}
+
+Matrix* gemm_bias_act(const Matrix* A, const Matrix* B, const Matrix* bias, LaAct act, Matrix** Z) {
+    return gemm_bias_act_ref(mat_ref(A), mat_ref(B), bias, act, Z);
+}
+
+int gemm_bias_act_half_into(HalfMatrix* Y, HalfMatrix* Z, MatRef A, MatRef B, const Matrix* bias, LaAct act) {
+    assert(A.col == B.row && "matrix dim A.col != B.row");
+    assert(Y->row == A.row && Y->col == B.col && "output dim != A.row x B.col");
+    assert((!Z || (Z->row == Y->row && Z->col == Y->col && Z->fmt == Y->fmt)) &&
+           "pre-activation dim != output dim");
+
+    if(!pool)
+        la_init();
+
+    // accumulate at full precision; the epilogue rounds each finished tile into 16 bits
+    real_t* acc = la_scratch_get(LA_SCRATCH_ACC, (size_t) A.row * B.col * sizeof(real_t));
+    if(!acc) {
+        return -1;
+    }
+    Matrix acc_m = { .row = A.row, .col = B.col, .ld = B.col, .data = acc, .view = 1 };
+    Matrix* C = &acc_m;
+    BlasEpilogue ep = { .bias = bias, .relu = (act == LA_ACT_RELU) };
+    if(act == LA_ACT_NONE) {
+        ep.z_half = Y;
     } else {
-        dmm(pool, 1.0, A, B, 0.0, C);
+        ep.z_half = Z;
+        ep.relu_half = Y;
+    }
+    dgemm_ref(pool, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, A, B, 0.0, C, &ep);
+    la_scratch_put(LA_SCRATCH_ACC, acc);
+    return 0;
+}
+
+HalfMatrix* gemm_bias_act_half(MatRef A, MatRef B, const Matrix* bias, LaAct act,
+                               HalfFormat fmt, HalfMatrix** Z) {
+    assert(A.col == B.row && "matrix dim A.col != B.row");
+
+    HalfMatrix* out = create_half(A.row, B.col, fmt);
+    HalfMatrix* z = (Z && act != LA_ACT_NONE) ? create_half(A.row, B.col, fmt) : NULL;
+    if(!out || (Z && act != LA_ACT_NONE && !z) || gemm_bias_act_half_into(out, z, A, B, bias, act) != 0) {
+        free_half(out);
+        free_half(z);
+        return NULL;
     }
+    if(z)
+        *Z = z;
+    return out;
+}
+
+void matmul_nt_drelu_ref_into(Matrix* C, MatRef A, MatRef B, MatRef Z) {
+    assert(A.col == B.col && "matrix dim A.col != B.col");
+    int masked = Z.data || Z.half;
+    assert((!masked || (Z.row == A.row && Z.col == B.row)) && "mask dim != output dim");
+    assert(C->row == A.row && C->col == B.row && "output dim != A.row x B.row");
+
+    if(!pool)
+        la_init();
+
+    BlasEpilogue ep = { .mask = Z };
+    la_gemm(BLAS_NO_TRANS, BLAS_TRANS, A, B, C, masked ? &ep : NULL);
+}
+
+Matrix* matmul_nt_drelu_ref(MatRef A, MatRef B, MatRef Z) {
+    assert(A.col == B.col && "matrix dim A.col != B.col");
+    Matrix* C = create_matrix_uninit(A.row, B.row);
+    if(!C) {
+        return NULL;
+    }
+    matmul_nt_drelu_ref_into(C, A, B, Z);
     return C;
 }
 
+void matmul_nt_drelu_into(Matrix* C, const Matrix* A, const Matrix* B, const Matrix* Z) {
+    matmul_nt_drelu_ref_into(C, mat_ref(A), mat_ref(B), mat_ref(Z));
+}
+
+Matrix* matmul_nt_drelu(const Matrix* A, const Matrix* B, const Matrix* Z) {
+    return matmul_nt_drelu_ref(mat_ref(A), mat_ref(B), mat_ref(Z));
+}
+
 // Helper for parallel tasks
 typedef struct {
     const Matrix *A, *B;
     Matrix *C;
-    int start, end;
+    int run; // contiguous run length for elementwise walks (see mat_run)
 } MatOpArgs;
 
-static void matadd_task(void *arg) {
+// smallest chunk worth shipping to another thread, in elements
+#define LA_MIN_GRAIN 4096
+
+// rows per chunk so a row-split loop still gets LA_MIN_GRAIN elements
+static int row_grain(int col) {
+    return col > 0 ? (LA_MIN_GRAIN + col - 1) / col : LA_MIN_GRAIN;
+}
+
+static void matadd_task(void *arg, int start, int end) {
     MatOpArgs *args = (MatOpArgs*)arg;
-    // Simple split by linear index for element-wise ops
-    for(int i = args->start; i < args->end; i++) {
-        args->C->data[i] = args->A->data[i] + args->B->data[i];
+    int run = args->run;
+    // split by logical index, one contiguous run at a time
+    for(int k = start; k < end; ) {
+        int w = run - k % run;
+        if(w > end - k) w = end - k;
+        const real_t *a = mat_at(args->A, run, k), *b = mat_at(args->B, run, k);
+        real_t *c = mat_at(args->C, run, k);
+        for(int j = 0; j < w; j++) {
+            c[j] = a[j] + b[j];
+        }
+        k += w;
     }
-    free(args);
+}
+
+void matadd_into(Matrix* C, const Matrix* A, const Matrix* B) {
+    assert(A->row == B->row && A->col == B->col && "matrix dim A != B");
+    assert(C->row == A->row && C->col == A->col && "output dim != A");
+
+    MatOpArgs args = { .A = A, .B = B, .C = C, .run = mat_run(A, B, C) };
+    threadpool_parallel_for(get_la_pool(), A->row * A->col, LA_MIN_GRAIN, matadd_task, &args);
 }
 
 Matrix* matadd(const Matrix* A, const Matrix* B) {
     assert(A->row == B->row && A->col == B->col && "matrix dim A != B");
-    Matrix* C = create_matrix(A->row, A->col);
+    Matrix* C = create_matrix_uninit(A->row, A->col);
     if(!C) return NULL;
     
-    ThreadPool *tp = get_la_pool();
-    int total = A->row * A->col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
-
-        MatOpArgs *args = malloc(sizeof(MatOpArgs));
-        args->A = A; args->B = B; args->C = C;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, matadd_task, args);
-    }
-    threadpool_wait(tp);
+    matadd_into(C, A, B);
     return C;
 }
 
-static void matscale_task(void *arg) {
+static void matscale_task(void *arg, int start, int end) {
     MatOpArgs *args = (MatOpArgs*)arg;
-    for(int i = args->start; i < args->end; i++) {
-        args->C->data[i] = args->A->data[i] * args->B->data[i];
+    int run = args->run;
+    for(int k = start; k < end; ) {
+        int w = run - k % run;
+        if(w > end - k) w = end - k;
+        const real_t *a = mat_at(args->A, run, k), *b = mat_at(args->B, run, k);
+        real_t *c = mat_at(args->C, run, k);
+        for(int j = 0; j < w; j++) {
+            c[j] = a[j] * b[j];
+        }
+        k += w;
     }
-    free(args);
+}
+
+void matscale_into(Matrix* C, const Matrix* A, const Matrix* B) {
+    assert(A->row == B->row && A->col == B->col && "matrix dim A != B");
+    assert(C->row == A->row && C->col == A->col && "output dim != A");
+
+    MatOpArgs args = { .A = A, .B = B, .C = C, .run = mat_run(A, B, C) };
+    threadpool_parallel_for(get_la_pool(), A->row * A->col, LA_MIN_GRAIN, matscale_task, &args);
 }
 
 Matrix* matscale(const Matrix* A, const Matrix* B) {
     assert(A->row == B->row && A->col == B->col && "matrix dim A != B");
-    Matrix* C = create_matrix(A->row, A->col);
+    Matrix* C = create_matrix_uninit(A->row, A->col);
     if(!C) return NULL;
 
-    ThreadPool *tp = get_la_pool();
-    int total = A->row * A->col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
+    matscale_into(C, A, B);
+    return C;
+}
 
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
+// Transpose works on LA_TRANSPOSE_BLOCK square blocks so a block of A and its
+// image in At both stay in L1; inside a block, full tr x tr tiles go through the
+// in-register SIMD kernel and only the ragged edges move element by element.
+#define LA_TRANSPOSE_BLOCK 32
 
-        MatOpArgs *args = malloc(sizeof(MatOpArgs));
-        args->A = A; args->B = B; args->C = C;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, matscale_task, args);
+typedef struct {
+    const Matrix *A;
+    Matrix *C;
+    int nbj; // blocks across A
+} TransposeArgs;
+
+// b (w, h) = a (h, w)^T
+static void transpose_block(const SimdKernels *k, const real_t *a, size_t lda, real_t *b, size_t ldb,
+                            int h, int w) {
+    int tr = k->tr;
+    int i = 0;
+    for(; i + tr <= h; i += tr) {
+        int j = 0;
+        for(; j + tr <= w; j += tr)
+            k->transpose(a + i * lda + j, lda, b + j * ldb + i, ldb);
+        for(; j < w; j++)
+            for(int r = i; r < i + tr; r++)
+                b[j * ldb + r] = a[r * lda + j];
     }
-    threadpool_wait(tp);
-    return C;
+    for(; i < h; i++)
+        for(int j = 0; j < w; j++)
+            b[j * ldb + i] = a[i * lda + j];
 }
 
-static void transpose_task(void *arg) {
-    MatOpArgs *args = (MatOpArgs*)arg;
-    // Split by rows of A
-    for(int i = args->start; i < args->end; i++) {
-        for(int j = 0; j < args->A->col; j++) {
-            args->C->data[j * args->C->col + i] = args->A->data[i * args->A->col + j];
-        }
+static void transpose_task(void *arg, int start, int end) {
+    TransposeArgs *args = (TransposeArgs*)arg;
+    const SimdKernels *k = simd_kernels();
+    const Matrix *A = args->A;
+    // Split by blocks of A, row-major over the block grid
+    for(int t = start; t < end; t++) {
+        int r0 = t / args->nbj * LA_TRANSPOSE_BLOCK;
+        int c0 = t % args->nbj * LA_TRANSPOSE_BLOCK;
+        int h = A->row - r0 < LA_TRANSPOSE_BLOCK ? A->row - r0 : LA_TRANSPOSE_BLOCK;
+        int w = A->col - c0 < LA_TRANSPOSE_BLOCK ? A->col - c0 : LA_TRANSPOSE_BLOCK;
+        transpose_block(k, mat_row(A, r0) + c0, A->ld, mat_row(args->C, c0) + r0, args->C->ld, h, w);
     }
-    free(args);
 }
 
-Matrix* transpose(const Matrix* A) {
-    Matrix* At = create_matrix(A->col, A->row);
-    if(!At) return NULL;
+// blocks per task: enough elements to cover the parallel_for overhead
+static int transpose_grain(void) {
+    int grain = LA_MIN_GRAIN / (LA_TRANSPOSE_BLOCK * LA_TRANSPOSE_BLOCK);
+    return grain > 0 ? grain : 1;
+}
 
-    ThreadPool *tp = get_la_pool();
-    int num_threads = tp->tcount;
-    int chunk = (A->row + num_threads - 1) / num_threads;
+void transpose_into(Matrix* At, const Matrix* A) {
+    assert(At->row == A->col && At->col == A->row && "output dim != A.col x A.row");
+    assert(At->data != A->data && "transpose_into can't write over its input");
+    if(A->row == 0 || A->col == 0) return;
 
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > A->row) ? A->row : start + chunk;
-        if(start >= end) break;
+    int nbi = (A->row + LA_TRANSPOSE_BLOCK - 1) / LA_TRANSPOSE_BLOCK;
+    int nbj = (A->col + LA_TRANSPOSE_BLOCK - 1) / LA_TRANSPOSE_BLOCK;
+    TransposeArgs args = { .A = A, .C = At, .nbj = nbj };
+    threadpool_parallel_for(get_la_pool(), nbi * nbj, transpose_grain(), transpose_task, &args);
+}
+
+// Swap the (h, w) block of A at (r0, c0) with the transpose of its mirror at
+// (c0, r0). A diagonal block (r0 == c0, h == w) is its own mirror, so only the
+// tiles on or above its diagonal are visited.
+static void transpose_swap_block(const SimdKernels *k, real_t *A, size_t ld, int r0, int c0, int h, int w) {
+    int tr = k->tr;
+    int diag = r0 == c0;
+    real_t tmp[SIMD_TR_MAX * SIMD_TR_MAX];
+    for(int i = 0; i < h; i += tr) {
+        for(int j = diag ? i : 0; j < w; j += tr) {
+            real_t *x = A + (size_t) (r0 + i) * ld + c0 + j;
+            real_t *y = A + (size_t) (c0 + j) * ld + r0 + i;
+            if(i + tr <= h && j + tr <= w) {
+                k->transpose(x, ld, tmp, tr);
+                if(x != y)
+                    k->transpose(y, ld, x, ld);
+                for(int p = 0; p < tr; p++)
+                    memcpy(y + p * ld, tmp + p * tr, tr * sizeof(real_t));
+                continue;
+            }
+            int th = h - i < tr ? h - i : tr;
+            int tw = w - j < tr ? w - j : tr;
+            for(int p = 0; p < th; p++) {
+                for(int q = x == y ? p + 1 : 0; q < tw; q++) {
+                    real_t v = x[p * ld + q];
+                    x[p * ld + q] = y[q * ld + p];
+                    y[q * ld + p] = v;
+                }
+            }
+        }
+    }
+}
 
-        MatOpArgs *args = malloc(sizeof(MatOpArgs));
-        args->A = A; args->C = At;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, transpose_task, args);
+static void transpose_inplace_task(void *arg, int start, int end) {
+    TransposeArgs *args = (TransposeArgs*)arg;
+    const SimdKernels *k = simd_kernels();
+    Matrix *A = args->C;
+    int n = A->row;
+    // Split by blocks of A on or above the diagonal; each swaps with its mirror
+    for(int t = start; t < end; t++) {
+        int bi = t / args->nbj, bj = t % args->nbj;
+        if(bi > bj) continue;
+        int r0 = bi * LA_TRANSPOSE_BLOCK, c0 = bj * LA_TRANSPOSE_BLOCK;
+        int h = n - r0 < LA_TRANSPOSE_BLOCK ? n - r0 : LA_TRANSPOSE_BLOCK;
+        int w = n - c0 < LA_TRANSPOSE_BLOCK ? n - c0 : LA_TRANSPOSE_BLOCK;
+        transpose_swap_block(k, A->data, A->ld, r0, c0, h, w);
     }
-    threadpool_wait(tp);
+}
+
+void transpose_inplace(Matrix* A) {
+    assert(A->row == A->col && "transpose_inplace needs a square matrix");
+    if(A->row == 0) return;
+
+    int nb = (A->row + LA_TRANSPOSE_BLOCK - 1) / LA_TRANSPOSE_BLOCK;
+    TransposeArgs args = { .A = A, .C = A, .nbj = nb };
+    threadpool_parallel_for(get_la_pool(), nb * nb, transpose_grain(), transpose_inplace_task, &args);
+}
+
+Matrix* transpose(const Matrix* A) {
+    Matrix* At = create_matrix_uninit(A->col, A->row);
+    if(!At) return NULL;
+
+    transpose_into(At, A);
     return At;
 }
 
+void hadamard_into(Matrix* C, const Matrix* A, const Matrix* B) {
+    // matscale logic
+    matscale_into(C, A, B);
+}
+
 Matrix* hadamard(const Matrix* A, const Matrix* B) {
     // matscale logic
     return matscale(A, B);
 }
 
-static void add_bias_task(void *arg) {
+static void add_bias_task(void *arg, int start, int end) {
     MatOpArgs *args = (MatOpArgs*)arg;
+    const SimdKernels *K = simd_kernels();
+    int col = args->C->col;
     // Split by rows of Z
-    for(int i = args->start; i < args->end; i++) {
-        for(int j = 0; j < args->A->col; j++) {
-            args->A->data[i * args->A->col + j] += args->B->data[j];
-        }
+    for(int i = start; i < end; i++) {
+        K->add(col, args->B->data, mat_row(args->C, i));
     }
-    free(args);
 }
 
 void mat_add_bias(Matrix *Z, const Matrix *b) {
-    ThreadPool *tp = get_la_pool();
-    int num_threads = tp->tcount;
-    int chunk = (Z->row + num_threads - 1) / num_threads;
+    MatOpArgs args = { .B = b, .C = Z };
+    threadpool_parallel_for(get_la_pool(), Z->row, row_grain(Z->col), add_bias_task, &args);
+}
 
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > Z->row) ? Z->row : start + chunk;
-        if(start >= end) break;
+// at most this many partials per reduction; more blocks only add combine work
+#define LA_REDUCE_BLOCKS 64
 
-        MatOpArgs *args = malloc(sizeof(MatOpArgs));
-        args->A = Z; args->B = b;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, add_bias_task, args);
+typedef struct {
+    la_reduce_fn fn;
+    void *ctx;
+    int n, block;
+    size_t stride; // doubles per partial, rounded up to whole cache lines
+    double *partial;
+} ReduceArgs;
+
+static void reduce_task(void *arg, int start, int end) {
+    ReduceArgs *r = (ReduceArgs*) arg;
+    for(int b = start; b < end; b++) {
+        int i0 = b * r->block;
+        int i1 = i0 + r->block < r->n ? i0 + r->block : r->n;
+        r->fn(r->ctx, i0, i1, r->partial + (size_t) b * r->stride);
     }
-    threadpool_wait(tp);
 }
 
-static void sum_rows_task(void *arg) {
-    MatOpArgs *args = (MatOpArgs*)arg;
-    // Split by columns (output size)
-    for(int j = args->start; j < args->end; j++) {
-        double sum = 0.0;
-        for(int i = 0; i < args->A->row; i++) {
-            sum += args->A->data[i * args->A->col + j];
-        }
-        args->C->data[j] += sum;
+void la_reduce_rows(int n, int width, int grain, la_reduce_fn fn, void* ctx, double* out) {
+    memset(out, 0, (size_t) width * sizeof(double));
+    if(n <= 0 || width <= 0)
+        return;
+    if(grain < 1)
+        grain = 1;
+    int block = (n + LA_REDUCE_BLOCKS - 1) / LA_REDUCE_BLOCKS;
+    if(block < grain)
+        block = grain;
+    int blocks = (n + block - 1) / block;
+    if(blocks == 1) {
+        fn(ctx, 0, n, out);
+        return;
+    }
+
+    size_t per_line = LA_ALIGN / sizeof(double);
+    size_t stride = ((size_t) width + per_line - 1) / per_line * per_line;
+    double *partial = (double*) la_scratch_get(LA_SCRATCH_REDUCE, blocks * stride * sizeof(double));
+    if(!partial) {
+        // no room for partials: one serial pass (same sum, different rounding)
+        fn(ctx, 0, n, out);
+        return;
+    }
+    memset(partial, 0, blocks * stride * sizeof(double));
+    ReduceArgs r = { .fn = fn, .ctx = ctx, .n = n, .block = block, .stride = stride, .partial = partial };
+    threadpool_parallel_for(get_la_pool(), blocks, 1, reduce_task, &r);
+
+    for(int b = 0; b < blocks; b++) {
+        const double *p = partial + (size_t) b * stride;
+        for(int j = 0; j < width; j++)
+            out[j] += p[j];
+    }
+    la_scratch_put(LA_SCRATCH_REDUCE, partial);
+}
+
+// rows [start, end) of a Matrix added into acc, walking each row contiguously
+static void sum_rows_block(void *arg, int start, int end, double *acc) {
+    const Matrix *A = (const Matrix*) arg;
+    for(int i = start; i < end; i++) {
+        const real_t *a = mat_row(A, i);
+        for(int j = 0; j < A->col; j++)
+            acc[j] += a[j];
+    }
+}
+
+// columns summed per reduction, so the accumulators fit on the stack
+#define LA_SUM_COLS 256
+
+void mat_sum_rows_into(Matrix *db, const Matrix *dA) {
+    assert(db->row == 1 && db->col == dA->col && "output dim != 1 x dA.col");
+
+    double sum[LA_SUM_COLS];
+    for(int j0 = 0; j0 < dA->col; j0 += LA_SUM_COLS) {
+        int w = dA->col - j0 < LA_SUM_COLS ? dA->col - j0 : LA_SUM_COLS;
+        Matrix cols = mat_view(dA, 0, dA->row, j0, w);
+        la_reduce_rows(dA->row, w, row_grain(w), sum_rows_block, &cols, sum);
+        for(int j = 0; j < w; j++)
+            db->data[j0 + j] = sum[j];
     }
-    free(args);
 }
 
 Matrix* mat_sum_rows(const Matrix *dA) {
-    Matrix *db = create_matrix(1, dA->col);
-    ThreadPool *tp = get_la_pool();
-    int num_threads = tp->tcount;
-    int chunk = (dA->col + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > dA->col) ? dA->col : start + chunk;
-        if(start >= end) break;
-
-        MatOpArgs *args = malloc(sizeof(MatOpArgs));
-        args->A = dA; args->C = db;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, sum_rows_task, args);
-    }
-    threadpool_wait(tp);
+    Matrix *db = create_matrix_uninit(1, dA->col);
+    if(!db) return NULL;
+
+    mat_sum_rows_into(db, dA);
     return db;
 }
 
@@ -53,40 +53,34 @@ static double randn_r(double mean, double std, unsigned int *seed) {
 typedef struct {
     Matrix *m;
     double mean, std;
-    int start, end;
     unsigned int seed;
 } RandArgs;
 
-static void randn_task(void *arg) {
+// the stream restarts every RANDN_BLOCK values, seeded from the block offset,
+// so the result doesn't depend on how parallel_for splits the matrix
+#define RANDN_BLOCK 1024
+
+static void randn_task(void *arg, int start, int end) {
     RandArgs *a = (RandArgs*)arg;
-    unsigned int seed = a->seed;
-    for(int i = a->start; i < a->end; i++) {
+    // a chunk starting inside a block replays the block up to its start
+    int block = start - start % RANDN_BLOCK;
+    unsigned int seed = a->seed + (unsigned int)block;
+    for(int i = block; i < start; i++) {
+        randn_r(a->mean, a->std, &seed);
+    }
+    for(int i = start; i < end; i++) {
+        if(i % RANDN_BLOCK == 0) seed = a->seed + (unsigned int)i;
         a->m->data[i] = randn_r(a->mean, a->std, &seed);
     }
-    free(a);
 }
 
 Matrix* matrix_randn(size_t row, size_t col, double mean, double std) {
     Matrix *m = create_matrix(row, col);
     if(!m) return NULL;
 
-    ThreadPool *tp = get_la_pool();
-    int total = row * col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
-
-        RandArgs *args = malloc(sizeof(RandArgs));
-        args->m = m; args->mean = mean; args->std = std;
-        args->start = start; args->end = end;
-        args->seed = rand() + i; // Initial seed from global rand
-        threadpool_submit(tp, randn_task, args);
-    }
-    threadpool_wait(tp);
+    RandArgs args = { .m = m, .mean = mean, .std = std };
+    args.seed = rand(); // Initial seed from global rand
+    threadpool_parallel_for(get_la_pool(), (int)(row * col), RANDN_BLOCK, randn_task, &args);
     return m;
 }
 
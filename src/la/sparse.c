@@ -0,0 +1,332 @@
+#include "la/sparse.h"
+#include "poolla/simd.h"
+
+// smallest chunk worth shipping to another thread, in multiply-adds
+#define SPARSE_MIN_WORK 16384
+
+CsrMatrix* create_csr(int row, int col, int nnz) {
+    CsrMatrix* A = (CsrMatrix*) calloc(1, sizeof(CsrMatrix));
+    if(!A) return NULL;
+    A->row = row;
+    A->col = col;
+    A->nnz = nnz;
+    A->row_ptr = (int*) calloc((size_t) row + 1, sizeof(int));
+    A->col_idx = (int*) malloc(((size_t) nnz + 1) * sizeof(int));
+    A->val = (real_t*) malloc(((size_t) nnz + 1) * sizeof(real_t));
+    if(!A->row_ptr || !A->col_idx || !A->val) {
+        free_csr(A);
+        return NULL;
+    }
+    return A;
+}
+
+int csr_finish(CsrMatrix* A) {
+    free(A->col_ptr);
+    free(A->col_row);
+    free(A->col_pos);
+    A->col_ptr = (int*) calloc((size_t) A->col + 1, sizeof(int));
+    A->col_row = (int*) malloc(((size_t) A->nnz + 1) * sizeof(int));
+    A->col_pos = (int*) malloc(((size_t) A->nnz + 1) * sizeof(int));
+    if(!A->col_ptr || !A->col_row || !A->col_pos)
+        return -1;
+
+    // counting sort by column; walking rows in order keeps each column's rows ascending
+    for(int k = A->row_ptr[0]; k < A->row_ptr[A->row]; k++)
+        A->col_ptr[A->col_idx[k] + 1]++;
+    for(int j = 0; j < A->col; j++)
+        A->col_ptr[j + 1] += A->col_ptr[j];
+    int* next = (int*) malloc(((size_t) A->col + 1) * sizeof(int));
+    if(!next)
+        return -1;
+    memcpy(next, A->col_ptr, (size_t) A->col * sizeof(int));
+    for(int i = 0; i < A->row; i++) {
+        for(int k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+            int dst = next[A->col_idx[k]]++;
+            A->col_row[dst] = i;
+            A->col_pos[dst] = k;
+        }
+    }
+    free(next);
+    return 0;
+}
+
+void free_csr(CsrMatrix* A) {
+    if(A) {
+        if(!A->view) {
+            free(A->row_ptr);
+            free(A->col_idx);
+            free(A->val);
+        }
+        free(A->col_ptr);
+        free(A->col_row);
+        free(A->col_pos);
+        free(A->center);
+        free(A);
+    }
+}
+
+CsrMatrix* csr_from_dense(const Matrix* A) {
+    int nnz = 0;
+    for(int i = 0; i < A->row; i++) {
+        const real_t* a = mat_row(A, i);
+        for(int j = 0; j < A->col; j++)
+            nnz += a[j] != 0;
+    }
+
+    CsrMatrix* S = create_csr(A->row, A->col, nnz);
+    if(!S) return NULL;
+    int k = 0;
+    for(int i = 0; i < A->row; i++) {
+        const real_t* a = mat_row(A, i);
+        for(int j = 0; j < A->col; j++) {
+            if(a[j] != 0) {
+                S->col_idx[k] = j;
+                S->val[k++] = a[j];
+            }
+        }
+        S->row_ptr[i + 1] = k;
+    }
+    if(csr_finish(S) != 0) {
+        free_csr(S);
+        return NULL;
+    }
+    return S;
+}
+
+void csr_row_dense(const CsrMatrix* A, int i, real_t* out) {
+    for(int j = 0; j < A->col; j++)
+        out[j] = A->center ? -A->center[j] : 0;
+    for(int k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++)
+        out[A->col_idx[k]] += A->val[k];
+}
+
+Matrix* csr_to_dense(const CsrMatrix* A) {
+    Matrix* D = create_matrix(A->row, A->col);
+    if(!D) return NULL;
+    for(int i = 0; i < A->row; i++)
+        csr_row_dense(A, i, mat_row(D, i));
+    return D;
+}
+
+CsrMatrix* csr_select_rows(const CsrMatrix* A, const int* rows, int n) {
+    int nnz = 0;
+    for(int i = 0; i < n; i++)
+        nnz += A->row_ptr[rows[i] + 1] - A->row_ptr[rows[i]];
+
+    CsrMatrix* S = create_csr(n, A->col, nnz);
+    if(!S) return NULL;
+    for(int i = 0; i < n; i++) {
+        int from = A->row_ptr[rows[i]], len = A->row_ptr[rows[i] + 1] - from;
+        memcpy(S->col_idx + S->row_ptr[i], A->col_idx + from, (size_t) len * sizeof(int));
+        memcpy(S->val + S->row_ptr[i], A->val + from, (size_t) len * sizeof(real_t));
+        S->row_ptr[i + 1] = S->row_ptr[i] + len;
+    }
+    if(A->center) {
+        S->center = (real_t*) malloc((size_t) A->col * sizeof(real_t));
+        if(!S->center) {
+            free_csr(S);
+            return NULL;
+        }
+        memcpy(S->center, A->center, (size_t) A->col * sizeof(real_t));
+    }
+    if(csr_finish(S) != 0) {
+        free_csr(S);
+        return NULL;
+    }
+    return S;
+}
+
+CsrMatrix* csr_view_rows(const CsrMatrix* A, int row0, int n) {
+    assert(row0 >= 0 && n >= 0 && row0 + n <= A->row && "view rows out of range");
+    CsrMatrix* S = (CsrMatrix*) calloc(1, sizeof(CsrMatrix));
+    if(!S) return NULL;
+    S->view = 1;
+    S->row = n;
+    S->col = A->col;
+    // row_ptr keeps A's offsets, so every kernel indexes A's col_idx / val directly
+    S->row_ptr = A->row_ptr + row0;
+    S->col_idx = A->col_idx;
+    S->val = A->val;
+    S->nnz = S->row_ptr[n] - S->row_ptr[0];
+    if(A->center) {
+        S->center = (real_t*) malloc((size_t) A->col * sizeof(real_t));
+        if(!S->center) {
+            free_csr(S);
+            return NULL;
+        }
+        memcpy(S->center, A->center, (size_t) A->col * sizeof(real_t));
+    }
+    if(csr_finish(S) != 0) {
+        free_csr(S);
+        return NULL;
+    }
+    return S;
+}
+
+// chunk of rows (or columns) so each one gets about SPARSE_MIN_WORK multiply-adds
+static int sparse_grain(int nnz, int lines, int n) {
+    double per_line = ((double) nnz / (lines > 0 ? lines : 1) + 1.0) * (n > 0 ? n : 1);
+    int grain = (int) (SPARSE_MIN_WORK / per_line);
+    return grain > 1 ? grain : 1;
+}
+
+typedef struct {
+    const CsrMatrix* A;
+    const real_t* B; // (A->col, n), row stride ldb
+    size_t ldb;
+    const real_t* base; // (n) value every output row starts from, or NULL for zero
+    int n;
+    int relu;
+    Matrix *Y, *Z; // Z (pre-activation) may be NULL, then Y is activated in place
+} SpmmArgs;
+
+static void spmm_task(void* arg, int start, int end) {
+    SpmmArgs* a = (SpmmArgs*) arg;
+    const SimdKernels* K = simd_kernels();
+    const CsrMatrix* A = a->A;
+    int n = a->n;
+    for(int i = start; i < end; i++) {
+        real_t* y = mat_row(a->Y, i);
+        real_t* z = a->Z ? mat_row(a->Z, i) : y;
+        if(a->base)
+            memcpy(z, a->base, (size_t) n * sizeof(real_t));
+        else
+            memset(z, 0, (size_t) n * sizeof(real_t));
+        // the output row stays in L1 while each stored value adds one row of B
+        for(int k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++)
+            K->axpby(n, A->val[k], a->B + (size_t) A->col_idx[k] * a->ldb, 1.0, z);
+        if(a->relu)
+            K->relu(n, z, y);
+    }
+}
+
+int spmm_bias_act_into(Matrix* Y, Matrix* Z, const CsrMatrix* A, MatRef B, const Matrix* bias, LaAct act) {
+    assert(A->col == B.row && "matrix dim A.col != B.row");
+    assert(Y->row == A->row && Y->col == B.col && "output dim != A.row x B.col");
+    assert((!Z || (Z->row == Y->row && Z->col == Y->col)) && "pre-activation dim != output dim");
+
+    ThreadPool* tp = get_la_pool();
+    if(!tp) {
+        la_init();
+        tp = get_la_pool();
+    }
+    const SimdKernels* K = simd_kernels();
+    int n = B.col;
+
+    // 16-bit weights are widened once; rows of B are then read nnz times
+    real_t* wide = NULL;
+    const real_t* Bd = B.data;
+    size_t ldb = B.ld;
+    if(!Bd) {
+        wide = (real_t*) la_scratch_get(LA_SCRATCH_WIDE, ((size_t) B.row * n + 1) * sizeof(real_t));
+        if(!wide) return -1;
+        for(int p = 0; p < B.row; p++)
+            K->from_half(n, B.fmt, B.half + (size_t) p * B.ld, wide + (size_t) p * n);
+        Bd = wide;
+        ldb = n;
+    }
+
+    // bias - center * B: the dense part shared by every output row
+    real_t* base = NULL;
+    if(bias || A->center) {
+        base = (real_t*) la_scratch_get(LA_SCRATCH_ROW, ((size_t) n + 1) * sizeof(real_t));
+        if(!base) {
+            if(wide) la_scratch_put(LA_SCRATCH_WIDE, wide);
+            return -1;
+        }
+        memset(base, 0, (size_t) n * sizeof(real_t));
+        if(bias)
+            memcpy(base, bias->data, (size_t) n * sizeof(real_t));
+        for(int p = 0; A->center && p < A->col; p++)
+            if(A->center[p] != 0)
+                K->axpby(n, -A->center[p], Bd + (size_t) p * ldb, 1.0, base);
+    }
+
+    int relu = (act == LA_ACT_RELU);
+    SpmmArgs args = { .A = A, .B = Bd, .ldb = ldb, .base = base, .n = n, .relu = relu, .Y = Y, .Z = relu ? Z : NULL };
+    threadpool_parallel_for(tp, A->row, sparse_grain(A->nnz, A->row, n), spmm_task, &args);
+    if(base) la_scratch_put(LA_SCRATCH_ROW, base);
+    if(wide) la_scratch_put(LA_SCRATCH_WIDE, wide);
+    return 0;
+}
+
+Matrix* spmm_bias_act(const CsrMatrix* A, MatRef B, const Matrix* bias, LaAct act, Matrix** Z) {
+    assert(A->col == B.row && "matrix dim A.col != B.row");
+
+    int relu = (act == LA_ACT_RELU);
+    Matrix* Y = create_matrix_uninit(A->row, B.col);
+    Matrix* pre = (relu && Z) ? create_matrix_uninit(A->row, B.col) : NULL;
+    if(!Y || (relu && Z && !pre) || spmm_bias_act_into(Y, pre, A, B, bias, act) != 0) {
+        free_matrix(Y);
+        free_matrix(pre);
+        return NULL;
+    }
+    if(pre)
+        *Z = pre;
+    return Y;
+}
+
+Matrix* spmm(const CsrMatrix* A, const Matrix* B) {
+    return spmm_bias_act(A, mat_ref(B), NULL, LA_ACT_NONE, NULL);
+}
+
+typedef struct {
+    const CsrMatrix* A;
+    const Matrix* B;
+    const real_t* colsum; // (n) column sums of B when A has a center, else NULL
+    Matrix* C;
+} SpmmTnArgs;
+
+static void spmm_tn_task(void* arg, int start, int end) {
+    SpmmTnArgs* a = (SpmmTnArgs*) arg;
+    const SimdKernels* K = simd_kernels();
+    const CsrMatrix* A = a->A;
+    int n = a->B->col;
+    for(int j = start; j < end; j++) {
+        real_t* c = mat_row(a->C, j);
+        // (S - 1 center)^T B = S^T B - center^T (1^T B)
+        if(a->colsum && A->center[j] != 0) {
+            for(int p = 0; p < n; p++)
+                c[p] = (real_t) (-A->center[j] * a->colsum[p]);
+        } else {
+            memset(c, 0, (size_t) n * sizeof(real_t));
+        }
+        for(int k = A->col_ptr[j]; k < A->col_ptr[j + 1]; k++)
+            K->axpby(n, A->val[A->col_pos[k]], mat_row(a->B, A->col_row[k]), 1.0, c);
+    }
+}
+
+int spmm_tn_into(Matrix* C, const CsrMatrix* A, const Matrix* B) {
+    assert(A->row == B->row && "matrix dim A.row != B.row");
+    assert(C->row == A->col && C->col == B->col && "output dim != A.col x B.col");
+
+    ThreadPool* tp = get_la_pool();
+    if(!tp) {
+        la_init();
+        tp = get_la_pool();
+    }
+    real_t* colsum = NULL;
+    if(A->center) {
+        colsum = (real_t*) la_scratch_get(LA_SCRATCH_ROW, (size_t) B->col * sizeof(real_t));
+        if(!colsum)
+            return -1;
+        Matrix sums = { .row = 1, .col = B->col, .ld = B->col, .data = colsum, .view = 1 };
+        mat_sum_rows_into(&sums, B);
+    }
+
+    SpmmTnArgs args = { .A = A, .B = B, .colsum = colsum, .C = C };
+    threadpool_parallel_for(tp, A->col, sparse_grain(A->nnz, A->col, B->col), spmm_tn_task, &args);
+    if(colsum) la_scratch_put(LA_SCRATCH_ROW, colsum);
+    return 0;
+}
+
+Matrix* spmm_tn(const CsrMatrix* A, const Matrix* B) {
+    assert(A->row == B->row && "matrix dim A.row != B.row");
+
+    Matrix* C = create_matrix_uninit(A->col, B->col);
+    if(!C || spmm_tn_into(C, A, B) != 0) {
+        free_matrix(C);
+        return NULL;
+    }
+    return C;
+}
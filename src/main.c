@@ -1,21 +1,97 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "nn.h"
 #include "train.h"
 #include "val.h"
 #include "data.h"
+#include "quant.h"
+#include "poolla/backend.h"
 
-#define HIDDEN1_DIM  144
-#define HIDDEN2_DIM  144
-#define HIDDEN3_DIM  144
-#define OUTPUT_DIM   1
+#define HIDDEN_DIM    144
+#define HIDDEN_LAYERS 3
+#define MAX_LAYERS    32
+#define OUTPUT_DIM    1
 
 #define EPOCHS       100
 #define LEARNING_RATE 0.001
 
+#define CALIB_SAMPLES 2048 // training rows used to calibrate int8 activation ranges
+
 #define MAX_PATH_LEN 512
 
+// NNC_SPARSE=1 loads features as CSR, for one-hot / indicator heavy data
+static Dataset* load_dataset(const char *path) {
+    const char *sparse = getenv("NNC_SPARSE");
+    if (sparse && strcmp(sparse, "1") == 0) {
+        return load_csv_sparse(path, OUTPUT_DIM, 1);
+    }
+    return load_csv(path, OUTPUT_DIM, 1);
+}
+
+// NNC_HIDDEN=w1,w2,... sets the ReLU hidden layer widths; the output layer is
+// appended. Returns the number of layers.
+static int network_layers(int *width, Activation *act) {
+    int n = 0;
+    const char *hidden = getenv("NNC_HIDDEN");
+    if (hidden) {
+        char *end;
+        for (const char *p = hidden; *p && n < MAX_LAYERS - 1; p = *end ? end + 1 : end) {
+            long w = strtol(p, &end, 10);
+            if (end == p || w <= 0) {
+                fprintf(stderr, "NNC_HIDDEN=%s is not a list of widths, using the default\n", hidden);
+                n = 0;
+                break;
+            }
+            width[n++] = (int) w;
+        }
+    }
+    if (!hidden || n == 0) {
+        for (n = 0; n < HIDDEN_LAYERS; n++)
+            width[n] = HIDDEN_DIM;
+    }
+    for (int l = 0; l < n; l++)
+        act[l] = ACT_RELU;
+    width[n] = OUTPUT_DIM;
+    act[n] = ACT_NONE;
+    return n + 1;
+}
+
+// NNC_WS_BUDGET=MiB caps the training workspace; hidden activations that
+// don't fit are recomputed in the backward pass. 0 (unset) keeps them all.
+static size_t workspace_budget(void) {
+    const char *budget = getenv("NNC_WS_BUDGET");
+    if (!budget || !*budget) return 0;
+    char *end;
+    double mib = strtod(budget, &end);
+    if (end == budget || *end || mib < 0) {
+        fprintf(stderr, "NNC_WS_BUDGET=%s is not a size in MiB, ignoring it\n", budget);
+        return 0;
+    }
+    return (size_t) (mib * 1048576.0);
+}
+
+static void workspace_report(const Workspace *ws, size_t budget) {
+    int hidden = ws->n_layers - 1, kept = 0;
+    for (int l = 0; l < hidden; l++)
+        kept += ws->keep[l];
+    if (kept == hidden) {
+        printf("Workspace: %.1f MiB (%.1f MiB unshared)\n",
+               ws->bytes / 1048576.0, ws->unshared_bytes / 1048576.0);
+    } else {
+        printf("Workspace: %.1f MiB (%.1f MiB keeping every activation, %.1f MiB unshared)\n",
+               ws->bytes / 1048576.0, ws->full_bytes / 1048576.0, ws->unshared_bytes / 1048576.0);
+        printf("Checkpoints: %d of %d hidden activations kept, recomputing %.0f%% of a forward pass per step\n",
+               kept, hidden, 100.0 * ws->recompute);
+    }
+    if (budget && ws->bytes > budget && kept == hidden)
+        printf("Over the %.1f MiB budget: checkpoints would save less than one activation\n", budget / 1048576.0);
+    else if (budget && ws->bytes > budget)
+        printf("Over the %.1f MiB budget even with the fewest checkpoints\n", budget / 1048576.0);
+    printf("\n");
+}
+
 static void trim_newline(char *str) {
     int len = strlen(str);
     while (len > 0 && (str[len-1] == '\n' || str[len-1] == '\r')) {
@@ -23,7 +99,70 @@ static void trim_newline(char *str) {
     }
 }
 
-int main(void) {
+#define BENCH_SAMPLES  8192
+#define BENCH_FEATURES 64
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+/**
+ * Train the default network on seeded synthetic data once per storage format
+ * and print the final loss and time per epoch. The data and the initial
+ * weights depend only on the seed; with the same NNC_NUM_THREADS, rows from
+ * both precision builds compare (k-split GEMM rounding varies with it).
+ * @param seed seed for the data and the initial weights
+ */
+static void storage_benchmark(unsigned seed) {
+    Matrix *X, *Y;
+    generate_synthetic_data_seeded(&X, &Y, BENCH_SAMPLES, BENCH_FEATURES, seed);
+    int width[MAX_LAYERS];
+    Activation act[MAX_LAYERS];
+    int n_layers = network_layers(width, act);
+
+    printf("%d x %d synthetic samples, seed %u, %d epochs\n", BENCH_SAMPLES, BENCH_FEATURES, seed, EPOCHS);
+    const HalfFormat formats[] = {HALF_NONE, HALF_BF16, HALF_FP16};
+    for (int f = 0; f < 3; f++) {
+        srand(seed);
+        NN *net = net_create_layers(BENCH_FEATURES, n_layers, width, act);
+        net_set_storage(net, formats[f]);
+        Workspace *ws = workspace_create(net, BENCH_SAMPLES);
+        TrainResult r = {0};
+        double t0 = now_ms();
+        for (int epoch = 1; epoch <= EPOCHS; epoch++) {
+            r = train_epoch(net, X, Y, LEARNING_RATE, ws);
+        }
+        double ms = (now_ms() - t0) / EPOCHS;
+        printf("  %-7s %-4s loss %.6f  %6.1f ms/epoch\n", REAL_NAME,
+               net->storage == HALF_NONE ? "-" : half_format_name(net->storage), r.loss, ms);
+        workspace_free(ws);
+        net_free(net);
+    }
+    free_matrix(X);
+    free_matrix(Y);
+}
+
+int main(int argc, char **argv) {
+    // start the pool before any data is loaded so large matrices are first-touched by it
+    la_init();
+
+    // nnc --blas-check [seed]: BLAS backend conformance and throughput, then exit
+    if (argc > 1 && strcmp(argv[1], "--blas-check") == 0) {
+        unsigned seed = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 10) : (unsigned) time(NULL);
+        int failed = blas_conformance(seed);
+        la_destroy();
+        return failed ? 1 : 0;
+    }
+    // nnc --storage-bench [seed]: loss and epoch time for each 16-bit storage format
+    if (argc > 1 && strcmp(argv[1], "--storage-bench") == 0) {
+        unsigned seed = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 10) : (unsigned) time(NULL);
+        storage_benchmark(seed);
+        la_destroy();
+        return 0;
+    }
+
     printf("=== Neural Network Training ===\n\n");
 
     char train_path[MAX_PATH_LEN];
@@ -49,7 +188,7 @@ int main(void) {
 
     // Load training data
     printf("Loading training data from: %s\n", train_path);
-    Dataset *train_data = load_csv(train_path, OUTPUT_DIM, 1);
+    Dataset *train_data = load_dataset(train_path);
     
     if (!train_data) {
         fprintf(stderr, "Error: Failed to load training data\n");
@@ -59,7 +198,7 @@ int main(void) {
 
     // Load test data
     printf("\nLoading test data from: %s\n", test_path);
-    Dataset *test_data = load_csv(test_path, OUTPUT_DIM, 1);
+    Dataset *test_data = load_dataset(test_path);
     
     if (!test_data) {
         fprintf(stderr, "Error: Failed to load test data\n");
@@ -76,11 +215,31 @@ int main(void) {
     // Get input dimension from data
     int input_dim = train_data->n_features;
     
-    printf("\nArchitecture: %d -> %d -> %d -> %d -> %d\n\n", 
-           input_dim, HIDDEN1_DIM, HIDDEN2_DIM, HIDDEN3_DIM, OUTPUT_DIM);
+    int width[MAX_LAYERS];
+    Activation act[MAX_LAYERS];
+    int n_layers = network_layers(width, act);
+
+    printf("\nArchitecture: %d", input_dim);
+    for (int l = 0; l < n_layers; l++) {
+        printf(" -> %d", width[l]);
+    }
+    printf("\n\n");
 
     // Create network
-    NN *net = net_create(input_dim, HIDDEN1_DIM, HIDDEN2_DIM, HIDDEN3_DIM, OUTPUT_DIM);
+    NN *net = net_create_layers(input_dim, n_layers, width, act);
+    if (!net) {
+        fprintf(stderr, "Error: Failed to create network\n");
+        dataset_free(train_data);
+        dataset_free(test_data);
+        return 1;
+    }
+
+    // Training buffers, allocated once for the whole run
+    size_t budget = workspace_budget();
+    Workspace *ws = workspace_create_budget(net, train_data->n_samples, budget);
+    if (ws) {
+        workspace_report(ws, budget);
+    }
 
     // Initialize metric lists
     MetricList *train_metrics = metrics_init();
@@ -91,10 +250,14 @@ int main(void) {
 
     for (int epoch = 1; epoch <= EPOCHS; epoch++) {
         // Train
-        TrainResult train_result = train_epoch(net, train_data->X, train_data->Y, LEARNING_RATE);
+        TrainResult train_result = train_data->Xs
+            ? train_epoch_sparse(net, train_data->Xs, train_data->Y, LEARNING_RATE, ws)
+            : train_epoch(net, train_data->X, train_data->Y, LEARNING_RATE, ws);
         
         // Evaluate on test set
-        ValResult test_result = validate(net, test_data->X, test_data->Y);
+        ValResult test_result = test_data->Xs
+            ? validate_sparse(net, test_data->Xs, test_data->Y)
+            : validate(net, test_data->X, test_data->Y);
         
         // Store metrics
         metrics_append(train_metrics, epoch, train_result.loss, 
@@ -111,10 +274,26 @@ int main(void) {
         }
     }
 
+    workspace_free(ws);
+
     // Print history
     metrics_print(train_metrics, "Training");
     metrics_print(test_metrics, "Test");
 
+    // Post-training int8 quantization for scoring
+    QNN *qnet = quant_create(net, train_data, CALIB_SAMPLES);
+    // the int8 path scores dense rows
+    Matrix *X_test = test_data->Xs ? csr_to_dense(test_data->Xs) : test_data->X;
+    if (qnet && X_test) {
+        QuantReport qr = quant_evaluate(net, qnet, X_test, test_data->Y);
+        printf("\nInt8 scoring (test): R² %.6f -> %.6f (drop %.6f), %.2f ms -> %.2f ms\n",
+               qr.r2_ref, qr.r2_quant, qr.r2_ref - qr.r2_quant, qr.ms_ref, qr.ms_quant);
+    }
+    quant_free(qnet);
+    if (test_data->Xs) {
+        free_matrix(X_test);
+    }
+
     // Cleanup
     metrics_free(train_metrics);
     metrics_free(test_metrics);
@@ -2,163 +2,1095 @@
 #include "la/normal.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
-NN* net_create(int input, int hidden1, int hidden2, int hidden3, int output) {
-    NN *net = malloc(sizeof(NN));
-    la_init();
+// smallest block worth its own partial in the loss reduction, in elements
+#define NN_MIN_GRAIN 4096
 
-    net->W1 = Xavier_init((size_t)input,   (size_t)hidden1, input,   hidden1);
-    net->b1 = create_matrix(1, hidden1);
+// elements per arena slot boundary, so every W and b starts on a cache line
+#define NN_ARENA_ALIGN (LA_ALIGN / (int) sizeof(real_t))
 
-    net->W2 = Xavier_init((size_t)hidden1, (size_t)hidden2, hidden1, hidden2);
-    net->b2 = create_matrix(1, hidden2);
+static LaAct la_act(Activation act) {
+    return act == ACT_RELU ? LA_ACT_RELU : LA_ACT_NONE;
+}
 
-    net->W3 = Xavier_init((size_t)hidden2, (size_t)hidden3, hidden2, hidden3);
-    net->b3 = create_matrix(1, hidden3);
+// Matrix header over storage owned elsewhere; freeing it leaves the storage alone
+static Matrix* view_at(real_t *data, int row, int col, int ld) {
+    Matrix *m = malloc(sizeof(Matrix));
+    if(!m) return NULL;
+    Matrix v = { .row = row, .col = col, .ld = ld, .data = data, .view = 1 };
+    *m = v;
+    return m;
+}
 
-    net->W4 = Xavier_init((size_t)hidden3, (size_t)output,  hidden3, output);
-    net->b4 = create_matrix(1, output);
+// dense (row, col) Matrix over arena->data + off
+static Matrix* arena_view(const Matrix *arena, int off, int row, int col) {
+    return view_at(arena->data + off, row, col, col);
+}
+
+static int arena_round(int n) {
+    return (n + NN_ARENA_ALIGN - 1) / NN_ARENA_ALIGN * NN_ARENA_ALIGN;
+}
+
+// arena elements for the W and b of every layer of net
+static int arena_size(const NN *net) {
+    int n = 0;
+    for(int l = 0; l < net->n_layers; l++) {
+        const Layer *ly = &net->layer[l];
+        n += arena_round(ly->W->row * ly->W->col) + arena_round(ly->b->col);
+    }
+    return n;
+}
+
+// W / b views of layer l on arena, at the same offsets in every arena of net's layout;
+// returns the offset past them
+static int arena_layer(const Matrix *arena, int off, int in, int out, Matrix **W, Matrix **b) {
+    *W = arena_view(arena, off, in, out);
+    off += arena_round(in * out);
+    *b = arena_view(arena, off, 1, out);
+    return off + arena_round(out);
+}
+
+NN* net_create_layers(int input, int n_layers, const int *width, const Activation *act) {
+    la_init();
+    NN *net = calloc(1, sizeof(NN));
+    if(!net) return NULL;
+    net->n_layers = n_layers;
+    net->layer = calloc(n_layers, sizeof(Layer));
+
+    int total = 0;
+    for(int l = 0, in = input; l < n_layers; in = width[l++])
+        total += arena_round(in * width[l]) + arena_round(width[l]);
+    net->params = create_matrix(1, total);
+    if(!net->layer || !net->params) {
+        net_free(net);
+        return NULL;
+    }
+
+    for(int l = 0, in = input, off = 0; l < n_layers; in = width[l++]) {
+        Layer *ly = &net->layer[l];
+        ly->act = act[l];
+        off = arena_layer(net->params, off, in, width[l], &ly->W, &ly->b);
+        Matrix *W = Xavier_init((size_t)in, (size_t)width[l], in, width[l]);
+        if(!ly->W || !ly->b || !W) {
+            free_matrix(W);
+            net_free(net);
+            return NULL;
+        }
+        memcpy(ly->W->data, W->data, (size_t) in * width[l] * sizeof(real_t));
+        free_matrix(W);
+    }
+
+    net->storage = HALF_NONE;
+    HalfFormat fmt = half_format(getenv("NNC_STORAGE"));
+    if(net_set_storage(net, fmt) != 0)
+        fprintf(stderr, "NNC_STORAGE=%s: cannot allocate weight shadows, using full precision\n",
+                half_format_name(fmt));
 
     return net;
 }
 
+NN* net_create(int input, int hidden1, int hidden2, int hidden3, int output) {
+    int width[] = { hidden1, hidden2, hidden3, output };
+    Activation act[] = { ACT_RELU, ACT_RELU, ACT_RELU, ACT_NONE };
+    return net_create_layers(input, 4, width, act);
+}
+
+static void free_shadows(NN *net) {
+    for(int l = 0; l < net->n_layers; l++) {
+        free_half(net->layer[l].Wh);
+        net->layer[l].Wh = NULL;
+    }
+}
+
+int net_set_storage(NN *net, HalfFormat fmt) {
+    free_shadows(net);
+    net->storage = HALF_NONE;
+    if(fmt == HALF_NONE) return 0;
+    for(int l = 0; l < net->n_layers; l++) {
+        Layer *ly = &net->layer[l];
+        ly->Wh = create_half(ly->W->row, ly->W->col, fmt);
+        if(!ly->Wh) {
+            free_shadows(net);
+            return -1;
+        }
+    }
+    net->storage = fmt;
+    net_sync_storage(net);
+    return 0;
+}
+
+void net_sync_storage(NN *net) {
+    if(net->storage == HALF_NONE) return;
+    for(int l = 0; l < net->n_layers; l++)
+        half_store(net->layer[l].Wh, net->layer[l].W->data);
+}
+
 void net_free(NN *net) {
     if(!net) return;
-    free_matrix(net->W1); free_matrix(net->b1);
-    free_matrix(net->W2); free_matrix(net->b2);
-    free_matrix(net->W3); free_matrix(net->b3);
-    free_matrix(net->W4); free_matrix(net->b4);
+    if(net->layer) {
+        free_shadows(net);
+        for(int l = 0; l < net->n_layers; l++) {
+            free_matrix(net->layer[l].W);
+            free_matrix(net->layer[l].b);
+        }
+    }
+    free(net->layer);
+    free_matrix(net->params);
     free(net);
 }
 
-Cache* forward(NN *net, const Matrix *X) {
-    Cache *c = malloc(sizeof(Cache));
-    
-    // Layer 1
-    c->Z1 = matmul(X, net->W1);
-    mat_add_bias(c->Z1, net->b1);
-    c->A1 = relu(c->Z1);
-
-    // Layer 2
-    c->Z2 = matmul(c->A1, net->W2);
-    mat_add_bias(c->Z2, net->b2);
-    c->A2 = relu(c->Z2);
-
-    // Layer 3
-    c->Z3 = matmul(c->A2, net->W3);
-    mat_add_bias(c->Z3, net->b3);
-    c->A3 = relu(c->Z3);
-
-    // Layer 4 (Output) - Linear activation
-    c->Z4 = matmul(c->A3, net->W4);
-    mat_add_bias(c->Z4, net->b4);
-    c->A4 = create_matrix(c->Z4->row, c->Z4->col);
-    for(int i = 0; i < c->Z4->row * c->Z4->col; i++) {
-        c->A4->data[i] = c->Z4->data[i];
+// whichever of a full / 16-bit pair is populated
+static MatRef either_ref(const Matrix *m, const HalfMatrix *h) {
+    if(h) return half_ref(h);
+    if(m) return mat_ref(m);
+    MatRef none = { 0 };
+    return none;
+}
+
+// *m if it already has this shape, else a fresh (uninitialized) replacement
+static Matrix* ensure_matrix(Matrix **m, int row, int col) {
+    if(*m && (*m)->row == row && (*m)->col == col)
+        return *m;
+    free_matrix(*m);
+    *m = create_matrix_uninit(row, col);
+    return *m;
+}
+
+// ensure_matrix for hidden activations, whose rows are padded to whole cache lines
+static Matrix* ensure_padded(Matrix **m, int row, int col) {
+    if(*m && (*m)->row == row && (*m)->col == col)
+        return *m;
+    free_matrix(*m);
+    *m = create_matrix_padded_uninit(row, col);
+    return *m;
+}
+
+static HalfMatrix* ensure_half(HalfMatrix **h, int row, int col, HalfFormat fmt) {
+    if(*h && (*h)->row == row && (*h)->col == col && (*h)->fmt == fmt)
+        return *h;
+    free_half(*h);
+    *h = create_half(row, col, fmt);
+    return *h;
+}
+
+static void cache_clear(Cache *c) {
+    for(int l = 0; l < c->n_layers; l++) {
+        free_matrix(c->A[l]);
+        free_half(c->Ah[l]);
+    }
+    free(c->A);
+    free(c->Ah);
+    free_matrix(c->A0f);
+    c->A0f = NULL;
+    c->A = NULL;
+    c->Ah = NULL;
+    c->n_layers = 0;
+}
+
+// one slot per layer of net, and hidden activations held only at the
+// precision the storage mode uses
+static void cache_match(Cache *c, const NN *net) {
+    if(c->n_layers != net->n_layers) {
+        cache_clear(c);
+        int n = net->n_layers;
+        c->A = calloc(n, sizeof(Matrix*));
+        c->Ah = calloc(n, sizeof(HalfMatrix*));
+        assert(c->A && c->Ah && "out of memory for Cache");
+        c->n_layers = n;
     }
+    for(int l = 0; l + 1 < c->n_layers; l++) {
+        if(net->storage == HALF_NONE) {
+            free_half(c->Ah[l]);
+            c->Ah[l] = NULL;
+        } else {
+            free_matrix(c->A[l]);
+            c->A[l] = NULL;
+        }
+    }
+}
+
+// layer l's output as the next layer's input
+static MatRef cache_ref(const Cache *c, int l) {
+    return either_ref(c->A[l], c->Ah[l]);
+}
+
+// move the view of layer l's activation (the sparse layer 1 output when
+// l == n_layers) onto data
+static void cache_point(Cache *c, int l, void *data) {
+    if(l == c->n_layers)
+        c->A0f->data = data;
+    else if(c->Ah[l])
+        c->Ah[l]->data = data;
+    else
+        c->A[l]->data = data;
+}
 
+// Layers [first, end) from X into c, or from layer first - 1's activation
+// when first > 0. Bias and activation are fused into each matmul write-back; in
+// 16-bit mode each hidden GEMM rounds its outputs as tiles finish and the
+// next layer widens them again while packing.
+static void forward_layers(NN *net, const Matrix *X, Cache *c, int m, int first, int end) {
+    HalfFormat fmt = net->storage;
+    for(int l = first; l < end; l++) {
+        const Layer *ly = &net->layer[l];
+        int out = ly->W->col;
+        MatRef in = l == 0 ? mat_ref(X) : cache_ref(c, l - 1);
+
+        if(fmt != HALF_NONE && l + 1 < net->n_layers) {
+            gemm_bias_act_half_into(ensure_half(&c->Ah[l], m, out, fmt), NULL,
+                                    in, half_ref(ly->Wh), ly->b, la_act(ly->act));
+        } else if(l + 1 < net->n_layers) {
+            gemm_bias_act_ref_into(ensure_padded(&c->A[l], m, out), NULL,
+                                   in, mat_ref(ly->W), ly->b, la_act(ly->act));
+        } else {
+            // the output layer stays full precision for the loss
+            gemm_bias_act_ref_into(ensure_matrix(&c->A[l], m, out), NULL,
+                                   in, either_ref(ly->W, ly->Wh), ly->b, la_act(ly->act));
+        }
+    }
+}
+
+Cache* cache_create(void) {
+    return calloc(1, sizeof(Cache));
+}
+
+void forward_into(NN *net, const Matrix *X, Cache *c) {
+    cache_match(c, net);
+    forward_layers(net, X, c, X->row, 0, net->n_layers);
+}
+
+// layer 1 of forward_sparse_into
+static void forward_sparse_first(NN *net, const CsrMatrix *X, Cache *c) {
+    const Layer *ly = &net->layer[0];
+    int h1 = ly->W->col;
+    MatRef W1 = either_ref(ly->W, ly->Wh);
+
+    // Layer 1 one output row at a time: each stored feature adds one row of W1
+    if(net->storage == HALF_NONE || net->n_layers == 1) {
+        Matrix *(*ensure)(Matrix**, int, int) = net->n_layers == 1 ? ensure_matrix : ensure_padded;
+        spmm_bias_act_into(ensure(&c->A[0], X->row, h1), NULL, X, W1, ly->b, la_act(ly->act));
+    } else {
+        Matrix *A1 = ensure_matrix(&c->A0f, X->row, h1);
+        spmm_bias_act_into(A1, NULL, X, W1, ly->b, la_act(ly->act));
+        half_store(ensure_half(&c->Ah[0], X->row, h1, net->storage), A1->data);
+    }
+}
+
+void forward_sparse_into(NN *net, const CsrMatrix *X, Cache *c) {
+    cache_match(c, net);
+    forward_sparse_first(net, X, c);
+    forward_layers(net, NULL, c, X->row, 1, net->n_layers);
+}
+
+Cache* forward(NN *net, const Matrix *X) {
+    Cache *c = cache_create();
+    forward_into(net, X, c);
+    return c;
+}
+
+Cache* forward_sparse(NN *net, const CsrMatrix *X) {
+    Cache *c = cache_create();
+    forward_sparse_into(net, X, c);
     return c;
 }
 
 void cache_free(Cache *c) {
     if(!c) return;
-    free_matrix(c->Z1); free_matrix(c->A1);
-    free_matrix(c->Z2); free_matrix(c->A2);
-    free_matrix(c->Z3); free_matrix(c->A3);
-    free_matrix(c->Z4); free_matrix(c->A4);
+    cache_clear(c);
     free(c);
 }
 
-double mse(const Matrix *Y_pred, const Matrix *Y_true) {
+Matrix* cache_output(const Cache *c) {
+    return c->A[c->n_layers - 1];
+}
+
+typedef struct {
+    const Matrix *pred, *truth;
+} LossArgs;
+
+static void sq_err_block(void *arg, int start, int end, double *acc) {
+    LossArgs *a = (LossArgs*) arg;
+    int col = a->pred->col;
+    // dense operands are one run; padded ones go a row at a time
+    int dense = mat_dense(a->pred) && mat_dense(a->truth);
+    int rows = dense ? 1 : end - start;
+    int len = dense ? (end - start) * col : col;
     double loss = 0.0;
-    int size = Y_pred->row * Y_pred->col;
-    for(int i=0; i<size; i++) {
-        double diff = Y_pred->data[i] - Y_true->data[i];
-        loss += diff * diff;
+    for(int i=0; i<rows; i++) {
+        const real_t *p = mat_row(a->pred, start + i), *t = mat_row(a->truth, start + i);
+        for(int j=0; j<len; j++) {
+            double diff = p[j] - t[j];
+            loss += diff * diff;
+        }
     }
+    acc[0] += loss;
+}
+
+double mse(const Matrix *Y_pred, const Matrix *Y_true) {
+    int size = Y_pred->row * Y_pred->col;
+    LossArgs args = { .pred = Y_pred, .truth = Y_true };
+    double loss;
+    la_reduce_rows(Y_pred->row, 1, NN_MIN_GRAIN / (Y_pred->col > 0 ? Y_pred->col : 1), sq_err_block, &args, &loss);
     return loss / size;
 }
 
-Grad* backward(NN *net, const Matrix *X, const Matrix *Y_true, Cache *c) {
-    Grad *g = malloc(sizeof(Grad));
-    int batch_size = X->row;
+// gradient work for one layer; the three products only read dZ, so they run concurrently
+typedef struct {
+    MatRef A_prev, W; // full or 16-bit, depending on the storage mode
+    const CsrMatrix *A_sparse; // sparse input, used instead of A_prev when set
+    const Matrix *dZ;
+    int has_prev; // not the first layer, so dZ_prev is wanted
+    MatRef mask_prev; // previous layer's activation, masks dZ_prev through its ReLU (empty if linear)
+    Matrix *dW, *db, *dZ_prev; // outputs, sized by the caller
+} LayerGrad;
+
+static void dW_task(void *arg) {
+    LayerGrad *l = (LayerGrad*) arg;
+    if(l->A_sparse)
+        spmm_tn_into(l->dW, l->A_sparse, l->dZ);
+    else
+        matmul_tn_ref_into(l->dW, l->A_prev, mat_ref(l->dZ));
+}
+
+static void db_task(void *arg) {
+    LayerGrad *l = (LayerGrad*) arg;
+    mat_sum_rows_into(l->db, l->dZ);
+}
+
+static void dZ_prev_task(void *arg) {
+    LayerGrad *l = (LayerGrad*) arg;
+    matmul_nt_drelu_ref_into(l->dZ_prev, mat_ref(l->dZ), l->W, l->mask_prev);
+}
+
+// dW = A_prev^T * dZ, db = sum_rows(dZ) and, unless this is the first layer,
+// dZ_prev = (dZ * W^T) ⊙ (A_prev > 0) with the ReLU mask fused into the matmul
+// (dZ_prev is allocated here unless the caller provides it)
+static void layer_backward(LayerGrad *l) {
+    ThreadPool *tp = get_la_pool();
+    TaskGroup group;
+    Task task[3]; // joined below, so the task nodes can live on this frame
+    threadpool_group_init(&group);
+
+    if(!l->has_prev)
+        l->dZ_prev = NULL;
+    else if(!l->dZ_prev)
+        l->dZ_prev = create_matrix_padded_uninit(l->dZ->row, l->W.row);
+    threadpool_submit_task(tp, &group, &task[0], dW_task, l);
+    threadpool_submit_task(tp, &group, &task[1], db_task, l);
+    if(l->dZ_prev)
+        threadpool_submit_task(tp, &group, &task[2], dZ_prev_task, l);
+    threadpool_group_wait(tp, &group);
+}
+
+Grad* grad_create(void) {
+    return calloc(1, sizeof(Grad));
+}
+
+static void grad_clear(Grad *g) {
+    for(int l = 0; l < g->n_layers; l++) {
+        free_matrix(g->dW[l]);
+        free_matrix(g->db[l]);
+    }
+    free(g->dW);
+    free(g->db);
+    free_matrix(g->params);
+    g->dW = g->db = NULL;
+    g->params = NULL;
+    g->n_layers = 0;
+}
+
+// gradient arena in net's layout; its alignment gaps stay zero
+static void grad_match(Grad *g, const NN *net) {
+    if(g->params && g->n_layers == net->n_layers && g->params->col == net->params->col)
+        return;
+    grad_clear(g);
+    int n = net->n_layers;
+    g->dW = calloc(n, sizeof(Matrix*));
+    g->db = calloc(n, sizeof(Matrix*));
+    g->params = create_matrix(1, arena_size(net));
+    assert(g->dW && g->db && g->params && "out of memory for Grad");
+    g->n_layers = n;
+    for(int l = 0, off = 0; l < n; l++) {
+        const Matrix *W = net->layer[l].W;
+        off = arena_layer(g->params, off, W->row, W->col, &g->dW[l], &g->db[l]);
+        assert(g->dW[l] && g->db[l] && "out of memory for Grad");
+    }
+}
+
+// X or Xs is the network input. ws, when set, holds a dZ buffer per layer and
+// marks the layers whose activations c holds; the others are recomputed a
+// segment at a time into ws->redo_at (see ws_layout) before the backward needs
+// them. Without ws each dZ is allocated and freed once the layer below is done.
+static void backward_layers(NN *net, const Matrix *X, const CsrMatrix *Xs, const Matrix *Y_true,
+                            Cache *c, Grad *g, const Workspace *ws) {
+    grad_match(g, net);
+    Matrix **dZ_buf = ws ? ws->dZ : NULL;
+    const char *keep = ws ? ws->keep : NULL;
+    int L = net->n_layers;
+    const Matrix *out = c->A[L - 1];
+    int batch_size = out->row;
     double scale = 2.0 / (batch_size * Y_true->col);
 
-    // 1. Output Layer Gradients (Linear activation: dZ4 = dL/dA4)
-    Matrix *dZ4 = create_matrix(c->A4->row, c->A4->col);
-    for(int i=0; i<dZ4->row * dZ4->col; i++) {
-        dZ4->data[i] = scale * (c->A4->data[i] - Y_true->data[i]);
-    }
-
-    Matrix *A3_T = transpose(c->A3);
-    g->dW4 = matmul(A3_T, dZ4);
-    g->db4 = mat_sum_rows(dZ4);
-    free_matrix(A3_T);
-
-    // 2. Hidden Layer 3 Gradients
-    Matrix *W4_T = transpose(net->W4);
-    Matrix *dA3 = matmul(dZ4, W4_T);
-    free_matrix(W4_T);
-    free_matrix(dZ4);
-
-    Matrix *dZ3 = drelu(c->Z3, dA3);
-    free_matrix(dA3);
-
-    Matrix *A2_T = transpose(c->A2);
-    g->dW3 = matmul(A2_T, dZ3);
-    g->db3 = mat_sum_rows(dZ3);
-    free_matrix(A2_T);
-
-    // 3. Hidden Layer 2 Gradients
-    Matrix *W3_T = transpose(net->W3);
-    Matrix *dA2 = matmul(dZ3, W3_T);
-    free_matrix(W3_T);
-    free_matrix(dZ3);
-
-    Matrix *dZ2 = drelu(c->Z2, dA2);
-    free_matrix(dA2);
-
-    Matrix *A1_T = transpose(c->A1);
-    g->dW2 = matmul(A1_T, dZ2);
-    g->db2 = mat_sum_rows(dZ2);
-    free_matrix(A1_T);
-
-    // 4. Hidden Layer 1 Gradients
-    Matrix *W2_T = transpose(net->W2);
-    Matrix *dA1 = matmul(dZ2, W2_T);
-    free_matrix(W2_T);
-    free_matrix(dZ2);
-
-    Matrix *dZ1 = drelu(c->Z1, dA1);
-    free_matrix(dA1);
-
-    Matrix *X_T = transpose(X);
-    g->dW1 = matmul(X_T, dZ1);
-    g->db1 = mat_sum_rows(dZ1);
-    
-    free_matrix(X_T);
-    free_matrix(dZ1);
+    // Output layer: dZ = dL/dA, masked through its activation
+    Matrix *dZ = dZ_buf ? dZ_buf[L - 1] : create_matrix_uninit(out->row, out->col);
+    for(int i=0; i<dZ->row; i++) {
+        const real_t *a = mat_row(out, i), *y = mat_row(Y_true, i);
+        real_t *dz = mat_row(dZ, i);
+        for(int j=0; j<dZ->col; j++)
+            dz[j] = scale * (a[j] - y[j]);
+    }
+    if(net->layer[L - 1].act == ACT_RELU)
+        drelu_into(dZ, out, dZ);
 
+    // Then each layer hands the next one down its dZ
+    int held = L - 1; // the segment in the region is the one below this kept layer
+    for(int l = L - 1; l >= 0; l--) {
+        const Layer *ly = &net->layer[l];
+        if(keep && l > 0 && !keep[l - 1]) {
+            int lo = l - 1, hi = l;
+            while(lo > 0 && !keep[lo - 1]) lo--;
+            while(!keep[hi]) hi++;
+            if(hi != held) {
+                // recompute into the segment's own block, free during the forward tail
+                for(int k = lo; k < hi; k++)
+                    cache_point(c, k, ws->redo_at[k]);
+                if(lo == 0 && ws->redo_at[L])
+                    cache_point(c, L, ws->redo_at[L]);
+                if(lo == 0 && Xs) {
+                    forward_sparse_first(net, Xs, c);
+                    forward_layers(net, NULL, c, batch_size, 1, hi);
+                } else {
+                    forward_layers(net, X, c, batch_size, lo, hi);
+                }
+                held = hi;
+            }
+        }
+        LayerGrad lg = { .W = either_ref(ly->W, ly->Wh), .dZ = dZ, .has_prev = l > 0,
+                         .dW = g->dW[l], .db = g->db[l],
+                         .dZ_prev = dZ_buf && l > 0 ? dZ_buf[l - 1] : NULL };
+        if(l > 0) {
+            lg.A_prev = cache_ref(c, l - 1);
+            if(net->layer[l - 1].act == ACT_RELU)
+                lg.mask_prev = lg.A_prev;
+        } else if(X) {
+            lg.A_prev = mat_ref(X);
+        } else {
+            lg.A_sparse = Xs;
+        }
+        layer_backward(&lg);
+        if(!dZ_buf)
+            free_matrix(dZ);
+        dZ = lg.dZ_prev;
+    }
+}
+
+void backward_into(NN *net, const Matrix *X, const Matrix *Y_true, Cache *c, Grad *g) {
+    backward_layers(net, X, NULL, Y_true, c, g, NULL);
+}
+
+void backward_sparse_into(NN *net, const CsrMatrix *X, const Matrix *Y_true, Cache *c, Grad *g) {
+    backward_layers(net, NULL, X, Y_true, c, g, NULL);
+}
+
+Grad* backward(NN *net, const Matrix *X, const Matrix *Y_true, Cache *c) {
+    Grad *g = grad_create();
+    backward_into(net, X, Y_true, c, g);
+    return g;
+}
+
+Grad* backward_sparse(NN *net, const CsrMatrix *X, const Matrix *Y_true, Cache *c) {
+    Grad *g = grad_create();
+    backward_sparse_into(net, X, Y_true, c, g);
     return g;
 }
 
 void grad_free(Grad *g) {
     if(!g) return;
-    free_matrix(g->dW1); free_matrix(g->db1);
-    free_matrix(g->dW2); free_matrix(g->db2);
-    free_matrix(g->dW3); free_matrix(g->db3);
-    free_matrix(g->dW4); free_matrix(g->db4);
+    grad_clear(g);
     free(g);
 }
 
-void sgd_update(NN *net, Grad *g, double lr) {
-    sgd(net->W1, g->dW1, lr);
-    sgd(net->b1, g->db1, lr);
-    sgd(net->W2, g->dW2, lr);
-    sgd(net->b2, g->db2, lr);
-    sgd(net->W3, g->dW3, lr);
-    sgd(net->b3, g->db3, lr);
-    sgd(net->W4, g->dW4, lr);
-    sgd(net->b4, g->db4, lr);
+/* ------------------------------------------------------------- workspace */
+
+// One buffer of a training step: live over step times [start, end], where
+// the forward of layer l runs at l, the output gradient at L and the backward
+// of layer l at 2L - l. Both ends are inclusive since a step reads its inputs
+// while writing its outputs.
+typedef struct {
+    size_t bytes; // for max_batch rows, whole cache lines
+    int start, end;
+} WsBuf;
+
+// Greedy interval colouring: in order of start time each buffer takes the
+// smallest free slot that fits it, else grows the largest free slot, else
+// opens a new one. Fills in each buffer's byte offset; returns the arena size.
+static size_t ws_plan_slots(const WsBuf *b, int n, size_t *off) {
+    size_t *size = calloc(n, sizeof(size_t));
+    int *until = malloc(n * sizeof(int));
+    int *order = malloc(n * sizeof(int));
+    int *slot = malloc(n * sizeof(int));
+    assert(size && until && order && slot && "out of memory for workspace plan");
+    int nslots = 0;
+
+    for(int i = 0; i < n; i++) {
+        int k = i;
+        while(k > 0 && b[order[k - 1]].start > b[i].start) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = i;
+    }
+    for(int k = 0; k < n; k++) {
+        const WsBuf *w = &b[order[k]];
+        if(w->bytes == 0) {
+            slot[order[k]] = -1;
+            continue;
+        }
+        int fit = -1, big = -1;
+        for(int s = 0; s < nslots; s++) {
+            if(until[s] >= w->start) continue;
+            if(size[s] >= w->bytes && (fit < 0 || size[s] < size[fit])) fit = s;
+            if(big < 0 || size[s] > size[big]) big = s;
+        }
+        int s = fit >= 0 ? fit : big >= 0 ? big : nslots++;
+        if(size[s] < w->bytes) size[s] = w->bytes;
+        until[s] = w->end;
+        slot[order[k]] = s;
+    }
+
+    size_t total = 0;
+    for(int s = 0; s < nslots; s++) {
+        size_t start = total;
+        total += size[s];
+        size[s] = start; // now the slot's offset
+    }
+    for(int i = 0; i < n; i++)
+        off[i] = slot[i] >= 0 ? size[slot[i]] : 0;
+    free(size);
+    free(until);
+    free(order);
+    free(slot);
+    return total;
+}
+
+// Greedy by size: largest buffers first (earliest first among equals), each
+// at the lowest offset that does not overlap a placed buffer live at the same
+// time, so small buffers can share a larger one's storage while it is dead.
+// Fills in each buffer's byte offset; returns the arena size.
+static size_t ws_plan_size(const WsBuf *b, int n, size_t *off) {
+    int *order = malloc(n * sizeof(int));
+    int *placed = malloc(n * sizeof(int));
+    assert(order && placed && "out of memory for workspace plan");
+
+    for(int i = 0; i < n; i++) {
+        int k = i;
+        while(k > 0 && (b[order[k - 1]].bytes < b[i].bytes ||
+                        (b[order[k - 1]].bytes == b[i].bytes && b[order[k - 1]].start > b[i].start))) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = i;
+    }
+    size_t total = 0;
+    int np = 0; // placed so far, in offset order
+    for(int k = 0; k < n; k++) {
+        int i = order[k];
+        off[i] = 0;
+        if(b[i].bytes == 0) continue;
+        size_t at = 0;
+        for(int q = 0; q < np; q++) {
+            const WsBuf *o = &b[placed[q]];
+            if(o->end < b[i].start || o->start > b[i].end) continue;
+            if(off[placed[q]] >= at + b[i].bytes) break; // fits in the gap below o
+            if(off[placed[q]] + o->bytes > at) at = off[placed[q]] + o->bytes;
+        }
+        off[i] = at;
+        if(at + b[i].bytes > total) total = at + b[i].bytes;
+        int q = np++;
+        while(q > 0 && off[placed[q - 1]] > at) {
+            placed[q] = placed[q - 1];
+            q--;
+        }
+        placed[q] = i;
+    }
+    free(order);
+    free(placed);
+    return total;
+}
+
+// Neither greedy is optimal and each wins on some layouts (slots when sizes
+// are uniform, by size when segment blocks mix with single buffers), so plan
+// both ways and keep the smaller arena.
+static size_t ws_plan(const WsBuf *b, int n, size_t *off) {
+    size_t *alt = malloc(n * sizeof(size_t));
+    assert(alt && "out of memory for workspace plan");
+    size_t total = ws_plan_slots(b, n, off);
+    size_t by_size = ws_plan_size(b, n, alt);
+    if(by_size < total) {
+        memcpy(off, alt, n * sizeof(size_t));
+        total = by_size;
+    }
+    free(alt);
+    return total;
+}
+
+static size_t ws_bytes(int rows, int ld, size_t elem) {
+    size_t bytes = (size_t) rows * ld * elem;
+    return (bytes + LA_ALIGN - 1) / LA_ALIGN * LA_ALIGN;
+}
+
+static int padded_ld(int col) {
+    int per_line = LA_ALIGN / (int) sizeof(real_t);
+    return (col + per_line - 1) / per_line * per_line;
+}
+
+// buffer indices in the plan: per layer A, Ah, dZ and, at the lowest layer of
+// each dropped segment, the segment's forward and recompute blocks; then the
+// full-precision layer 1 output of the sparse 16-bit forward
+enum { WS_A, WS_AH, WS_DZ, WS_SEG, WS_REDO, WS_PER_LAYER };
+
+static HalfMatrix* half_view_at(uint16_t *data, int row, int col, HalfFormat fmt) {
+    HalfMatrix *h = malloc(sizeof(HalfMatrix));
+    if(!h) return NULL;
+    HalfMatrix v = { .row = row, .col = col, .fmt = fmt, .data = data, .view = 1 };
+    *h = v;
+    return h;
+}
+
+// bytes of layer l's activation for max_batch rows, at the precision it is kept in
+static size_t ws_act_bytes(const NN *net, int max_batch, int l) {
+    int w = net->layer[l].W->col;
+    if(l + 1 == net->n_layers)
+        return ws_bytes(max_batch, w, sizeof(real_t));
+    if(net->storage != HALF_NONE)
+        return ws_bytes(max_batch, w, sizeof(uint16_t));
+    return ws_bytes(max_batch, padded_ld(w), sizeof(real_t));
+}
+
+// Plan the buffers of a step with keep[l] == 0 layers dropped: a run of them
+// up to the next kept layer is a segment, recomputed by the backward pass from
+// the kept activation below it. With split set each segment gets a block of
+// its own that the forward pass writes and that is then free until the
+// backward pass recomputes the segment into a second block, live only while
+// the segment's gradients are formed; the planner can put other buffers in
+// either gap. The top segment is still in place when the backward pass
+// reaches it, so it has one block for the whole step. Otherwise every segment
+// shares one block, live from the first dropped layer's forward to the
+// backward that last reads it; a segment without a block uses the one below.
+// Fills b / off (L * WS_PER_LAYER + 1 entries) and each dropped layer's
+// offset in its segment's blocks in roff, with roff[L] for the sparse layer 1
+// output when layer 1 is dropped (else SIZE_MAX). Returns the arena size.
+static size_t ws_layout_as(const NN *net, int max_batch, const char *keep, int split,
+                           WsBuf *b, size_t *off, size_t *roff) {
+    int L = net->n_layers;
+    int half = net->storage != HALF_NONE;
+    WsBuf *sparse = b + L * WS_PER_LAYER;
+    memset(b, 0, (L * WS_PER_LAYER + 1) * sizeof(WsBuf));
+    size_t seg = 0;
+    int lo = -1; // lowest layer of the open segment
+    int first = -1; // lowest dropped layer, whose block every segment uses unless split
+
+    roff[L] = SIZE_MAX;
+    if(half && L > 1) {
+        size_t full = ws_bytes(max_batch, net->layer[0].W->col, sizeof(real_t));
+        if(keep[0]) {
+            *sparse = (WsBuf) { .bytes = full, .start = 0, .end = 0 };
+        } else {
+            // written again whenever layer 1 is recomputed, so it lives with the segment
+            roff[L] = 0;
+            seg = full;
+        }
+    }
+    for(int l = 0; l < L; l++) {
+        const Layer *ly = &net->layer[l];
+        int w = ly->W->col;
+        int last = l + 1 == L;
+        int ld = last ? w : padded_ld(w);
+        // an activation is read by the next layer's forward and backward; the
+        // output only until its gradient is formed
+        int end = last ? L : 2 * L - (l + 1);
+        WsBuf *lb = b + l * WS_PER_LAYER;
+        size_t act = ws_act_bytes(net, max_batch, l);
+        int on_half = half && !last;
+        roff[l] = SIZE_MAX;
+        if(keep[l]) {
+            lb[on_half ? WS_AH : WS_A] = (WsBuf) { .bytes = act, .start = l, .end = end };
+            if(lo >= 0) {
+                // segment [lo, l): read up to layer l's forward, and again from
+                // the recompute before layer l's backward to layer lo + 1's
+                WsBuf *sb = b + lo * WS_PER_LAYER;
+                if(!split) {
+                    if(first < 0) first = lo;
+                    WsBuf *shared = &b[first * WS_PER_LAYER + WS_SEG];
+                    if(seg > shared->bytes) shared->bytes = seg;
+                    shared->start = first;
+                    shared->end = 2 * L - first - 1;
+                } else if(last) {
+                    sb[WS_SEG] = (WsBuf) { .bytes = seg, .start = lo, .end = 2 * L - lo - 1 };
+                } else {
+                    sb[WS_SEG] = (WsBuf) { .bytes = seg, .start = lo, .end = l };
+                    sb[WS_REDO] = (WsBuf) { .bytes = seg, .start = 2 * L - l, .end = 2 * L - lo - 1 };
+                }
+            }
+            lo = -1;
+            seg = 0;
+        } else {
+            if(lo < 0) lo = l;
+            roff[l] = seg;
+            seg += act;
+        }
+        // dZ of layer l is formed by the step above it and read by its own backward
+        lb[WS_DZ] = (WsBuf) { .bytes = ws_bytes(max_batch, ld, sizeof(real_t)),
+                              .start = 2 * L - l - 1, .end = 2 * L - l };
+    }
+    return ws_plan(b, L * WS_PER_LAYER + 1, off);
+}
+
+// the smaller of the split and shared layouts (see ws_layout_as)
+static size_t ws_layout(const NN *net, int max_batch, const char *keep, WsBuf *b, size_t *off, size_t *roff) {
+    size_t shared = ws_layout_as(net, max_batch, keep, 0, b, off, roff);
+    size_t split = ws_layout_as(net, max_batch, keep, 1, b, off, roff);
+    return split <= shared ? split : ws_layout_as(net, max_batch, keep, 0, b, off, roff);
+}
+
+// Greedy checkpoint choice (Chen et al., training deep nets with sublinear
+// memory cost): walk the hidden layers dropping activations, and keep the
+// one that would grow the current run past cap bytes. The output is always kept.
+static void ws_checkpoints(const NN *net, int max_batch, size_t cap, char *keep) {
+    size_t run = 0;
+    for(int l = 0; l + 1 < net->n_layers; l++) {
+        run += ws_act_bytes(net, max_batch, l);
+        keep[l] = run > cap;
+        if(keep[l]) run = 0;
+    }
+    keep[net->n_layers - 1] = 1;
+}
+
+// forward work the backward pass redoes, as a fraction of one forward pass:
+// every dropped layer except those above the last kept hidden layer, whose
+// activations are still in place when the backward pass starts
+static double ws_recompute(const NN *net, const char *keep) {
+    double redo = 0.0, total = 0.0;
+    int top = 1; // no kept hidden layer above l yet
+    for(int l = net->n_layers - 1; l >= 0; l--) {
+        const Matrix *W = net->layer[l].W;
+        double work = (double) W->row * W->col;
+        total += work;
+        if(l + 1 < net->n_layers && keep[l]) top = 0;
+        if(!keep[l] && !top) redo += work;
+    }
+    return total > 0.0 ? redo / total : 0.0;
 }
 
+Workspace* workspace_create(const NN *net, int max_batch) {
+    return workspace_create_budget(net, max_batch, 0);
+}
+
+Workspace* workspace_create_budget(const NN *net, int max_batch, size_t budget) {
+    int L = net->n_layers;
+    int n = L * WS_PER_LAYER + 1;
+    int half = net->storage != HALF_NONE;
+    WsBuf *b = calloc(n, sizeof(WsBuf));
+    size_t *off = calloc(n, sizeof(size_t));
+    size_t *roff = calloc(L + 1, sizeof(size_t));
+    char *trial = malloc(L);
+    Workspace *ws = calloc(1, sizeof(Workspace));
+    if(ws) {
+        ws->keep = malloc(L);
+        ws->drop_at = calloc(L + 1, sizeof(void*));
+        ws->redo_at = calloc(L + 1, sizeof(void*));
+    }
+    if(!b || !off || !roff || !trial || !ws || !ws->keep || !ws->drop_at || !ws->redo_at) {
+        free(b);
+        free(off);
+        free(roff);
+        free(trial);
+        workspace_free(ws);
+        return NULL;
+    }
+    ws->n_layers = L;
+    ws->max_batch = max_batch;
+
+    memset(ws->keep, 1, L);
+    ws->full_bytes = ws_layout(net, max_batch, ws->keep, b, off, roff);
+    for(int i = 0; i < n; i++)
+        ws->unshared_bytes += b[i].bytes;
+    ws->bytes = ws->full_bytes;
+
+    // Over budget: try each run of hidden activations as the segment cap and
+    // take the plan that fits with the least recompute, else the smallest
+    for(int i = 0; budget && ws->full_bytes > budget && i + 1 < L; i++) {
+        size_t cap = 0;
+        for(int j = i; j + 1 < L; j++) {
+            cap += ws_act_bytes(net, max_batch, j);
+            ws_checkpoints(net, max_batch, cap, trial);
+            size_t bytes = ws_layout(net, max_batch, trial, b, off, roff);
+            double redo = ws_recompute(net, trial);
+            int fits = bytes <= budget, best_fits = ws->bytes <= budget;
+            if(fits ? !best_fits || redo < ws->recompute || (redo == ws->recompute && bytes < ws->bytes)
+                    : !best_fits && bytes < ws->bytes) {
+                memcpy(ws->keep, trial, L);
+                ws->bytes = bytes;
+                ws->recompute = redo;
+            }
+        }
+    }
+    // then spend what the budget has left: keep dropped layers back one at a
+    // time, each time the one that saves the most recomputation
+    while(budget && ws->bytes <= budget && ws->recompute > 0.0) {
+        int pick = -1;
+        size_t pick_bytes = 0;
+        double pick_redo = ws->recompute;
+        for(int l = 0; l + 1 < L; l++) {
+            if(ws->keep[l]) continue;
+            memcpy(trial, ws->keep, L);
+            trial[l] = 1;
+            size_t bytes = ws_layout(net, max_batch, trial, b, off, roff);
+            double redo = ws_recompute(net, trial);
+            if(bytes <= budget && (redo < pick_redo || (pick >= 0 && redo == pick_redo && bytes < pick_bytes))) {
+                pick = l;
+                pick_bytes = bytes;
+                pick_redo = redo;
+            }
+        }
+        if(pick < 0) break;
+        ws->keep[pick] = 1;
+        ws->bytes = pick_bytes;
+        ws->recompute = pick_redo;
+    }
+    // a plan that saves less than one of the activations it drops isn't worth
+    // the recomputation: keep them all and leave the budget unmet
+    size_t least = SIZE_MAX;
+    for(int l = 0; l + 1 < L; l++)
+        if(!ws->keep[l] && ws_act_bytes(net, max_batch, l) < least)
+            least = ws_act_bytes(net, max_batch, l);
+    if(least != SIZE_MAX && ws->full_bytes - ws->bytes < least) {
+        memset(ws->keep, 1, L);
+        ws->recompute = 0.0;
+    }
+    ws->bytes = ws_layout(net, max_batch, ws->keep, b, off, roff);
+
+    ws->arena = create_matrix_uninit(1, (int) (ws->bytes / sizeof(real_t)));
+    ws->cache = cache_create();
+    ws->grad = grad_create();
+    ws->dZ = calloc(L, sizeof(Matrix*));
+    int ok = ws->arena && ws->cache && ws->grad && ws->dZ;
+    if(ok) {
+        Cache *c = ws->cache;
+        cache_match(c, net);
+        grad_match(ws->grad, net);
+        char *base = (char*) ws->arena->data;
+        char *seg = NULL, *redo = NULL; // blocks of the segment holding layer l
+        for(int l = 0; l < L && ok; l++) {
+            const Layer *ly = &net->layer[l];
+            int w = ly->W->col;
+            int last = l + 1 == L;
+            int ld = last ? w : padded_ld(w);
+            const size_t *lo = off + l * WS_PER_LAYER;
+            if(!ws->keep[l] && (l == 0 || ws->keep[l - 1])) {
+                if(b[l * WS_PER_LAYER + WS_SEG].bytes)
+                    seg = base + lo[WS_SEG];
+                redo = b[l * WS_PER_LAYER + WS_REDO].bytes ? base + lo[WS_REDO] : seg;
+                if(l == 0 && roff[L] != SIZE_MAX) {
+                    ws->drop_at[L] = seg + roff[L];
+                    ws->redo_at[L] = redo + roff[L];
+                }
+            }
+            char *act = base + lo[half && !last ? WS_AH : WS_A];
+            if(!ws->keep[l]) {
+                act = ws->drop_at[l] = seg + roff[l];
+                ws->redo_at[l] = redo + roff[l];
+            }
+            if(half && !last)
+                ok = (c->Ah[l] = half_view_at((uint16_t*) act, max_batch, w, net->storage)) != NULL;
+            else
+                ok = (c->A[l] = view_at((real_t*) act, max_batch, w, ld)) != NULL;
+            ok = ok && (ws->dZ[l] = view_at((real_t*) (base + lo[WS_DZ]), max_batch, w, ld)) != NULL;
+        }
+        if(ok && half && L > 1) {
+            int w = net->layer[0].W->col;
+            char *a0 = ws->drop_at[L] ? (char*) ws->drop_at[L] : base + off[L * WS_PER_LAYER];
+            ok = (c->A0f = view_at((real_t*) a0, max_batch, w, w)) != NULL;
+        }
+    }
+    free(b);
+    free(off);
+    free(roff);
+    free(trial);
+    if(!ok) {
+        workspace_free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+Cache* workspace_cache(Workspace *ws, int m) {
+    assert(m <= ws->max_batch && "batch larger than the workspace");
+    Cache *c = ws->cache;
+    for(int l = 0; l < ws->n_layers; l++) {
+        if(c->A[l]) c->A[l]->row = m;
+        if(c->Ah[l]) c->Ah[l]->row = m;
+        ws->dZ[l]->row = m;
+    }
+    if(c->A0f) c->A0f->row = m;
+    // the last backward pass may have left dropped activations in their recompute blocks
+    for(int l = 0; l <= ws->n_layers; l++) {
+        if(ws->drop_at[l]) cache_point(c, l, ws->drop_at[l]);
+    }
+    return c;
+}
+
+void workspace_backward(NN *net, const Matrix *X, const CsrMatrix *Xs, const Matrix *Y_true, Workspace *ws) {
+    backward_layers(net, X, Xs, Y_true, ws->cache, ws->grad, ws);
+}
+
+void workspace_free(Workspace *ws) {
+    if(!ws) return;
+    for(int l = 0; ws->dZ && l < ws->n_layers; l++)
+        free_matrix(ws->dZ[l]);
+    free(ws->dZ);
+    free(ws->keep);
+    free(ws->drop_at);
+    free(ws->redo_at);
+    cache_free(ws->cache);
+    grad_free(ws->grad);
+    free_matrix(ws->arena);
+    free(ws);
+}
+
+// rows per predict chunk: enough for full GEMM tiles, few enough that a
+// chunk's two activation buffers stay in cache between layers
+#define NN_PREDICT_ROWS 256
+
+typedef struct {
+    NN *net;
+    const Matrix *X; // dense input, or NULL
+    const CsrMatrix *Xs; // sparse input, or NULL
+    Matrix *Y;
+    int rows; // input rows
+    size_t buf_bytes; // one activation buffer of a chunk
+} PredictArgs;
+
+static Matrix buf_matrix(void *data, int row, int col) {
+    Matrix v = { .row = row, .col = col, .ld = padded_ld(col), .data = (real_t*) data, .view = 1 };
+    return v;
+}
+
+static HalfMatrix buf_half(void *data, int row, int col, HalfFormat fmt) {
+    HalfMatrix v = { .row = row, .col = col, .fmt = fmt, .data = (uint16_t*) data, .view = 1 };
+    return v;
+}
+
+// Rows [r0, r0 + m) through every layer, ping-ponging between buf[0] and
+// buf[1]; the output layer writes straight into the chunk's rows of Y. Layer
+// for layer this does what forward_layers does, so predictions match
+// cache_output bit for bit in every storage mode.
+static void predict_chunk(PredictArgs *a, int r0, int m, char *buf[2]) {
+    NN *net = a->net;
+    HalfFormat fmt = net->storage;
+    int L = net->n_layers;
+    Matrix Yc = mat_view(a->Y, r0, m, 0, a->Y->col);
+    Matrix Xc, Af;
+    HalfMatrix Ah;
+    MatRef in;
+    int cur = 0; // buffer the next layer writes to
+    int first = 0;
+
+    if(a->Xs) {
+        // CSR rows r0.. in place: spmm reads only row_ptr, col_idx, val and center
+        CsrMatrix Sc = *a->Xs;
+        Sc.row = m;
+        Sc.row_ptr = a->Xs->row_ptr + r0;
+        Sc.nnz = Sc.row_ptr[m] - Sc.row_ptr[0];
+        Sc.col_ptr = Sc.col_row = Sc.col_pos = NULL;
+        Sc.view = 1;
+        const Layer *ly = &net->layer[0];
+        int h1 = ly->W->col;
+        MatRef W1 = either_ref(ly->W, ly->Wh);
+        if(L == 1) {
+            spmm_bias_act_into(&Yc, NULL, &Sc, W1, ly->b, la_act(ly->act));
+            return;
+        }
+        Af = buf_matrix(buf[cur], m, h1);
+        if(fmt != HALF_NONE)
+            Af.ld = h1; // half_store reads it back densely
+        spmm_bias_act_into(&Af, NULL, &Sc, W1, ly->b, la_act(ly->act));
+        in = mat_ref(&Af);
+        if(fmt != HALF_NONE) {
+            // forward_sparse rounds the full-precision layer 1 output the same way
+            cur ^= 1;
+            Ah = buf_half(buf[cur], m, h1, fmt);
+            half_store(&Ah, Af.data);
+            in = half_ref(&Ah);
+        }
+        cur ^= 1;
+        first = 1;
+    } else {
+        Xc = mat_view(a->X, r0, m, 0, a->X->col);
+        in = mat_ref(&Xc);
+    }
+
+    for(int l = first; l < L; l++) {
+        const Layer *ly = &net->layer[l];
+        int out = ly->W->col;
+        if(l + 1 == L) {
+            gemm_bias_act_ref_into(&Yc, NULL, in, either_ref(ly->W, ly->Wh), ly->b, la_act(ly->act));
+        } else if(fmt != HALF_NONE) {
+            Ah = buf_half(buf[cur], m, out, fmt);
+            gemm_bias_act_half_into(&Ah, NULL, in, half_ref(ly->Wh), ly->b, la_act(ly->act));
+            in = half_ref(&Ah);
+        } else {
+            Af = buf_matrix(buf[cur], m, out);
+            gemm_bias_act_ref_into(&Af, NULL, in, mat_ref(ly->W), ly->b, la_act(ly->act));
+            in = mat_ref(&Af);
+        }
+        cur ^= 1;
+    }
+}
+
+static void predict_task(void *arg, int start, int end) {
+    PredictArgs *a = (PredictArgs*) arg;
+    char *buf = la_scratch_get(LA_SCRATCH_ACT, 2 * a->buf_bytes);
+    assert(buf && "out of memory for predict buffers");
+    char *pair[2] = { buf, buf + a->buf_bytes };
+    for(int c = start; c < end; c++) {
+        int r0 = c * NN_PREDICT_ROWS;
+        int m = a->rows - r0 < NN_PREDICT_ROWS ? a->rows - r0 : NN_PREDICT_ROWS;
+        predict_chunk(a, r0, m, pair);
+    }
+    la_scratch_put(LA_SCRATCH_ACT, buf);
+}
+
+static void predict_run(NN *net, const Matrix *X, const CsrMatrix *Xs, Matrix *Y) {
+    int rows = X ? X->row : Xs->row;
+    assert(Y->row == rows && Y->col == net->layer[net->n_layers - 1].W->col &&
+           "prediction dim != n_samples x output");
+    PredictArgs a = { .net = net, .X = X, .Xs = Xs, .Y = Y, .rows = rows };
+    for(int l = 0; l + 1 < net->n_layers; l++) {
+        size_t bytes = ws_bytes(NN_PREDICT_ROWS, padded_ld(net->layer[l].W->col), sizeof(real_t));
+        if(bytes > a.buf_bytes)
+            a.buf_bytes = bytes;
+    }
+    ThreadPool *tp = get_la_pool();
+    if(!tp) {
+        la_init();
+        tp = get_la_pool();
+    }
+    // chunks are independent; the GEMMs inside one run on its own thread
+    threadpool_parallel_for(tp, (rows + NN_PREDICT_ROWS - 1) / NN_PREDICT_ROWS, 1, predict_task, &a);
+}
+
+void predict(NN *net, const Matrix *X, Matrix *Y) {
+    predict_run(net, X, NULL, Y);
+}
+
+void predict_sparse(NN *net, const CsrMatrix *X, Matrix *Y) {
+    predict_run(net, NULL, X, Y);
+}
+
+// every W and b in one pass over the arenas
+void sgd_update(NN *net, Grad *g, double lr) {
+    sgd(net->params, g->params, lr);
+    net_sync_storage(net);
+}
@@ -1,39 +1,34 @@
 #include <math.h>
 #include <stdlib.h>
 #include "optax.h"
+#include "poolla/simd.h"
 
 typedef struct {
     Matrix *W, *dW;
     AdamState *st;
     double lr;
-    int start, end;
+    int run; // contiguous run length (see mat_run)
 } OptArgs;
 
-static void sgd_task(void *arg) {
+// smallest chunk worth shipping to another thread, in elements
+#define OPT_MIN_GRAIN 4096
+
+static void sgd_task(void *arg, int start, int end) {
     OptArgs *a = (OptArgs*)arg;
-    for(int i=a->start; i<a->end; i++) {
-        a->W->data[i] -= a->lr * a->dW->data[i];
+    const SimdKernels *K = simd_kernels();
+    // W := -lr * dW + W
+    for(int k = start; k < end; ) {
+        int w = a->run - k % a->run;
+        if(w > end - k) w = end - k;
+        K->axpby(w, -a->lr, mat_at(a->dW, a->run, k), 1.0, mat_at(a->W, a->run, k));
+        k += w;
     }
-    free(a);
 }
 
 void sgd(Matrix *W, Matrix *dW, double lr) {
-    ThreadPool *tp = get_la_pool();
-    int total = W->row * W->col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
-
-        OptArgs *args = malloc(sizeof(OptArgs));
-        args->W = W; args->dW = dW; args->lr = lr;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, sgd_task, args);
-    }
-    threadpool_wait(tp);
+    assert(dW->row == W->row && dW->col == W->col && "gradient dim != W");
+    OptArgs args = { .W = W, .dW = dW, .lr = lr, .run = mat_run(W, dW, NULL) };
+    threadpool_parallel_for(get_la_pool(), W->row * W->col, OPT_MIN_GRAIN, sgd_task, &args);
 }
 
 AdamState* adam_init (const Matrix *W, double b1, double b2, double eps) {
@@ -63,43 +58,29 @@ AdamState* adam_init (const Matrix *W, double b1, double b2, double eps) {
     return st;
 }
 
-static void adam_task(void *arg) {
+static void adam_task(void *arg, int start, int end) {
     OptArgs *a = (OptArgs*)arg;
     AdamState *st = a->st;
     double corr1 = 1.0 - pow(st->b1, st->t);
     double corr2 = 1.0 - pow(st->b2, st->t);
 
-    for(int i=a->start; i<a->end; i++) {
-        double g = a->dW->data[i];
-        st->m->data[i] = st->b1 * st->m->data[i] + (1.0 - st->b1) * g;     
-        st->v->data[i] = st->b2 * st->v->data[i] + (1.0 - st->b2) * g * g; 
-
-        double mh = st->m->data[i] / corr1;
-        double vh = st->v->data[i] / corr2;
-
-        a->W->data[i] -= a->lr * mh / (sqrt(vh) + st->eps);
+    const SimdKernels *K = simd_kernels();
+    for(int k = start; k < end; ) {
+        int w = a->run - k % a->run;
+        if(w > end - k) w = end - k;
+        K->adam(w, a->lr, st->b1, st->b2, st->eps, corr1, corr2,
+                mat_at(a->dW, a->run, k), mat_at(st->m, a->run, k), mat_at(st->v, a->run, k),
+                mat_at(a->W, a->run, k));
+        k += w;
     }
-    free(a);
 }
 
 void adam (Matrix *W, Matrix *dW, AdamState *st, double lr) {
+    assert(dW->row == W->row && dW->col == W->col && "gradient dim != W");
     st->t++;
-    ThreadPool *tp = get_la_pool();
-    int total = W->row * W->col;
-    int num_threads = tp->tcount;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = (start + chunk > total) ? total : start + chunk;
-        if(start >= end) break;
-
-        OptArgs *args = malloc(sizeof(OptArgs));
-        args->W = W; args->dW = dW; args->st = st; args->lr = lr;
-        args->start = start; args->end = end;
-        threadpool_submit(tp, adam_task, args);
-    }
-    threadpool_wait(tp);
+    // the moments are dense; any padding in W or dW splits the walk into rows
+    OptArgs args = { .W = W, .dW = dW, .st = st, .lr = lr, .run = mat_run(W, dW, st->m) };
+    threadpool_parallel_for(get_la_pool(), W->row * W->col, OPT_MIN_GRAIN, adam_task, &args);
 }
 
 void adam_free(AdamState *st) {
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include "poolla/backend.h"
+
+static void shape_check(int ok, const char *what) {
+    if(!ok) {
+        fprintf(stderr, "Matrix dimensions do not match for %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* ------------------------------------------------------------- reference */
+
+static void gemm_reference(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+                           double alpha, const Matrix *A, const Matrix *B, double beta, Matrix *C) {
+    (void) pool;
+    int m = transA ? A->col : A->row;
+    int k = transA ? A->row : A->col;
+    int n = transB ? B->row : B->col;
+    shape_check((transB ? B->col : B->row) == k && C->row == m && C->col == n, "gemm");
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < n; j++) {
+            double sum = 0.0;
+            for(int p = 0; p < k; p++) {
+                double a = transA ? mat_row(A, p)[i] : mat_row(A, i)[p];
+                double b = transB ? mat_row(B, j)[p] : mat_row(B, p)[j];
+                sum += a * b;
+            }
+            real_t *c = mat_row(C, i) + j;
+            *c = (real_t) (alpha * sum + (beta == 0.0 ? 0.0 : beta * *c));
+        }
+    }
+}
+
+static void gemv_reference(ThreadPool *pool, BlasTrans transA,
+                           double alpha, const Matrix *A, const Matrix *x, double beta, Matrix *y) {
+    gemm_reference(pool, transA, BLAS_NO_TRANS, alpha, A, x, beta, y);
+}
+
+static void axpy_reference(ThreadPool *pool, double alpha, const Matrix *x, Matrix *y) {
+    (void) pool;
+    shape_check(y->row == x->row && y->col == x->col, "axpy");
+    for(int i = 0; i < x->row; i++) {
+        for(int j = 0; j < x->col; j++)
+            mat_row(y, i)[j] = (real_t) (alpha * mat_row(x, i)[j] + mat_row(y, i)[j]);
+    }
+}
+
+static void scal_reference(ThreadPool *pool, double alpha, Matrix *x) {
+    (void) pool;
+    for(int i = 0; i < x->row; i++) {
+        for(int j = 0; j < x->col; j++)
+            mat_row(x, i)[j] = (real_t) (alpha * mat_row(x, i)[j]);
+    }
+}
+
+static const BlasBackend backend_reference = {
+    .name = "reference",
+    .gemm = gemm_reference, .gemv = gemv_reference,
+    .axpy = axpy_reference, .scal = scal_reference,
+};
+
+/* ---------------------------------------------------------------- native */
+
+static void gemv_native(ThreadPool *pool, BlasTrans transA,
+                        double alpha, const Matrix *A, const Matrix *x, double beta, Matrix *y) {
+    if(transA)
+        dmtv(pool, alpha, A, x, beta, y);
+    else
+        dmv(pool, alpha, A, x, beta, y);
+}
+
+static void axpy_native(ThreadPool *pool, double alpha, const Matrix *x, Matrix *y) {
+    dvv(pool, alpha, x, 1.0, y);
+}
+
+static void scal_native(ThreadPool *pool, double alpha, Matrix *x) {
+    dsv(pool, alpha, x, 0.0);
+}
+
+static const BlasBackend backend_native = {
+    .name = "native",
+    .gemm = dgemm, .gemv = gemv_native,
+    .axpy = axpy_native, .scal = scal_native,
+};
+
+/* ----------------------------------------------------------------- CBLAS */
+
+// CBLAS enums, declared here so no cblas.h is needed at build time
+#define CBLAS_ROW_MAJOR 101
+#define CBLAS_NO_TRANS 111
+#define CBLAS_TRANS 112
+
+#ifdef NNC_FLOAT32
+#define CBLAS_PREFIX "cblas_s"
+#else
+#define CBLAS_PREFIX "cblas_d"
+#endif
+
+typedef void (*cblas_gemm_fn)(int order, int ta, int tb, int m, int n, int k, real_t alpha,
+                              const real_t *A, int lda, const real_t *B, int ldb,
+                              real_t beta, real_t *C, int ldc);
+typedef void (*cblas_gemv_fn)(int order, int ta, int m, int n, real_t alpha, const real_t *A, int lda,
+                              const real_t *x, int incx, real_t beta, real_t *y, int incy);
+typedef void (*cblas_axpy_fn)(int n, real_t alpha, const real_t *x, int incx, real_t *y, int incy);
+typedef void (*cblas_scal_fn)(int n, real_t alpha, real_t *x, int incx);
+
+static struct {
+    void *lib;
+    cblas_gemm_fn gemm;
+    cblas_gemv_fn gemv;
+    cblas_axpy_fn axpy;
+    cblas_scal_fn scal;
+} cblas;
+
+static void gemm_cblas(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+                       double alpha, const Matrix *A, const Matrix *B, double beta, Matrix *C) {
+    (void) pool; // the library runs its own threads
+    int m = transA ? A->col : A->row;
+    int k = transA ? A->row : A->col;
+    int n = transB ? B->row : B->col;
+    shape_check((transB ? B->col : B->row) == k && C->row == m && C->col == n, "gemm");
+    if(m == 0 || n == 0)
+        return;
+    cblas.gemm(CBLAS_ROW_MAJOR, transA ? CBLAS_TRANS : CBLAS_NO_TRANS, transB ? CBLAS_TRANS : CBLAS_NO_TRANS,
+               m, n, k, (real_t) alpha, A->data, A->ld > 0 ? A->ld : 1, B->data, B->ld > 0 ? B->ld : 1,
+               (real_t) beta, C->data, C->ld);
+}
+
+static void gemv_cblas(ThreadPool *pool, BlasTrans transA,
+                       double alpha, const Matrix *A, const Matrix *x, double beta, Matrix *y) {
+    (void) pool;
+    shape_check(x->col == 1 && y->col == 1 &&
+                (transA ? A->row : A->col) == x->row &&
+                (transA ? A->col : A->row) == y->row, "gemv");
+    if(A->row == 0 || A->col == 0)
+        return;
+    cblas.gemv(CBLAS_ROW_MAJOR, transA ? CBLAS_TRANS : CBLAS_NO_TRANS, A->row, A->col, (real_t) alpha,
+               A->data, A->ld, x->data, x->ld, (real_t) beta, y->data, y->ld);
+}
+
+// padded matrices go one row per call; dense ones and column vectors in one
+static void axpy_cblas(ThreadPool *pool, double alpha, const Matrix *x, Matrix *y) {
+    (void) pool;
+    shape_check(x->row == y->row && x->col == y->col, "axpy");
+    if(x->col == 1)
+        cblas.axpy(x->row, (real_t) alpha, x->data, x->ld, y->data, y->ld);
+    else if(mat_dense(x) && mat_dense(y))
+        cblas.axpy(x->row * x->col, (real_t) alpha, x->data, 1, y->data, 1);
+    else
+        for(int i = 0; i < x->row; i++)
+            cblas.axpy(x->col, (real_t) alpha, mat_row(x, i), 1, mat_row(y, i), 1);
+}
+
+static void scal_cblas(ThreadPool *pool, double alpha, Matrix *x) {
+    (void) pool;
+    if(x->col == 1)
+        cblas.scal(x->row, (real_t) alpha, x->data, x->ld);
+    else if(mat_dense(x))
+        cblas.scal(x->row * x->col, (real_t) alpha, x->data, 1);
+    else
+        for(int i = 0; i < x->row; i++)
+            cblas.scal(x->col, (real_t) alpha, mat_row(x, i), 1);
+}
+
+static const BlasBackend backend_cblas = {
+    .name = "cblas",
+    .gemm = gemm_cblas, .gemv = gemv_cblas,
+    .axpy = axpy_cblas, .scal = scal_cblas,
+};
+
+static pthread_once_t cblas_once = PTHREAD_ONCE_INIT;
+
+static void cblas_load(void) {
+    const char *names[] = {
+        getenv("NNC_CBLAS_LIB"),
+        "libopenblas.so.0", "libopenblas.so", "libcblas.so.3", "libcblas.so",
+        "libblis.so.4", "libmkl_rt.so", "libblas.so.3",
+    };
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if(!names[i])
+            continue;
+        void *lib = dlopen(names[i], RTLD_NOW | RTLD_LOCAL);
+        if(!lib)
+            continue;
+        cblas.gemm = (cblas_gemm_fn) dlsym(lib, CBLAS_PREFIX "gemm");
+        cblas.gemv = (cblas_gemv_fn) dlsym(lib, CBLAS_PREFIX "gemv");
+        cblas.axpy = (cblas_axpy_fn) dlsym(lib, CBLAS_PREFIX "axpy");
+        cblas.scal = (cblas_scal_fn) dlsym(lib, CBLAS_PREFIX "scal");
+        if(cblas.gemm && cblas.gemv && cblas.axpy && cblas.scal) {
+            cblas.lib = lib;
+            return;
+        }
+        dlclose(lib); // a Fortran-only BLAS without the C interface
+    }
+}
+
+/* -------------------------------------------------------------- selection */
+
+const BlasBackend* blas_backend_reference(void) {
+    return &backend_reference;
+}
+
+const BlasBackend* blas_backend_native(void) {
+    return &backend_native;
+}
+
+const BlasBackend* blas_backend_cblas(void) {
+    pthread_once(&cblas_once, cblas_load);
+    return cblas.lib ? &backend_cblas : NULL;
+}
+
+const BlasBackend* blas_backend_find(const char *name) {
+    if(strcmp(name, "reference") == 0) return blas_backend_reference();
+    if(strcmp(name, "native") == 0) return blas_backend_native();
+    if(strcmp(name, "cblas") == 0) return blas_backend_cblas();
+    return NULL;
+}
+
+static const BlasBackend *selected = NULL;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void backend_select(void) {
+    const char *env = getenv("NNC_BLAS");
+    if(!selected && env) {
+        selected = blas_backend_find(env);
+        if(!selected)
+            fprintf(stderr, "NNC_BLAS=%s not available, using native\n", env);
+    }
+    if(!selected)
+        selected = &backend_native;
+}
+
+const BlasBackend* blas_backend(void) {
+    pthread_once(&select_once, backend_select);
+    return selected;
+}
+
+void blas_set_backend(const BlasBackend *backend) {
+    pthread_once(&select_once, backend_select);
+    selected = backend ? backend : &backend_native;
+}
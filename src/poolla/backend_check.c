@@ -0,0 +1,252 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "poolla/backend.h"
+
+// Conformance and throughput harness for the BLAS backends. Every backend runs
+// the same operands as the reference, and each output must be within the
+// worst-case rounding bound of a depth-k dot product, (k + 2) eps times the same
+// product taken over absolute values, counted twice for the two computations.
+
+#ifdef NNC_FLOAT32
+#define REAL_EPS FLT_EPSILON
+#else
+#define REAL_EPS DBL_EPSILON
+#endif
+
+#define CHECK_MIN_MS 50.0 // time each case for at least this long
+#define CHECK_RANDOM_SHAPES 6
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static Matrix* random_matrix(int row, int col, int pad) {
+    Matrix *M = pad ? create_matrix_padded(row, col) : create_matrix(row, col);
+    for(int i = 0; i < row; i++) {
+        for(int j = 0; j < col; j++)
+            mat_row(M, i)[j] = (real_t) (2.0 * rand() / RAND_MAX - 1.0);
+    }
+    return M;
+}
+
+// same shape and padding as M
+static Matrix* like_matrix(const Matrix *M) {
+    return M->ld != M->col ? create_matrix_padded(M->row, M->col) : create_matrix(M->row, M->col);
+}
+
+static Matrix* copy_matrix(const Matrix *M) {
+    Matrix *C = like_matrix(M);
+    memcpy(C->data, M->data, sizeof(real_t) * M->row * M->ld);
+    return C;
+}
+
+static Matrix* abs_matrix(const Matrix *M) {
+    if(!M)
+        return NULL;
+    Matrix *C = like_matrix(M);
+    for(int i = 0; i < M->row; i++) {
+        for(int j = 0; j < M->col; j++)
+            mat_row(C, i)[j] = (real_t) fabs(mat_row(M, i)[j]);
+    }
+    return C;
+}
+
+typedef enum { OP_GEMM, OP_GEMV, OP_AXPY, OP_SCAL } CheckOp;
+
+typedef struct {
+    CheckOp op;
+    int m, n, k; // gemm: C (m x n) over depth k; gemv: A (m x n); vectors: n
+    BlasTrans ta, tb;
+    double alpha, beta;
+    int pad; // operands with rows padded to LA_ALIGN
+} CheckCase;
+
+static const char *op_name[] = { "gemm", "gemv", "axpy", "scal" };
+
+// operands for one case, and the output the backend writes into
+typedef struct {
+    Matrix *A, *B, *C0;
+} CheckData;
+
+static CheckData make_data(const CheckCase *c) {
+    CheckData d = { 0 };
+    switch(c->op) {
+    case OP_GEMM:
+        d.A = c->ta ? random_matrix(c->k, c->m, c->pad) : random_matrix(c->m, c->k, c->pad);
+        d.B = c->tb ? random_matrix(c->n, c->k, c->pad) : random_matrix(c->k, c->n, c->pad);
+        d.C0 = random_matrix(c->m, c->n, c->pad);
+        break;
+    case OP_GEMV:
+        d.A = random_matrix(c->m, c->n, c->pad);
+        d.B = random_matrix(c->ta ? c->m : c->n, 1, c->pad);
+        d.C0 = random_matrix(c->ta ? c->n : c->m, 1, c->pad);
+        break;
+    case OP_AXPY:
+        d.B = random_matrix(c->n, 1, c->pad);
+        d.C0 = random_matrix(c->n, 1, c->pad);
+        break;
+    case OP_SCAL:
+        d.C0 = random_matrix(c->n, 1, c->pad);
+        break;
+    }
+    return d;
+}
+
+static void run_case(const BlasBackend *be, ThreadPool *pool, const CheckCase *c, const CheckData *d, Matrix *C) {
+    switch(c->op) {
+    case OP_GEMM: be->gemm(pool, c->ta, c->tb, c->alpha, d->A, d->B, c->beta, C); break;
+    case OP_GEMV: be->gemv(pool, c->ta, c->alpha, d->A, d->B, c->beta, C); break;
+    case OP_AXPY: be->axpy(pool, c->alpha, d->B, C); break;
+    case OP_SCAL: be->scal(pool, c->alpha, C); break;
+    }
+}
+
+static double case_flops(const CheckCase *c) {
+    switch(c->op) {
+    case OP_GEMM: return 2.0 * c->m * c->n * c->k;
+    case OP_GEMV: return 2.0 * c->m * c->n;
+    case OP_AXPY: return 2.0 * c->n;
+    default: return (double) c->n;
+    }
+}
+
+static int case_depth(const CheckCase *c) {
+    return c->op == OP_GEMM ? c->k : c->op == OP_GEMV ? (c->ta ? c->m : c->n) : 1;
+}
+
+static int check_case(const BlasBackend **backends, int nb, ThreadPool *pool, const CheckCase *c) {
+    const BlasBackend *oracle = blas_backend_reference();
+    CheckData d = make_data(c);
+    Matrix *ref = copy_matrix(d.C0);
+    run_case(oracle, pool, c, &d, ref);
+
+    // per-output error bound: the same operation over absolute values
+    CheckCase cabs = *c;
+    cabs.alpha = fabs(c->alpha);
+    cabs.beta = fabs(c->beta);
+    CheckData dabs = { abs_matrix(d.A), abs_matrix(d.B), abs_matrix(d.C0) };
+    Matrix *bound = copy_matrix(dabs.C0);
+    run_case(oracle, pool, &cabs, &dabs, bound);
+    double scale = 2.0 * (case_depth(c) + 2) * REAL_EPS;
+
+    char shape[48];
+    const char *pad = c->pad ? " pad" : "";
+    if(c->op == OP_GEMM)
+        snprintf(shape, sizeof(shape), "%dx%dx%d %c%c%s", c->m, c->n, c->k, c->ta ? 'T' : 'N', c->tb ? 'T' : 'N', pad);
+    else if(c->op == OP_GEMV)
+        snprintf(shape, sizeof(shape), "%dx%d %c%s", c->m, c->n, c->ta ? 'T' : 'N', pad);
+    else
+        snprintf(shape, sizeof(shape), "%d%s", c->n, pad);
+
+    int failed = 0;
+    for(int b = 0; b < nb; b++) {
+        Matrix *C = copy_matrix(d.C0);
+        run_case(backends[b], pool, c, &d, C);
+        double err = 0.0, ratio = 0.0;
+        for(int i = 0; i < C->row; i++) {
+            for(int j = 0; j < C->col; j++) {
+                double e = fabs((double) mat_row(C, i)[j] - (double) mat_row(ref, i)[j]);
+                err = fmax(err, e);
+                ratio = fmax(ratio, e / (scale * mat_row(bound, i)[j] + DBL_MIN));
+            }
+        }
+        int ok = ratio <= 1.0;
+        failed += !ok;
+
+        // best time over repeats (the outputs drift but the cost doesn't); the
+        // oracle is slow and only timed once
+        double best = 1e300, spent = 0.0;
+        while(spent < CHECK_MIN_MS) {
+            double t0 = now_ms();
+            run_case(backends[b], pool, c, &d, C);
+            double t = now_ms() - t0;
+            best = fmin(best, t);
+            spent += t;
+            if(backends[b] == oracle)
+                break;
+        }
+        printf("%-10s %-5s %-22s %10.2e %9.3f %9.2f  %s\n", backends[b]->name, op_name[c->op], shape,
+               err, ratio, case_flops(c) / (best * 1e6), ok ? "ok" : "FAIL");
+        free_matrix(C);
+    }
+    free_matrix(ref);
+    free_matrix(bound);
+    CheckData all[2] = { d, dabs };
+    for(int i = 0; i < 2; i++) {
+        free_matrix(all[i].A);
+        free_matrix(all[i].B);
+        free_matrix(all[i].C0);
+    }
+    return failed;
+}
+
+int blas_conformance(unsigned seed) {
+    ThreadPool *pool = get_la_pool();
+    const BlasBackend *backends[3];
+    int nb = 0;
+    backends[nb++] = blas_backend_reference();
+    backends[nb++] = blas_backend_native();
+    if(blas_backend_cblas())
+        backends[nb++] = blas_backend_cblas();
+
+    srand(seed);
+    printf("BLAS conformance (%s, seed %u): %d backends\n", REAL_NAME, seed, nb);
+    printf("%-10s %-5s %-22s %10s %9s %9s\n", "backend", "op", "shape", "max err", "err/bound", "GFLOP/s");
+
+    const CheckCase fixed[] = {
+        { OP_GEMM, 1, 1, 1, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMM, 7, 5, 3, BLAS_NO_TRANS, BLAS_NO_TRANS, 0.5, -1.0, 0 },
+        { OP_GEMM, 64, 64, 64, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMM, 256, 256, 256, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMM, 256, 256, 256, BLAS_TRANS, BLAS_NO_TRANS, -0.5, 0.25, 0 },
+        { OP_GEMM, 256, 256, 256, BLAS_NO_TRANS, BLAS_TRANS, 1.0, 1.0, 0 },
+        { OP_GEMM, 256, 256, 256, BLAS_TRANS, BLAS_TRANS, 2.0, 0.0, 0 },
+        { OP_GEMM, 512, 512, 512, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        // the network's shapes: forward, dW = A^T dZ and dZ_prev = dZ W^T
+        { OP_GEMM, 2000, 144, 144, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMM, 144, 144, 2000, BLAS_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMM, 2000, 144, 144, BLAS_NO_TRANS, BLAS_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMM, 2000, 1, 144, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMV, 1024, 1024, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 0.0, 0 },
+        { OP_GEMV, 1024, 1024, 0, BLAS_TRANS, BLAS_NO_TRANS, 0.5, 2.0, 0 },
+        { OP_GEMV, 2000, 144, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 1.0, 0 },
+        { OP_AXPY, 0, 1, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, 0.5, 0.0, 0 },
+        { OP_AXPY, 0, 1 << 20, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, -2.0, 0.0, 0 },
+        { OP_SCAL, 0, 1 << 20, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, 0.75, 0.0, 0 },
+        // odd widths with padded rows, read through their leading dimension
+        { OP_GEMM, 7, 5, 3, BLAS_NO_TRANS, BLAS_NO_TRANS, 0.5, -1.0, 1 },
+        { OP_GEMM, 301, 97, 131, BLAS_TRANS, BLAS_NO_TRANS, 1.0, 0.5, 1 },
+        { OP_GEMM, 301, 97, 131, BLAS_NO_TRANS, BLAS_TRANS, 1.0, 0.0, 1 },
+        { OP_GEMV, 301, 97, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, 1.0, 1.0, 1 },
+        { OP_GEMV, 301, 97, 0, BLAS_TRANS, BLAS_NO_TRANS, 0.5, 2.0, 1 },
+        { OP_AXPY, 0, 1000, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, -2.0, 0.0, 1 },
+        { OP_SCAL, 0, 1000, 0, BLAS_NO_TRANS, BLAS_NO_TRANS, 0.75, 0.0, 1 },
+    };
+
+    int failed = 0;
+    for(size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+        failed += check_case(backends, nb, pool, &fixed[i]);
+
+    // random shapes catch edge tiles the fixed ones line up with
+    for(int i = 0; i < CHECK_RANDOM_SHAPES; i++) {
+        CheckCase c = {
+            .op = i % 3 == 2 ? OP_GEMV : OP_GEMM,
+            .m = 1 + rand() % 300, .n = 1 + rand() % 300, .k = 1 + rand() % 600,
+            .ta = rand() % 2 ? BLAS_TRANS : BLAS_NO_TRANS,
+            .tb = rand() % 2 ? BLAS_TRANS : BLAS_NO_TRANS,
+            .alpha = 2.0 * rand() / RAND_MAX - 1.0,
+            .beta = rand() % 2 ? 0.0 : 2.0 * rand() / RAND_MAX - 1.0,
+            .pad = rand() % 2,
+        };
+        failed += check_case(backends, nb, pool, &c);
+    }
+
+    printf("%d check%s failed\n", failed, failed == 1 ? "" : "s");
+    return failed;
+}
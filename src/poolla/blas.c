@@ -1,25 +1,36 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "poolla/blas.h"
+#include "poolla/simd.h"
 #include "la/linalg.h"
 
+// smallest chunk worth shipping to another thread, in multiply-adds
+#define BLAS_MIN_WORK 16384
+
 static inline int imin(int a, int b) {
     return (a < b) ? a : b;
 }
 
+static inline int imax(int a, int b) {
+    return (a > b) ? a : b;
+}
+
 typedef struct {
-    int start_row, end_row;
     double a, b;
     Matrix *x; //  x (n, 1)
 } dsv_args;
 
-void dsv_task(void *args) {
+void dsv_task(void *args, int start, int end) {
     dsv_args *data = (dsv_args*) args;
-    
-    for(int i=data->start_row; i<data->end_row; i++) {
-        data->x->data[i] = data->a * data->x->data[i] + data->b;
+    const Matrix *x = data->x;
+    if(x->ld == 1) {
+        simd_kernels()->scal_add(end - start, data->a, data->b, x->data + start);
+        return;
     }
-    free(data);
+    // padded column vector: one element per row
+    for(int i = start; i < end; i++)
+        x->data[(size_t) i * x->ld] = data->a * x->data[(size_t) i * x->ld] + data->b;
 }
 
 void dsv(ThreadPool *pool, double a, Matrix *x, double b) {
@@ -34,47 +45,29 @@ void dsv(ThreadPool *pool, double a, Matrix *x, double b) {
         fprintf(stderr, "dsv expects x to be a column vector (n,1)\n");
         exit(EXIT_FAILURE);
     }
-    
-    int total = x->row;
-    int num_threads = pool->tcount > 0 ? pool->tcount : 1;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = imin(start + chunk, total);
-        if(start >= end) 
-            break;
-
-        dsv_args *args = malloc(sizeof(dsv_args));
-        if(!args) {
-            perror("Failed to allocate memory for dsv_args");
-            exit(EXIT_FAILURE);
-        }
-
-        args->start_row = start;
-        args->end_row = end;
-        args->a = a;
-        args->x = x;
-        args->b = b;
 
-        threadpool_submit(pool, dsv_task, args);
-    }
-    threadpool_wait(pool);
+    dsv_args args = { .a = a, .b = b, .x = x };
+    threadpool_parallel_for(pool, x->row, BLAS_MIN_WORK, dsv_task, &args);
 }
 
 typedef struct {
-    int start_row, end_row;
     double a, b;
-    Matrix *A, *B; // A (n, 1), B (n, 1)
+    const Matrix *A;
+    Matrix *B; // A (n, 1), B (n, 1)
 } dvv_args;
 
-void dvv_task(void *args) {
+void dvv_task(void *args, int start, int end) {
     dvv_args *data = (dvv_args*) args;
-    
-    for(int i=data->start_row; i<data->end_row; i++) {
-        data->B->data[i] = data->a * data->A->data[i] + data->b * data->B->data[i];
+    const Matrix *A = data->A;
+    Matrix *B = data->B;
+    if(A->ld == 1 && B->ld == 1) {
+        simd_kernels()->axpby(end - start, data->a, A->data + start, data->b, B->data + start);
+        return;
+    }
+    for(int i = start; i < end; i++) {
+        real_t *b = B->data + (size_t) i * B->ld;
+        *b = data->a * A->data[(size_t) i * A->ld] + data->b * *b;
     }
-    free(data);
 }
 
 void dvv(ThreadPool *pool, double a,const Matrix *A, double b, Matrix *B) {
@@ -91,52 +84,28 @@ void dvv(ThreadPool *pool, double a,const Matrix *A, double b, Matrix *B) {
         exit(EXIT_FAILURE);
     }
 
-    int total = A->row;
-    int num_threads = pool->tcount > 0 ? pool->tcount : 1;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = imin(start + chunk, total);
-        if(start >= end) 
-            break;
-
-        dvv_args *args = malloc(sizeof(dvv_args));
-        if(!args) {
-            perror("Failed to allocate memory for dvv_args");
-            exit(EXIT_FAILURE);
-        }
-
-        args->start_row = start;
-        args->end_row = end;
-
-        args->a = a;
-        args->A = A;
-        args->b = b;
-        args->B = B;
-
-        threadpool_submit(pool, dvv_task, args);
-    }
-    threadpool_wait(pool);
+    dvv_args args = { .a = a, .b = b, .A = A, .B = B };
+    threadpool_parallel_for(pool, A->row, BLAS_MIN_WORK, dvv_task, &args);
 }
 
 typedef struct {
-    int start_row, end_row;
     double a, b;
-    Matrix *A, *B, *C; // A (n, m), B (m, 1), C (n, 1)
+    const Matrix *A, *B;
+    Matrix *C; // A (n, m), B (m, 1), C (n, 1)
+    const real_t *x; // B's elements, contiguous
 } dmv_args;
 
-void dmv_task(void *args) {
+void dmv_task(void *args, int start, int end) {
     dmv_args *data = (dmv_args*) args;
-
-    for(int i=data->start_row; i<data->end_row; i++) {
-        double sum = 0.0;
-        for(int j=0; j<data->A->col; j++) {
-            sum += data->A->data[i * data->A->col + j] * data->B->data[j];
-        }
-        data->C->data[i] = data->a * sum + data->b * data->C->data[i];
+    const SimdKernels *K = simd_kernels();
+    int n = data->A->col;
+
+    for(int i=start; i<end; i++) {
+        double sum = K->dot(n, mat_row(data->A, i), data->x);
+        // b == 0 must not read C, which may be uninitialized
+        real_t *c = data->C->data + (size_t) i * data->C->ld;
+        *c = data->a * sum + (data->b == 0.0 ? 0.0 : data->b * *c);
     }
-    free(data);
 }
 
 void dmv(ThreadPool *pool, double a, const Matrix *A, const Matrix *B, double b, Matrix *C) {
@@ -155,56 +124,614 @@ void dmv(ThreadPool *pool, double a, const Matrix *A, const Matrix *B, double b,
         exit(EXIT_FAILURE);
     }
 
-    int total = A->row;
-    int num_threads = pool->tcount > 0 ? pool->tcount : 1;
-    int chunk = (total + num_threads - 1) / num_threads;
+    dmv_args args = { .a = a, .b = b, .A = A, .B = B, .C = C, .x = B->data };
+    real_t *packed = NULL;
+    if(B->ld != 1 && B->row > 0) {
+        // gather a padded column vector once so the dot products stay contiguous
+        packed = la_scratch_get(LA_SCRATCH_VEC, sizeof(real_t) * B->row);
+        if(!packed) {
+            perror("Failed to allocate gemv operand");
+            exit(EXIT_FAILURE);
+        }
+        for(int p = 0; p < B->row; p++)
+            packed[p] = B->data[(size_t) p * B->ld];
+        args.x = packed;
+    }
+    int grain = BLAS_MIN_WORK / imax(A->col, 1);
+    threadpool_parallel_for(pool, A->row, grain, dmv_task, &args);
+    if(packed)
+        la_scratch_put(LA_SCRATCH_VEC, packed);
+}
+
+typedef struct {
+    double a, b;
+    const Matrix *A, *x;
+    Matrix *y; // A (m, n), x (m, 1), y (n, 1)
+} dmtv_args;
+
+// entries [start, end) of y, accumulated one row of A at a time
+void dmtv_task(void *args, int start, int end) {
+    dmtv_args *data = (dmtv_args*) args;
+    const SimdKernels *K = simd_kernels();
+    const Matrix *A = data->A, *x = data->x;
+    int w = end - start, ldy = data->y->ld;
+    real_t *y = data->y->data + (size_t) start * ldy;
+    real_t *acc = y;
+    if(ldy != 1) {
+        // a padded y is accumulated densely, then scattered
+        acc = la_scratch_get(LA_SCRATCH_VEC, sizeof(real_t) * w);
+        if(!acc) {
+            perror("Failed to allocate gemv accumulator");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(data->b == 0.0) {
+        memset(acc, 0, sizeof(real_t) * w); // don't read y: it may hold NaNs
+    } else if(ldy == 1) {
+        K->scal_add(w, data->b, 0.0, y);
+    } else {
+        for(int j = 0; j < w; j++)
+            acc[j] = data->b * y[(size_t) j * ldy];
+    }
+    for(int i = 0; i < A->row; i++)
+        K->axpby(w, data->a * x->data[(size_t) i * x->ld], mat_row(A, i) + start, 1.0, acc);
+    if(ldy != 1) {
+        for(int j = 0; j < w; j++)
+            y[(size_t) j * ldy] = acc[j];
+        la_scratch_put(LA_SCRATCH_VEC, acc);
+    }
+}
+
+void dmtv(ThreadPool *pool, double a, const Matrix *A, const Matrix *x, double b, Matrix *y) {
+    /**
+     * y := a * A^T * x + b * y, reading A row by row
+     *
+     * @param pool ThreadPool to use for parallelism
+     * @param a Scalar multiplier for A^T*x
+     * @param A Matrix (m, n)
+     * @param x Vector (m, 1)
+     * @param b Scalar multiplier for y
+     * @param y Result vector (n, 1)
+     */
+    if(x->row != A->row || x->col != 1 || y->col != 1 || y->row != A->col) {
+        fprintf(stderr, "Matrix dimensions do not match for matrix-vector multiplication\n");
+        exit(EXIT_FAILURE);
+    }
+
+    dmtv_args args = { .a = a, .b = b, .A = A, .x = x, .y = y };
+    int grain = BLAS_MIN_WORK / imax(A->row, 1);
+    threadpool_parallel_for(pool, A->col, grain, dmtv_task, &args);
+}
+
+// Blocked GEMM (Goto/BLIS layout). B is packed into KC x NC panels of
+// NR-wide slivers, A into MC x KC blocks of MR-tall slivers, and an
+// MR x NR register tile of C is accumulated per micro-kernel call. MR, NR
+// and MC come from the SIMD kernel table selected at startup (see simd.h).
+#define GEMM_KC 256 // depth per panel; one B sliver (KC x NR) stays in L1
+#define GEMM_NC 2048 // columns of B per packed panel, sized for L3
 
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = imin(start + chunk, total);
-        if(start >= end) 
-            break;
+// per-thread packing buffers, grown on demand and released at thread exit
+typedef struct {
+    real_t *data;
+    size_t cap;
+} PackBuf;
+
+static pthread_key_t pack_key;
+static pthread_once_t pack_once = PTHREAD_ONCE_INIT;
+
+static void pack_key_free(void *p) {
+    PackBuf *bufs = (PackBuf*) p;
+    free(bufs[0].data);
+    free(bufs[1].data);
+    free(bufs);
+}
+
+static void pack_key_init(void) {
+    pthread_key_create(&pack_key, pack_key_free);
+}
 
-        dmv_args *args = malloc(sizeof(dmv_args));
-        if(!args) {
-            perror("Failed to allocate memory for dmv_args");
+// which = 0 for A blocks, 1 for B panels
+static real_t* pack_buffer(int which, size_t n) {
+    pthread_once(&pack_once, pack_key_init);
+    PackBuf *bufs = (PackBuf*) pthread_getspecific(pack_key);
+    if(!bufs) {
+        bufs = calloc(2, sizeof(PackBuf));
+        if(!bufs) {
+            perror("Failed to allocate gemm packing buffers");
+            exit(EXIT_FAILURE);
+        }
+        pthread_setspecific(pack_key, bufs);
+    }
+    PackBuf *b = &bufs[which];
+    if(n > b->cap) {
+        free(b->data);
+        size_t bytes = (n * sizeof(real_t) + 63) & ~(size_t) 63;
+        b->data = aligned_alloc(64, bytes);
+        if(!b->data) {
+            perror("Failed to allocate gemm packing buffer");
             exit(EXIT_FAILURE);
         }
+        b->cap = n;
+    }
+    return b->data;
+}
 
-        args->start_row = start;
-        args->end_row = end;
+// pack rows [0, mc) x depth [0, kc) of A (element (i,p) at A[i*rs + p*cs]) into MR-row slivers
+static void pack_A(int MR, int mc, int kc, const real_t *A, size_t rs, size_t cs, real_t *Ap) {
+    for(int ir = 0; ir < mc; ir += MR) {
+        int mr = imin(MR, mc - ir);
+        if(cs == 1) {
+            // row-major A: walk each row contiguously and scatter into the sliver
+            for(int i = 0; i < mr; i++) {
+                const real_t *a = A + (ir + i) * rs;
+                for(int p = 0; p < kc; p++)
+                    Ap[p * MR + i] = a[p];
+            }
+            for(int i = mr; i < MR; i++) {
+                for(int p = 0; p < kc; p++)
+                    Ap[p * MR + i] = 0.0;
+            }
+            Ap += (size_t) MR * kc;
+            continue;
+        }
+        for(int p = 0; p < kc; p++) {
+            for(int i = 0; i < mr; i++)
+                Ap[i] = A[(ir + i) * rs + p * cs];
+            for(int i = mr; i < MR; i++)
+                Ap[i] = 0.0;
+            Ap += MR;
+        }
+    }
+}
 
-        args->a = a;
-        args->A = A;
-        args->b = b;
-        args->B = B;
-        args->C = C;
-        
-        threadpool_submit(pool, dmv_task, args);
+// pack depth [0, kc) x columns [js, je) of B (element (p,j) at B[p*rs + j*cs]) into NR-column slivers
+static void pack_B(int NR, int kc, int js, int je, const real_t *B, size_t rs, size_t cs, real_t *Bp) {
+    for(int jr = js; jr < je; jr += NR) {
+        int nr = imin(NR, je - jr);
+        if(cs == 1 && nr == NR) {
+            // contiguous rows of B: straight copies the compiler can vectorize
+            for(int p = 0; p < kc; p++) {
+                const real_t *b = B + p * rs + jr;
+                for(int j = 0; j < NR; j++)
+                    Bp[j] = b[j];
+                Bp += NR;
+            }
+            continue;
+        }
+        if(rs == 1) {
+            // B read through its transpose: each packed column is a contiguous row
+            for(int j = 0; j < nr; j++) {
+                const real_t *b = B + (jr + j) * cs;
+                for(int p = 0; p < kc; p++)
+                    Bp[p * NR + j] = b[p];
+            }
+            for(int j = nr; j < NR; j++) {
+                for(int p = 0; p < kc; p++)
+                    Bp[p * NR + j] = 0.0;
+            }
+            Bp += (size_t) NR * kc;
+            continue;
+        }
+        for(int p = 0; p < kc; p++) {
+            for(int j = 0; j < nr; j++)
+                Bp[j] = B[p * rs + (jr + j) * cs];
+            for(int j = nr; j < NR; j++)
+                Bp[j] = 0.0;
+            Bp += NR;
+        }
     }
-    threadpool_wait(pool);
 }
 
+// 16-bit operands: contiguous runs go through the vector converters, the rest element-wise
+static void pack_A_half(const SimdKernels *K, int mc, int kc, const uint16_t *A, HalfFormat fmt,
+                        size_t rs, size_t cs, real_t *Ap) {
+    int MR = K->mr;
+    real_t row[GEMM_KC];
+    for(int ir = 0; ir < mc; ir += MR) {
+        int mr = imin(MR, mc - ir);
+        for(int p = 0; p < kc; p++) {
+            if(rs == 1) {
+                K->from_half(mr, fmt, A + ir + p * cs, Ap);
+            } else if(cs != 1) {
+                for(int i = 0; i < mr; i++)
+                    Ap[i] = half_get(fmt, A[(ir + i) * rs + p * cs]);
+            }
+            for(int i = mr; i < MR; i++)
+                Ap[i] = 0.0;
+            Ap += MR;
+        }
+        if(cs == 1 && rs != 1) {
+            // row-major A: widen each row once, then scatter into the sliver
+            real_t *base = Ap - (size_t) MR * kc;
+            for(int i = 0; i < mr; i++) {
+                K->from_half(kc, fmt, A + (ir + i) * rs, row);
+                for(int p = 0; p < kc; p++)
+                    base[p * MR + i] = row[p];
+            }
+        }
+    }
+}
+
+static void pack_B_half(const SimdKernels *K, int kc, int js, int je, const uint16_t *B, HalfFormat fmt,
+                        size_t rs, size_t cs, real_t *Bp) {
+    int NR = K->nr;
+    real_t col[GEMM_KC];
+    for(int jr = js; jr < je; jr += NR) {
+        int nr = imin(NR, je - jr);
+        for(int p = 0; p < kc; p++) {
+            if(cs == 1) {
+                K->from_half(nr, fmt, B + p * rs + jr, Bp);
+            } else if(rs != 1) {
+                for(int j = 0; j < nr; j++)
+                    Bp[j] = half_get(fmt, B[p * rs + (jr + j) * cs]);
+            }
+            for(int j = nr; j < NR; j++)
+                Bp[j] = 0.0;
+            Bp += NR;
+        }
+        if(rs == 1 && cs != 1) {
+            // B read through its transpose: widen each column once, then scatter
+            real_t *base = Bp - (size_t) NR * kc;
+            for(int j = 0; j < nr; j++) {
+                K->from_half(kc, fmt, B + (jr + j) * cs, col);
+                for(int p = 0; p < kc; p++)
+                    base[p * NR + j] = col[p];
+            }
+        }
+    }
+}
+
+// one GEMM call: C (m x n, row stride ldc) := alpha * op(A) op(B) + beta * C
 typedef struct {
-    int start_row, end_row;
-    double a, b;
-    Matrix *A, *B, *C;
-} dmm_args;
+    int m, n, k;
+    double alpha, beta;
+    const real_t *A, *B;
+    const uint16_t *Ah, *Bh; // 16-bit operands, used instead of A/B when set
+    HalfFormat afmt, bfmt;
+    size_t rsa, csa, rsb, csb, ldc;
+    real_t *C;
+    const SimdKernels *K;
+    const BlasEpilogue *ep; // applied once C is final, or NULL
+
+    // current panel, set by the driver between parallel loops
+    int jc, nc, pc, kc;
+    int row_slivers, col_blocks; // macro kernel grid
+    double panel_beta;
+    real_t *Bp;
+} GemmArgs;
+
+static void gemm_pack_B_task(void *arg, int start, int end) {
+    GemmArgs *g = (GemmArgs*) arg;
+    int NR = g->K->nr;
+    // start/end count NR slivers of the current panel
+    int js = g->jc + start * NR;
+    int je = imin(g->jc + end * NR, g->jc + g->nc);
+    real_t *Bp = g->Bp + (size_t) start * NR * g->kc;
+    if(g->Bh)
+        pack_B_half(g->K, g->kc, js, je, g->Bh + g->pc * g->rsb, g->bfmt, g->rsb, g->csb, Bp);
+    else
+        pack_B(NR, g->kc, js, je, g->B + g->pc * g->rsb, g->rsb, g->csb, Bp);
+}
 
-void dmm_task(void *args) {
-    dmm_args *data = (dmm_args*) args;
+#define EPI_CHUNK 64 // staging width for 16-bit epilogue outputs
+
+// apply the epilogue to the finished block C[i0:i1, j0:j0+nj] while it is still in cache
+static void gemm_epilogue(const GemmArgs *g, int i0, int i1, int j0, int nj) {
+    const BlasEpilogue *ep = g->ep;
+    const SimdKernels *K = g->K;
+    real_t tmp[EPI_CHUNK];
+
+    for(int i = i0; i < i1; i++) {
+        real_t *c = g->C + (size_t) i * g->ldc + j0;
+        size_t off = (size_t) i * g->n + j0; // 16-bit outputs are dense m x n
+        size_t moff = (size_t) i * ep->mask.ld + j0;
+        if(ep->bias)
+            K->add(nj, ep->bias->data + j0, c);
+        if(ep->z_half)
+            K->to_half(nj, ep->z_half->fmt, c, ep->z_half->data + off);
+        if(ep->relu && ep->relu_half) {
+            for(int j = 0; j < nj; j += EPI_CHUNK) {
+                int w = imin(EPI_CHUNK, nj - j);
+                K->relu(w, c + j, tmp);
+                K->to_half(w, ep->relu_half->fmt, tmp, ep->relu_half->data + off + j);
+            }
+        } else if(ep->relu) {
+            K->relu(nj, c, ep->relu_out ? mat_row(ep->relu_out, i) + j0 : c);
+        }
+        if(ep->mask.data) {
+            K->drelu(nj, ep->mask.data + moff, c, c);
+        } else if(ep->mask.half) {
+            K->drelu_half(nj, ep->mask.half + moff, c, c);
+        }
+    }
+}
 
-    for(int i=data->start_row; i<data->end_row; i++) {
-        for(int j=0; j<data->B->col; j++) {
-            double sum = 0.0;
-            for(int k=0; k<data->A->col; k++) {
-                sum += data->A->data[i * data->A->col + k] * data->B->data[k * data->B->col + j];
+// multiply the packed panel into C rows [rs, re) and panel columns [js, je)
+static void gemm_macro_block(GemmArgs *g, int rs, int re, int js, int je) {
+    const SimdKernels *K = g->K;
+    int MR = K->mr, NR = K->nr, MC = K->mc;
+    real_t *Ap = pack_buffer(0, (size_t) MC * g->kc);
+    int last_panel = g->ep && g->pc + g->kc == g->k;
+
+    for(int ic = rs; ic < re; ic += MC) {
+        int mc = imin(MC, re - ic);
+        size_t a_off = ic * g->rsa + g->pc * g->csa;
+        if(g->Ah)
+            pack_A_half(K, mc, g->kc, g->Ah + a_off, g->afmt, g->rsa, g->csa, Ap);
+        else
+            pack_A(MR, mc, g->kc, g->A + a_off, g->rsa, g->csa, Ap);
+
+        for(int jr = js; jr < je; jr += NR) {
+            int nr = imin(NR, je - jr);
+            const real_t *Bs = g->Bp + (size_t) (jr / NR) * NR * g->kc;
+            for(int ir = 0; ir < mc; ir += MR) {
+                int mr = imin(MR, mc - ir);
+                real_t *C = g->C + (size_t) (ic + ir) * g->ldc + g->jc + jr;
+                K->gemm_micro(g->kc, Ap + (size_t) ir * g->kc, Bs, C, g->ldc,
+                              mr, nr, g->alpha, g->panel_beta);
+                if(last_panel)
+                    gemm_epilogue(g, ic + ir, ic + ir + mr, g->jc + jr, nr);
             }
-            size_t idx = (size_t) i * data->C->col + j;
-            data->C->data[idx] = data->a * sum + data->b * data->C->data[idx];
         }
     }
-    free(data);
+}
+
+static void gemm_macro_task(void *arg, int start, int end) {
+    GemmArgs *g = (GemmArgs*) arg;
+    int MR = g->K->mr, NR = g->K->nr;
+    int slivers = (g->nc + NR - 1) / NR;
+
+    // item t is row sliver t % row_slivers of column block t / row_slivers;
+    // a chunk is split into runs of consecutive row slivers within one block
+    for(int t = start; t < end; ) {
+        int cb = t / g->row_slivers;
+        int r0 = t % g->row_slivers;
+        int r1 = imin(g->row_slivers, r0 + (end - t));
+        int js = (int) ((long) slivers * cb / g->col_blocks) * NR;
+        int je = imin((int) ((long) slivers * (cb + 1) / g->col_blocks) * NR, g->nc);
+        gemm_macro_block(g, r0 * MR, imin(r1 * MR, g->m), js, je);
+        t += r1 - r0;
+    }
+}
+
+static void gemm_scale_task(void *arg, int start, int end) {
+    GemmArgs *g = (GemmArgs*) arg;
+    for(int i = start; i < end; i++) {
+        real_t *c = g->C + (size_t) i * g->ldc;
+        for(int j = 0; j < g->n; j++)
+            c[j] = (g->beta == 0.0) ? 0.0 : g->beta * c[j];
+        if(g->ep)
+            gemm_epilogue(g, i, i + 1, 0, g->n);
+    }
+}
+
+// Goto loop nest over panels; the macro kernel runs over a 2D grid of
+// row slivers x column blocks so short outputs still fill every thread
+static void gemm_blocked(ThreadPool *pool, GemmArgs *g, int nthreads) {
+    int MR = g->K->mr, NR = g->K->nr;
+    int panels_cap = imin(g->n, GEMM_NC);
+    size_t bp_size = (size_t) ((panels_cap + NR - 1) / NR) * NR * imin(g->k, GEMM_KC);
+    g->Bp = pack_buffer(1, bp_size);
+    g->row_slivers = (g->m + MR - 1) / MR;
+
+    for(int jc = 0; jc < g->n; jc += GEMM_NC) {
+        g->jc = jc;
+        g->nc = imin(GEMM_NC, g->n - jc);
+        int slivers = (g->nc + NR - 1) / NR;
+
+        // aim for a few items per thread; split columns only when rows run short
+        int want = (nthreads > 1) ? 4 * nthreads : 1;
+        g->col_blocks = imax(1, imin(slivers, (want + g->row_slivers - 1) / g->row_slivers));
+
+        for(int pc = 0; pc < g->k; pc += GEMM_KC) {
+            g->pc = pc;
+            g->kc = imin(GEMM_KC, g->k - pc);
+            // beta applies once; later panels accumulate into C
+            g->panel_beta = (pc == 0) ? g->beta : 1.0;
+
+            threadpool_parallel_for(pool, slivers, imax(1, BLAS_MIN_WORK / (NR * g->kc)),
+                                    gemm_pack_B_task, g);
+
+            int cols = (g->nc + g->col_blocks - 1) / g->col_blocks;
+            int grain = imax(1, BLAS_MIN_WORK / (MR * cols * g->kc));
+            threadpool_parallel_for(pool, g->row_slivers * g->col_blocks, grain, gemm_macro_task, g);
+        }
+    }
+}
+
+// split the depth when C is too small to give every thread work but k is long
+#define GEMM_KSPLIT_MIN 128 // shallowest chunk worth its own partial C
+
+typedef struct {
+    ThreadPool *pool;
+    GemmArgs *g;
+    int chunks;
+    real_t *partial; // chunks stacked m x n buffers, alpha already applied
+} KSplitArgs;
+
+static void gemm_ksplit_task(void *arg, int start, int end) {
+    KSplitArgs *s = (KSplitArgs*) arg;
+    GemmArgs *g = s->g;
+    size_t mn = (size_t) g->m * g->n;
+
+    for(int c = start; c < end; c++) {
+        int k0 = (int) ((long) g->k * c / s->chunks);
+        int k1 = (int) ((long) g->k * (c + 1) / s->chunks);
+        GemmArgs sub = {
+            .m = g->m, .n = g->n, .k = k1 - k0,
+            .alpha = g->alpha, .beta = 0.0,
+            .A = g->A ? g->A + k0 * g->csa : NULL,
+            .Ah = g->Ah ? g->Ah + k0 * g->csa : NULL, .afmt = g->afmt,
+            .rsa = g->rsa, .csa = g->csa,
+            .B = g->B ? g->B + k0 * g->rsb : NULL,
+            .Bh = g->Bh ? g->Bh + k0 * g->rsb : NULL, .bfmt = g->bfmt,
+            .rsb = g->rsb, .csb = g->csb,
+            .C = s->partial + c * mn, .ldc = (size_t) g->n,
+            .K = g->K,
+        };
+        // nested loops inside a running parallel_for execute inline on this thread
+        gemm_blocked(s->pool, &sub, 1);
+    }
+}
+
+static void gemm_reduce_task(void *arg, int start, int end) {
+    KSplitArgs *s = (KSplitArgs*) arg;
+    GemmArgs *g = s->g;
+    const SimdKernels *K = g->K;
+    size_t mn = (size_t) g->m * g->n;
+
+    for(int i = start; i < end; i++) {
+        real_t *c = g->C + (size_t) i * g->ldc;
+        const real_t *p = s->partial + (size_t) i * g->n;
+        if(g->beta == 0.0) {
+            for(int j = 0; j < g->n; j++)
+                c[j] = p[j];
+        } else {
+            K->axpby(g->n, 1.0, p, g->beta, c);
+        }
+        for(int ch = 1; ch < s->chunks; ch++)
+            K->add(g->n, p + ch * mn, c);
+        if(g->ep)
+            gemm_epilogue(g, i, i + 1, 0, g->n);
+    }
+}
+
+static void gemm_run(ThreadPool *pool, GemmArgs *g) {
+    if(g->m == 0 || g->n == 0)
+        return;
+    g->K = simd_kernels();
+    if(g->k == 0 || g->alpha == 0.0) {
+        threadpool_parallel_for(pool, g->m, BLAS_MIN_WORK / imax(g->n, 1), gemm_scale_task, g);
+        return;
+    }
+
+    int nthreads = pool->tcount + 1;
+    long tiles = (long) ((g->m + g->K->mr - 1) / g->K->mr) * ((g->n + g->K->nr - 1) / g->K->nr);
+    int chunks = imin(nthreads, g->k / GEMM_KSPLIT_MIN);
+
+    if(chunks > 1 && tiles < 2L * nthreads) {
+        KSplitArgs s = { .pool = pool, .g = g, .chunks = chunks };
+        s.partial = la_scratch_get(LA_SCRATCH_SPLIT, sizeof(real_t) * (size_t) chunks * g->m * g->n);
+        if(s.partial) {
+            threadpool_parallel_for(pool, chunks, 1, gemm_ksplit_task, &s);
+            threadpool_parallel_for(pool, g->m, imax(1, BLAS_MIN_WORK / (chunks * g->n)),
+                                    gemm_reduce_task, &s);
+            la_scratch_put(LA_SCRATCH_SPLIT, s.partial);
+            return;
+        }
+        // out of memory for partials: fall back to the unsplit path
+    }
+    gemm_blocked(pool, g, nthreads);
+}
+
+// an epilogue output or mask that is set but not shaped like C
+#define EPI_BAD(p, m, n) ((p) && ((p)->row != (m) || (p)->col != (n)))
+
+static void epilogue_check(const BlasEpilogue *ep, int m, int n) {
+    if(ep && ((ep->bias && ep->bias->row * ep->bias->col != n) ||
+              EPI_BAD(ep->relu_out, m, n) || EPI_BAD(ep->relu_half, m, n) || EPI_BAD(ep->z_half, m, n) ||
+              ((ep->mask.data || ep->mask.half) && (ep->mask.row != m || ep->mask.col != n)))) {
+        fprintf(stderr, "Epilogue dimensions do not match the multiplication\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void dgemm_ref(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+               double a, MatRef A, MatRef B, double b, Matrix *C,
+               const BlasEpilogue *ep) {
+    /**
+     * C := ep(a * op(A) * op(B) + b * C), where op(X) is X or X^T
+     *
+     * Transposed operands are read in place through their strides while
+     * packing, so no transposed copy is materialized, and rows of every
+     * operand are addressed through its leading dimension, so padded
+     * matrices need no repacking either. 16-bit operands are widened while
+     * packing and all accumulation is at full precision. The epilogue runs
+     * on each register tile right after its last update, so bias,
+     * activation and mask cost no extra pass over C.
+     *
+     * @param pool ThreadPool to use for parallelism
+     * @param transA BLAS_TRANS to use A^T
+     * @param transB BLAS_TRANS to use B^T
+     * @param a Scalar multiplier for op(A)*op(B)
+     * @param A Left operand, full or 16-bit
+     * @param B Right operand, full or 16-bit
+     * @param b Scalar multiplier for C
+     * @param C Result matrix (rows of op(A), columns of op(B))
+     * @param ep Bias/activation/mask to fuse into the write-back, or NULL
+     */
+    int m = transA ? A.col : A.row;
+    int k = transA ? A.row : A.col;
+    int kb = transB ? B.col : B.row;
+    int n = transB ? B.row : B.col;
+    if(k != kb || C->row != m || C->col != n) {
+        fprintf(stderr, "Matrix dimensions do not match for multiplication\n");
+        exit(EXIT_FAILURE);
+    }
+    epilogue_check(ep, m, n);
+
+    GemmArgs g = {
+        .m = m, .n = n, .k = k,
+        .alpha = a, .beta = b,
+        .A = A.data, .Ah = A.data ? NULL : A.half, .afmt = A.fmt,
+        .rsa = transA ? 1 : (size_t) A.ld, .csa = transA ? (size_t) A.ld : 1,
+        .B = B.data, .Bh = B.data ? NULL : B.half, .bfmt = B.fmt,
+        .rsb = transB ? 1 : (size_t) B.ld, .csb = transB ? (size_t) B.ld : 1,
+        .C = C->data, .ldc = (size_t) C->ld,
+        .ep = ep,
+    };
+    gemm_run(pool, &g);
+}
+
+static void gemm_epilogue_task(void *arg, int start, int end) {
+    gemm_epilogue((const GemmArgs*) arg, start, end, 0, ((const GemmArgs*) arg)->n);
+}
+
+void dgemm_epilogue(ThreadPool *pool, Matrix *C, const BlasEpilogue *ep) {
+    /**
+     * Apply an epilogue to an already computed C as a separate pass, for
+     * products that came from a kernel that can't fuse it
+     *
+     * @param pool ThreadPool to use for parallelism
+     * @param C Finished product
+     * @param ep Bias/activation/mask, as for dgemm_ref
+     */
+    epilogue_check(ep, C->row, C->col);
+    if(!ep || C->row == 0 || C->col == 0)
+        return;
+    GemmArgs g = {
+        .m = C->row, .n = C->col,
+        .C = C->data, .ldc = (size_t) C->ld,
+        .K = simd_kernels(), .ep = ep,
+    };
+    threadpool_parallel_for(pool, g.m, BLAS_MIN_WORK / imax(g.n, 1), gemm_epilogue_task, &g);
+}
+
+void dgemm_ep(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+              double a, const Matrix *A, const Matrix *B, double b, Matrix *C,
+              const BlasEpilogue *ep) {
+    /**
+     * dgemm_ref for full-precision operands
+     */
+    dgemm_ref(pool, transA, transB, a, mat_ref(A), mat_ref(B), b, C, ep);
+}
+
+void dgemm(ThreadPool *pool, BlasTrans transA, BlasTrans transB,
+           double a, const Matrix *A, const Matrix *B, double b, Matrix *C) {
+    /**
+     * C := a * op(A) * op(B) + b * C, where op(X) is X or X^T
+     *
+     * @param pool ThreadPool to use for parallelism
+     * @param transA BLAS_TRANS to use A^T
+     * @param transB BLAS_TRANS to use B^T
+     * @param a Scalar multiplier for op(A)*op(B)
+     * @param A Left matrix
+     * @param B Right matrix
+     * @param b Scalar multiplier for C
+     * @param C Result matrix (rows of op(A), columns of op(B))
+     */
+    dgemm_ref(pool, transA, transB, a, mat_ref(A), mat_ref(B), b, C, NULL);
 }
 
 void *dmm(ThreadPool *pool, double a, const Matrix *A, const Matrix *B, double b, Matrix *C) {
@@ -218,38 +745,143 @@ void *dmm(ThreadPool *pool, double a, const Matrix *A, const Matrix *B, double b
      * @param b Scalar multiplier for C
      * @param C Result matrix
      */
-    // check dimensions
-    if(A->col != B->row || A->row != C->row || B->col != C->col) {
-        fprintf(stderr, "Matrix dimensions do not match for multiplication\n");
-        exit(EXIT_FAILURE);
+    dgemm(pool, BLAS_NO_TRANS, BLAS_NO_TRANS, a, A, B, b, C);
+    return NULL;
+}
+
+/* int8 GEMM for quantized inference. The whole packed B is small enough for
+ * inference-sized layers to stay in cache, so only rows are partitioned. */
+
+QPackedB* qgemm_pack(int k, int n, const int8_t *W, size_t ldw) {
+    /**
+     * Pack int8 weights for qgemm with the current kernels' column tile
+     *
+     * @param k Depth (inputs per output)
+     * @param n Output columns
+     * @param W Weights, W[j * ldw + p] for output j and depth p
+     * @param ldw Row stride of W
+     * @return Packed weights, or NULL on failure
+     */
+    const SimdKernels *K = simd_kernels();
+    int NR = K->qnr;
+    int kq = (k + 3) / 4;
+    int tiles = (n + NR - 1) / NR;
+    QPackedB *B = malloc(sizeof(QPackedB));
+    if(!B)
+        return NULL;
+    B->data = calloc((size_t) tiles * kq * 4 * NR, 1);
+    if(!B->data) {
+        free(B);
+        return NULL;
     }
-    
-    int total = A->row;
-    int num_threads = pool->tcount > 0 ? pool->tcount : 1;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    for(int i=0; i<num_threads; i++) {
-        int start = i * chunk;
-        int end = imin(start + chunk, total);
-        if(start >= end) 
-            break;
-        dmm_args *args = malloc(sizeof(dmm_args));
-        if (!args) {
-            perror("Failed to allocate memory for dmm_args");
-            exit(EXIT_FAILURE);
+    B->k = k;
+    B->n = n;
+    B->kq = kq;
+    B->nr = NR;
+    int8_t *dst = B->data;
+    for(int jt = 0; jt < n; jt += NR) {
+        for(int q = 0; q < kq; q++) {
+            for(int j = 0; j < NR && jt + j < n; j++) {
+                for(int t = 0; t < 4 && 4 * q + t < k; t++)
+                    dst[4 * j + t] = W[(size_t) (jt + j) * ldw + 4 * q + t];
+            }
+            dst += 4 * NR;
         }
+    }
+    return B;
+}
 
-        args->start_row = start;
-        args->end_row = end;
+void qpacked_free(QPackedB *B) {
+    if(!B)
+        return;
+    free(B->data);
+    free(B);
+}
 
-        args->a = a;
-        args->b = b;
-        args->A = A;
-        args->B = B;
-        args->C = C;
-        threadpool_submit(pool, dmm_task, args);
+typedef struct {
+    const SimdKernels *K;
+    int m;
+    const uint8_t *A;
+    size_t lda;
+    const QPackedB *B;
+    int32_t *C;
+    size_t ldc;
+    const QgemmEpilogue *ep;
+} QgemmArgs;
+
+static void qgemm_epilogue(const SimdKernels *K, const QgemmEpilogue *ep, int32_t *t, int i, int j0, int nj) {
+    if(ep->bias) {
+        for(int j = 0; j < nj; j++)
+            t[j] += ep->bias[j0 + j];
+    }
+    if(ep->out)
+        K->requant(nj, t, ep->mult + j0, ep->shift + j0, ep->out + (size_t) i * ep->ldo + j0);
+    if(ep->y) {
+        real_t *y = ep->y + (size_t) i * ep->ldy + j0;
+        for(int j = 0; j < nj; j++) {
+            int32_t v = (ep->relu && t[j] < 0) ? 0 : t[j];
+            y[j] = (real_t) (v * ep->scale[j0 + j]);
+        }
+    }
+}
+
+// rows [start, end) are in units of the kernel's row tile
+static void qgemm_task(void *arg, int start, int end) {
+    QgemmArgs *g = (QgemmArgs*) arg;
+    const SimdKernels *K = g->K;
+    const QPackedB *B = g->B;
+    int MR = K->qmr, NR = K->qnr;
+    int32_t T[MR * NR];
+    size_t tile = (size_t) B->kq * 4 * NR;
+
+    for(int it = start; it < end; it++) {
+        int i0 = it * MR;
+        int mr = imin(MR, g->m - i0);
+        for(int jt = 0; jt * NR < B->n; jt++) {
+            int j0 = jt * NR;
+            int nr = imin(NR, B->n - j0);
+            K->qgemm_micro(B->kq, g->A + (size_t) i0 * g->lda, g->lda, mr, B->data + jt * tile, T);
+            for(int i = 0; i < mr; i++) {
+                if(g->C) {
+                    int32_t *c = g->C + (size_t) (i0 + i) * g->ldc + j0;
+                    for(int j = 0; j < nr; j++)
+                        c[j] = T[i * NR + j];
+                }
+                if(g->ep)
+                    qgemm_epilogue(K, g->ep, T + i * NR, i0 + i, j0, nr);
+            }
+        }
     }
-    threadpool_wait(pool);
-    return NULL;
 }
 
+void qgemm(ThreadPool *pool, int m, const uint8_t *A, size_t lda, const QPackedB *B,
+           int32_t *C, size_t ldc, const QgemmEpilogue *ep) {
+    /**
+     * C := A * B over u8 activations and s8 weights with int32 accumulation,
+     * optionally requantized by ep on the way out
+     *
+     * Activations must be <= 127: without VNNI the kernels sum u8*s8 pairs in
+     * 16 bits, which that bound keeps from saturating, so every ISA gives the
+     * same integers.
+     *
+     * @param pool ThreadPool to use for parallelism
+     * @param m Rows of A and C
+     * @param A Activations (m x k), row stride lda >= 4 * B->kq; the padding
+     *          bytes are read but meet zero weights
+     * @param lda Row stride of A
+     * @param B Weights packed by qgemm_pack
+     * @param C Raw int32 sums (m x B->n, row stride ldc), or NULL if ep consumes them
+     * @param ldc Row stride of C
+     * @param ep Requantization to fuse into the write-back, or NULL
+     */
+    const SimdKernels *K = simd_kernels();
+    if(B->nr != K->qnr || lda < (size_t) B->kq * 4) {
+        fprintf(stderr, "qgemm operands were packed for another kernel or are too narrow\n");
+        exit(EXIT_FAILURE);
+    }
+    if(m == 0 || B->n == 0)
+        return;
+    QgemmArgs g = { .K = K, .m = m, .A = A, .lda = lda, .B = B, .C = C, .ldc = ldc, .ep = ep };
+    int tiles = (m + K->qmr - 1) / K->qmr;
+    threadpool_parallel_for(pool, tiles, imax(1, BLAS_MIN_WORK / (K->qmr * B->n)), qgemm_task, &g);
+}
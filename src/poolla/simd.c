@@ -0,0 +1,1002 @@
+#include "poolla/simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+// write back an accumulated tile held in a row-major mr_max x nr_max array
+static void tile_store(const real_t *acc, int nr_max, real_t *C, size_t ldc,
+                       int mr, int nr, real_t alpha, real_t beta) {
+    for(int i = 0; i < mr; i++) {
+        real_t *c = C + i * ldc;
+        const real_t *t = acc + i * nr_max;
+        if(beta == 0) {
+            // don't read C: it may be uninitialized or hold NaNs
+            for(int j = 0; j < nr; j++)
+                c[j] = alpha * t[j];
+        } else {
+            for(int j = 0; j < nr; j++)
+                c[j] = alpha * t[j] + beta * c[j];
+        }
+    }
+}
+
+/* ---------------------------------------------------------------- scalar */
+
+#define SCALAR_MR 4
+#define SCALAR_NR 8
+
+static void gemm_micro_scalar(int kc, const real_t *Ap, const real_t *Bp, real_t *C, size_t ldc,
+                              int mr, int nr, double alpha, double beta) {
+    real_t acc[SCALAR_MR][SCALAR_NR] = {{0}};
+
+    for(int p = 0; p < kc; p++) {
+        for(int i = 0; i < SCALAR_MR; i++) {
+            real_t a = Ap[i];
+            for(int j = 0; j < SCALAR_NR; j++)
+                acc[i][j] += a * Bp[j];
+        }
+        Ap += SCALAR_MR;
+        Bp += SCALAR_NR;
+    }
+    tile_store(&acc[0][0], SCALAR_NR, C, ldc, mr, nr, (real_t) alpha, (real_t) beta);
+}
+
+static double dot_scalar(int n, const real_t *x, const real_t *y) {
+    real_t sum = 0;
+    for(int i = 0; i < n; i++)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+static void axpby_scalar(int n, double a, const real_t *x, double b, real_t *y) {
+    real_t ra = (real_t) a, rb = (real_t) b;
+    for(int i = 0; i < n; i++)
+        y[i] = ra * x[i] + rb * y[i];
+}
+
+static void scal_add_scalar(int n, double a, double b, real_t *x) {
+    real_t ra = (real_t) a, rb = (real_t) b;
+    for(int i = 0; i < n; i++)
+        x[i] = ra * x[i] + rb;
+}
+
+static void add_scalar(int n, const real_t *x, real_t *y) {
+    for(int i = 0; i < n; i++)
+        y[i] += x[i];
+}
+
+static void relu_scalar(int n, const real_t *z, real_t *a) {
+    for(int i = 0; i < n; i++)
+        a[i] = (z[i] > 0) ? z[i] : 0;
+}
+
+static void drelu_scalar(int n, const real_t *z, const real_t *dz, real_t *out) {
+    for(int i = 0; i < n; i++)
+        out[i] = (z[i] > 0) ? dz[i] : 0;
+}
+
+static void drelu_half_scalar(int n, const uint16_t *z, const real_t *dz, real_t *out) {
+    for(int i = 0; i < n; i++)
+        out[i] = ((int16_t) z[i] > 0) ? dz[i] : 0;
+}
+
+static void adam_scalar(int n, double lr, double b1, double b2, double eps, double c1, double c2,
+                        const real_t *g, real_t *m, real_t *v, real_t *w) {
+    real_t rb1 = (real_t) b1, rb2 = (real_t) b2;
+    real_t rb1c = (real_t) (1.0 - b1), rb2c = (real_t) (1.0 - b2);
+    real_t ic1 = (real_t) (1.0 / c1), ic2 = (real_t) (1.0 / c2);
+    real_t reps = (real_t) eps, rlr = (real_t) lr;
+    for(int i = 0; i < n; i++) {
+        m[i] = rb1 * m[i] + rb1c * g[i];
+        v[i] = rb2 * v[i] + rb2c * g[i] * g[i];
+        real_t mh = m[i] * ic1;
+        real_t vh = v[i] * ic2;
+        w[i] -= rlr * mh / (sqrt(vh) + reps);
+    }
+}
+
+static void to_half_scalar(int n, HalfFormat fmt, const real_t *x, uint16_t *h) {
+    if(fmt == HALF_FP16) {
+        for(int i = 0; i < n; i++)
+            h[i] = float_to_fp16((float) x[i]);
+    } else {
+        for(int i = 0; i < n; i++)
+            h[i] = float_to_bf16((float) x[i]);
+    }
+}
+
+static void from_half_scalar(int n, HalfFormat fmt, const uint16_t *h, real_t *x) {
+    if(fmt == HALF_FP16) {
+        for(int i = 0; i < n; i++)
+            x[i] = fp16_to_float(h[i]);
+    } else {
+        for(int i = 0; i < n; i++)
+            x[i] = bf16_to_float(h[i]);
+    }
+}
+
+#define SCALAR_QMR 4
+#define SCALAR_QNR 8
+
+// int8 tile: Bp holds, for each group q of 4 depths, 4 bytes per column
+static void qgemm_micro_scalar(int kq, const uint8_t *A, size_t lda, int mr, const int8_t *Bp, int32_t *T) {
+    int32_t acc[SCALAR_QMR * SCALAR_QNR] = { 0 };
+    for(int i = 0; i < SCALAR_QMR; i++) {
+        const uint8_t *a = A + (size_t) (i < mr ? i : mr - 1) * lda;
+        const int8_t *b = Bp;
+        for(int q = 0; q < kq; q++, a += 4, b += 4 * SCALAR_QNR)
+            for(int j = 0; j < SCALAR_QNR; j++)
+                acc[i * SCALAR_QNR + j] += a[0] * b[4 * j] + a[1] * b[4 * j + 1] +
+                                           a[2] * b[4 * j + 2] + a[3] * b[4 * j + 3];
+    }
+    memcpy(T, acc, sizeof(acc));
+}
+
+static void requant_scalar(int n, const int32_t *t, const int32_t *mult, const int *shift, uint8_t *out) {
+    for(int i = 0; i < n; i++) {
+        int64_t v = t[i] > 0 ? t[i] : 0; // negative sums clamp to 0 anyway
+        int64_t r = (v * mult[i] + ((int64_t) 1 << (shift[i] - 1))) >> shift[i];
+        out[i] = (uint8_t) (r > 127 ? 127 : r);
+    }
+}
+
+#define SCALAR_TR 4
+
+static void transpose_scalar(const real_t *A, size_t lda, real_t *B, size_t ldb) {
+    for(int i = 0; i < SCALAR_TR; i++)
+        for(int j = 0; j < SCALAR_TR; j++)
+            B[j * ldb + i] = A[i * lda + j];
+}
+
+static const SimdKernels kernels_scalar = {
+    .isa = ISA_SCALAR, .name = "scalar",
+    .mr = SCALAR_MR, .nr = SCALAR_NR, .mc = 128,
+    .gemm_micro = gemm_micro_scalar,
+    .dot = dot_scalar, .axpby = axpby_scalar, .scal_add = scal_add_scalar, .add = add_scalar,
+    .relu = relu_scalar, .drelu = drelu_scalar, .drelu_half = drelu_half_scalar, .adam = adam_scalar,
+    .tr = SCALAR_TR, .transpose = transpose_scalar,
+    .to_half = to_half_scalar, .from_half = from_half_scalar,
+    .qmr = SCALAR_QMR, .qnr = SCALAR_QNR, .qgemm_micro = qgemm_micro_scalar, .requant = requant_scalar,
+};
+
+#ifdef SIMD_X86
+
+// Vector wrappers so one body serves both precisions. VW is lanes per register.
+#ifdef NNC_FLOAT32
+#define V2_W 8
+#define v2_t __m256
+#define v2_zero _mm256_setzero_ps
+#define v2_load _mm256_loadu_ps
+#define v2_store _mm256_storeu_ps
+#define v2_set1 _mm256_set1_ps
+#define v2_bcast _mm256_broadcast_ss
+#define v2_fma _mm256_fmadd_ps
+#define v2_mul _mm256_mul_ps
+#define v2_add _mm256_add_ps
+#define v2_sub _mm256_sub_ps
+#define v2_div _mm256_div_ps
+#define v2_sqrt _mm256_sqrt_ps
+#define v2_max _mm256_max_ps
+#define v2_and _mm256_and_ps
+#define v2_gt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+
+#define V5_W 16
+#define v5_t __m512
+#define v5_mask_t __mmask16
+#define v5_zero _mm512_setzero_ps
+#define v5_set1 _mm512_set1_ps
+#define v5_load _mm512_loadu_ps
+#define v5_maskz_load _mm512_maskz_loadu_ps
+#define v5_mask_store _mm512_mask_storeu_ps
+#define v5_fma _mm512_fmadd_ps
+#define v5_mul _mm512_mul_ps
+#define v5_add _mm512_add_ps
+#define v5_sub _mm512_sub_ps
+#define v5_div _mm512_div_ps
+#define v5_sqrt _mm512_sqrt_ps
+#define v5_max _mm512_max_ps
+#define v5_gt(k, a, b) _mm512_mask_cmp_ps_mask(k, a, b, _CMP_GT_OQ)
+#define v5_reduce_add _mm512_reduce_add_ps
+#else
+#define V2_W 4
+#define v2_t __m256d
+#define v2_zero _mm256_setzero_pd
+#define v2_load _mm256_loadu_pd
+#define v2_store _mm256_storeu_pd
+#define v2_set1 _mm256_set1_pd
+#define v2_bcast _mm256_broadcast_sd
+#define v2_fma _mm256_fmadd_pd
+#define v2_mul _mm256_mul_pd
+#define v2_add _mm256_add_pd
+#define v2_sub _mm256_sub_pd
+#define v2_div _mm256_div_pd
+#define v2_sqrt _mm256_sqrt_pd
+#define v2_max _mm256_max_pd
+#define v2_and _mm256_and_pd
+#define v2_gt(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+
+#define V5_W 8
+#define v5_t __m512d
+#define v5_mask_t __mmask8
+#define v5_zero _mm512_setzero_pd
+#define v5_set1 _mm512_set1_pd
+#define v5_load _mm512_loadu_pd
+#define v5_maskz_load _mm512_maskz_loadu_pd
+#define v5_mask_store _mm512_mask_storeu_pd
+#define v5_fma _mm512_fmadd_pd
+#define v5_mul _mm512_mul_pd
+#define v5_add _mm512_add_pd
+#define v5_sub _mm512_sub_pd
+#define v5_div _mm512_div_pd
+#define v5_sqrt _mm512_sqrt_pd
+#define v5_max _mm512_max_pd
+#define v5_gt(k, a, b) _mm512_mask_cmp_pd_mask(k, a, b, _CMP_GT_OQ)
+#define v5_reduce_add _mm512_reduce_add_pd
+#endif
+
+/* ------------------------------------------------------------ AVX2 + FMA */
+
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+#define AVX2_MR 6
+#define AVX2_NR (2 * V2_W)
+
+AVX2_TARGET
+static void gemm_micro_avx2(int kc, const real_t *Ap, const real_t *Bp, real_t *C, size_t ldc,
+                            int mr, int nr, double alpha, double beta) {
+    v2_t c00 = v2_zero(), c01 = v2_zero();
+    v2_t c10 = v2_zero(), c11 = v2_zero();
+    v2_t c20 = v2_zero(), c21 = v2_zero();
+    v2_t c30 = v2_zero(), c31 = v2_zero();
+    v2_t c40 = v2_zero(), c41 = v2_zero();
+    v2_t c50 = v2_zero(), c51 = v2_zero();
+
+    for(int p = 0; p < kc; p++) {
+        v2_t b0 = v2_load(Bp);
+        v2_t b1 = v2_load(Bp + V2_W);
+        v2_t a;
+        a = v2_bcast(Ap + 0); c00 = v2_fma(a, b0, c00); c01 = v2_fma(a, b1, c01);
+        a = v2_bcast(Ap + 1); c10 = v2_fma(a, b0, c10); c11 = v2_fma(a, b1, c11);
+        a = v2_bcast(Ap + 2); c20 = v2_fma(a, b0, c20); c21 = v2_fma(a, b1, c21);
+        a = v2_bcast(Ap + 3); c30 = v2_fma(a, b0, c30); c31 = v2_fma(a, b1, c31);
+        a = v2_bcast(Ap + 4); c40 = v2_fma(a, b0, c40); c41 = v2_fma(a, b1, c41);
+        a = v2_bcast(Ap + 5); c50 = v2_fma(a, b0, c50); c51 = v2_fma(a, b1, c51);
+        Ap += AVX2_MR;
+        Bp += AVX2_NR;
+    }
+
+    v2_t acc[AVX2_MR][2] = {
+        {c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51},
+    };
+    if(mr == AVX2_MR && nr == AVX2_NR) {
+        v2_t va = v2_set1((real_t) alpha);
+        v2_t vb = v2_set1((real_t) beta);
+        for(int i = 0; i < AVX2_MR; i++) {
+            real_t *c = C + i * ldc;
+            v2_t r0 = v2_mul(va, acc[i][0]);
+            v2_t r1 = v2_mul(va, acc[i][1]);
+            if(beta != 0.0) {
+                r0 = v2_fma(vb, v2_load(c), r0);
+                r1 = v2_fma(vb, v2_load(c + V2_W), r1);
+            }
+            v2_store(c, r0);
+            v2_store(c + V2_W, r1);
+        }
+        return;
+    }
+    real_t tile[AVX2_MR * AVX2_NR];
+    for(int i = 0; i < AVX2_MR; i++) {
+        v2_store(tile + i * AVX2_NR, acc[i][0]);
+        v2_store(tile + i * AVX2_NR + V2_W, acc[i][1]);
+    }
+    tile_store(tile, AVX2_NR, C, ldc, mr, nr, (real_t) alpha, (real_t) beta);
+}
+
+AVX2_TARGET
+static double dot_avx2(int n, const real_t *x, const real_t *y) {
+    v2_t s0 = v2_zero(), s1 = v2_zero();
+    int i = 0;
+    for(; i + 2 * V2_W <= n; i += 2 * V2_W) {
+        s0 = v2_fma(v2_load(x + i), v2_load(y + i), s0);
+        s1 = v2_fma(v2_load(x + i + V2_W), v2_load(y + i + V2_W), s1);
+    }
+    for(; i + V2_W <= n; i += V2_W)
+        s0 = v2_fma(v2_load(x + i), v2_load(y + i), s0);
+    real_t lanes[V2_W];
+    v2_store(lanes, v2_add(s0, s1));
+    real_t sum = 0;
+    for(int l = 0; l < V2_W; l++)
+        sum += lanes[l];
+    for(; i < n; i++)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+AVX2_TARGET
+static void axpby_avx2(int n, double a, const real_t *x, double b, real_t *y) {
+    v2_t va = v2_set1((real_t) a), vb = v2_set1((real_t) b);
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W)
+        v2_store(y + i, v2_fma(va, v2_load(x + i), v2_mul(vb, v2_load(y + i))));
+    axpby_scalar(n - i, a, x + i, b, y + i);
+}
+
+AVX2_TARGET
+static void scal_add_avx2(int n, double a, double b, real_t *x) {
+    v2_t va = v2_set1((real_t) a), vb = v2_set1((real_t) b);
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W)
+        v2_store(x + i, v2_fma(va, v2_load(x + i), vb));
+    scal_add_scalar(n - i, a, b, x + i);
+}
+
+AVX2_TARGET
+static void add_avx2(int n, const real_t *x, real_t *y) {
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W)
+        v2_store(y + i, v2_add(v2_load(y + i), v2_load(x + i)));
+    add_scalar(n - i, x + i, y + i);
+}
+
+AVX2_TARGET
+static void relu_avx2(int n, const real_t *z, real_t *a) {
+    v2_t zero = v2_zero();
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W)
+        v2_store(a + i, v2_max(v2_load(z + i), zero));
+    relu_scalar(n - i, z + i, a + i);
+}
+
+AVX2_TARGET
+static void drelu_avx2(int n, const real_t *z, const real_t *dz, real_t *out) {
+    v2_t zero = v2_zero();
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W)
+        v2_store(out + i, v2_and(v2_gt(v2_load(z + i), zero), v2_load(dz + i)));
+    drelu_scalar(n - i, z + i, dz + i, out + i);
+}
+
+// V2_W 16-bit lanes sign-extended to full-width integers and compared with 0
+AVX2_TARGET
+static void drelu_half_avx2(int n, const uint16_t *z, const real_t *dz, real_t *out) {
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W) {
+#ifdef NNC_FLOAT32
+        __m256i w = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (z + i)));
+        v2_t pos = _mm256_castsi256_ps(_mm256_cmpgt_epi32(w, zero));
+#else
+        __m256i w = _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i*) (z + i)));
+        v2_t pos = _mm256_castsi256_pd(_mm256_cmpgt_epi64(w, zero));
+#endif
+        v2_store(out + i, v2_and(pos, v2_load(dz + i)));
+    }
+    drelu_half_scalar(n - i, z + i, dz + i, out + i);
+}
+
+AVX2_TARGET
+static void adam_avx2(int n, double lr, double b1, double b2, double eps, double c1, double c2,
+                      const real_t *g, real_t *m, real_t *v, real_t *w) {
+    v2_t vb1 = v2_set1((real_t) b1), vb1c = v2_set1((real_t) (1.0 - b1));
+    v2_t vb2 = v2_set1((real_t) b2), vb2c = v2_set1((real_t) (1.0 - b2));
+    v2_t vic1 = v2_set1((real_t) (1.0 / c1)), vic2 = v2_set1((real_t) (1.0 / c2));
+    v2_t veps = v2_set1((real_t) eps), vlr = v2_set1((real_t) lr);
+    int i = 0;
+    for(; i + V2_W <= n; i += V2_W) {
+        v2_t vg = v2_load(g + i);
+        v2_t vm = v2_fma(vb1, v2_load(m + i), v2_mul(vb1c, vg));
+        v2_t vv = v2_fma(vb2, v2_load(v + i), v2_mul(vb2c, v2_mul(vg, vg)));
+        v2_store(m + i, vm);
+        v2_store(v + i, vv);
+        v2_t den = v2_add(v2_sqrt(v2_mul(vv, vic2)), veps);
+        v2_t step = v2_div(v2_mul(vlr, v2_mul(vm, vic1)), den);
+        v2_store(w + i, v2_sub(v2_load(w + i), step));
+    }
+    adam_scalar(n - i, lr, b1, b2, eps, c1, c2, g + i, m + i, v + i, w + i);
+}
+
+// 16-bit conversions work on 8 floats; the float64 build narrows on load and
+// widens on store, which rounds exactly as the scalar (float) cast does
+AVX2_TARGET
+static inline __m256 load_ps8(const real_t *x) {
+#ifdef NNC_FLOAT32
+    return _mm256_loadu_ps(x);
+#else
+    return _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(x + 4)), _mm256_cvtpd_ps(_mm256_loadu_pd(x)));
+#endif
+}
+
+AVX2_TARGET
+static inline void store_ps8(real_t *x, __m256 v) {
+#ifdef NNC_FLOAT32
+    _mm256_storeu_ps(x, v);
+#else
+    _mm256_storeu_pd(x, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+    _mm256_storeu_pd(x + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+#endif
+}
+
+AVX2_TARGET
+static void to_half_avx2(int n, HalfFormat fmt, const real_t *x, uint16_t *h) {
+    int i = 0;
+    if(fmt == HALF_FP16) {
+        for(; i + 8 <= n; i += 8)
+            _mm_storeu_si128((__m128i*) (h + i),
+                             _mm256_cvtps_ph(load_ps8(x + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    } else {
+        const __m256i bias = _mm256_set1_epi32(0x7fff), one = _mm256_set1_epi32(1);
+        for(; i + 8 <= n; i += 8) {
+            __m256 v = load_ps8(x + i);
+            __m256i u = _mm256_castps_si256(v);
+            __m256i r = _mm256_add_epi32(u, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(u, 16), one)));
+            __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+            r = _mm256_blendv_epi8(r, _mm256_or_si256(u, _mm256_set1_epi32(0x400000)), nan);
+            r = _mm256_srli_epi32(r, 16);
+            // narrow 8 x 32 to 8 x 16: packus works per 128-bit lane, so gather lanes 0 and 2
+            __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+            _mm_storeu_si128((__m128i*) (h + i), _mm256_castsi256_si128(p));
+        }
+    }
+    to_half_scalar(n - i, fmt, x + i, h + i);
+}
+
+AVX2_TARGET
+static void from_half_avx2(int n, HalfFormat fmt, const uint16_t *h, real_t *x) {
+    int i = 0;
+    if(fmt == HALF_FP16) {
+        for(; i + 8 <= n; i += 8)
+            store_ps8(x + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (h + i))));
+    } else {
+        for(; i + 8 <= n; i += 8) {
+            __m256i u = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (h + i)));
+            store_ps8(x + i, _mm256_castsi256_ps(_mm256_slli_epi32(u, 16)));
+        }
+    }
+    from_half_scalar(n - i, fmt, h + i, x + i);
+}
+
+// four u8 activations of row a at depth group q, broadcast to every 32-bit lane
+static inline int32_t quad_u8(const uint8_t *a, int q) {
+    int32_t v;
+    memcpy(&v, a + 4 * q, sizeof(v));
+    return v;
+}
+
+// int8 tiles: 4 rows x 16 columns, two registers of 8 int32 sums per row. Without
+// VNNI, maddubs adds u8*s8 pairs into int16 first; activations stay <= 127 so those
+// pair sums can't saturate and both paths give the same result.
+#define AVX2_QMR 4
+#define AVX2_QNR 16
+
+#define QGEMM_MICRO_AVX2(name, target, mac)                                                   \
+target                                                                                        \
+static void name(int kq, const uint8_t *A, size_t lda, int mr, const int8_t *Bp, int32_t *T) { \
+    const uint8_t *a0 = A, *a1 = A + (size_t) (mr > 1 ? 1 : 0) * lda;                         \
+    const uint8_t *a2 = A + (size_t) (mr > 2 ? 2 : mr - 1) * lda;                             \
+    const uint8_t *a3 = A + (size_t) (mr > 3 ? 3 : mr - 1) * lda;                             \
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();                       \
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();                       \
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();                       \
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();                       \
+    const __m256i ones = _mm256_set1_epi16(1);                                                \
+    (void) ones;                                                                              \
+    for(int q = 0; q < kq; q++) {                                                             \
+        __m256i b0 = _mm256_loadu_si256((const __m256i*) Bp);                                 \
+        __m256i b1 = _mm256_loadu_si256((const __m256i*) (Bp + 32));                          \
+        __m256i a;                                                                            \
+        a = _mm256_set1_epi32(quad_u8(a0, q)); c00 = mac(c00, a, b0); c01 = mac(c01, a, b1);  \
+        a = _mm256_set1_epi32(quad_u8(a1, q)); c10 = mac(c10, a, b0); c11 = mac(c11, a, b1);  \
+        a = _mm256_set1_epi32(quad_u8(a2, q)); c20 = mac(c20, a, b0); c21 = mac(c21, a, b1);  \
+        a = _mm256_set1_epi32(quad_u8(a3, q)); c30 = mac(c30, a, b0); c31 = mac(c31, a, b1);  \
+        Bp += 4 * AVX2_QNR;                                                                   \
+    }                                                                                         \
+    _mm256_storeu_si256((__m256i*) (T + 0), c00); _mm256_storeu_si256((__m256i*) (T + 8), c01);   \
+    _mm256_storeu_si256((__m256i*) (T + 16), c10); _mm256_storeu_si256((__m256i*) (T + 24), c11); \
+    _mm256_storeu_si256((__m256i*) (T + 32), c20); _mm256_storeu_si256((__m256i*) (T + 40), c21); \
+    _mm256_storeu_si256((__m256i*) (T + 48), c30); _mm256_storeu_si256((__m256i*) (T + 56), c31); \
+}
+
+#define MAC_MADDUBS_AVX2(c, a, b) _mm256_add_epi32(c, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones))
+#define MAC_VNNI_AVX2(c, a, b) _mm256_dpbusd_avx_epi32(c, a, b)
+
+QGEMM_MICRO_AVX2(qgemm_micro_avx2, AVX2_TARGET, MAC_MADDUBS_AVX2)
+QGEMM_MICRO_AVX2(qgemm_micro_avx2_vnni, __attribute__((target("avx2,fma,f16c,avxvnni"))), MAC_VNNI_AVX2)
+
+// round(t * m / 2^s) for the 64-bit lanes holding t, m and s in their low halves,
+// clamped to 127; t and m are non-negative so unsigned multiplies and shifts do
+AVX2_TARGET
+static inline __m256i requant_lanes_avx2(__m256i t, __m256i m, __m256i s) {
+    const __m256i one = _mm256_set1_epi64x(1), top = _mm256_set1_epi64x(127);
+    const __m256i lo = _mm256_set1_epi64x(0xffffffff);
+    s = _mm256_and_si256(s, lo);
+    __m256i half = _mm256_sllv_epi64(one, _mm256_sub_epi64(s, one));
+    __m256i r = _mm256_srlv_epi64(_mm256_add_epi64(_mm256_mul_epu32(t, m), half), s);
+    return _mm256_blendv_epi8(r, top, _mm256_cmpgt_epi64(r, top));
+}
+
+AVX2_TARGET
+static void requant_avx2(int n, const int32_t *t, const int32_t *mult, const int *shift, uint8_t *out) {
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_max_epi32(_mm256_loadu_si256((const __m256i*) (t + i)), _mm256_setzero_si256());
+        __m256i m = _mm256_loadu_si256((const __m256i*) (mult + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*) (shift + i));
+        __m256i even = requant_lanes_avx2(v, m, s);
+        __m256i odd = requant_lanes_avx2(_mm256_srli_epi64(v, 32), _mm256_srli_epi64(m, 32),
+                                         _mm256_srli_epi64(s, 32));
+        __m256i r = _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+        __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+        _mm_storel_epi64((__m128i*) (out + i), _mm_packus_epi16(w, w));
+    }
+    requant_scalar(n - i, t + i, mult + i, shift + i, out + i);
+}
+
+// V2_W x V2_W tile: interleave row pairs, then pairs of pairs, then swap 128-bit halves
+#ifdef NNC_FLOAT32
+#define AVX2_TR 8
+
+AVX2_TARGET
+static void transpose_avx2(const real_t *A, size_t lda, real_t *B, size_t ldb) {
+    __m256 r0 = _mm256_loadu_ps(A + 0 * lda), r1 = _mm256_loadu_ps(A + 1 * lda);
+    __m256 r2 = _mm256_loadu_ps(A + 2 * lda), r3 = _mm256_loadu_ps(A + 3 * lda);
+    __m256 r4 = _mm256_loadu_ps(A + 4 * lda), r5 = _mm256_loadu_ps(A + 5 * lda);
+    __m256 r6 = _mm256_loadu_ps(A + 6 * lda), r7 = _mm256_loadu_ps(A + 7 * lda);
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+    __m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+    __m256 t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5);
+    __m256 t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+    __m256 u0 = _mm256_shuffle_ps(t0, t2, 0x44), u1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+    __m256 u2 = _mm256_shuffle_ps(t1, t3, 0x44), u3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+    __m256 u4 = _mm256_shuffle_ps(t4, t6, 0x44), u5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+    __m256 u6 = _mm256_shuffle_ps(t5, t7, 0x44), u7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+    _mm256_storeu_ps(B + 0 * ldb, _mm256_permute2f128_ps(u0, u4, 0x20));
+    _mm256_storeu_ps(B + 1 * ldb, _mm256_permute2f128_ps(u1, u5, 0x20));
+    _mm256_storeu_ps(B + 2 * ldb, _mm256_permute2f128_ps(u2, u6, 0x20));
+    _mm256_storeu_ps(B + 3 * ldb, _mm256_permute2f128_ps(u3, u7, 0x20));
+    _mm256_storeu_ps(B + 4 * ldb, _mm256_permute2f128_ps(u0, u4, 0x31));
+    _mm256_storeu_ps(B + 5 * ldb, _mm256_permute2f128_ps(u1, u5, 0x31));
+    _mm256_storeu_ps(B + 6 * ldb, _mm256_permute2f128_ps(u2, u6, 0x31));
+    _mm256_storeu_ps(B + 7 * ldb, _mm256_permute2f128_ps(u3, u7, 0x31));
+}
+#else
+#define AVX2_TR 4
+
+AVX2_TARGET
+static void transpose_avx2(const real_t *A, size_t lda, real_t *B, size_t ldb) {
+    __m256d r0 = _mm256_loadu_pd(A + 0 * lda), r1 = _mm256_loadu_pd(A + 1 * lda);
+    __m256d r2 = _mm256_loadu_pd(A + 2 * lda), r3 = _mm256_loadu_pd(A + 3 * lda);
+    __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+    __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+    _mm256_storeu_pd(B + 0 * ldb, _mm256_permute2f128_pd(t0, t2, 0x20));
+    _mm256_storeu_pd(B + 1 * ldb, _mm256_permute2f128_pd(t1, t3, 0x20));
+    _mm256_storeu_pd(B + 2 * ldb, _mm256_permute2f128_pd(t0, t2, 0x31));
+    _mm256_storeu_pd(B + 3 * ldb, _mm256_permute2f128_pd(t1, t3, 0x31));
+}
+#endif
+
+#define AVX2_KERNELS                                                                      \
+    .isa = ISA_AVX2,                                                                      \
+    .mr = AVX2_MR, .nr = AVX2_NR, .mc = 96,                                               \
+    .gemm_micro = gemm_micro_avx2,                                                        \
+    .dot = dot_avx2, .axpby = axpby_avx2, .scal_add = scal_add_avx2, .add = add_avx2,     \
+    .relu = relu_avx2, .drelu = drelu_avx2, .drelu_half = drelu_half_avx2,                \
+    .adam = adam_avx2,                                                                    \
+    .tr = AVX2_TR, .transpose = transpose_avx2,                                           \
+    .to_half = to_half_avx2, .from_half = from_half_avx2,                                 \
+    .requant = requant_avx2
+
+static const SimdKernels kernels_avx2 = {
+    AVX2_KERNELS, .name = "avx2",
+    .qmr = AVX2_QMR, .qnr = AVX2_QNR, .qgemm_micro = qgemm_micro_avx2,
+};
+
+static const SimdKernels kernels_avx2_vnni = {
+    AVX2_KERNELS, .name = "avx2+vnni",
+    .qmr = AVX2_QMR, .qnr = AVX2_QNR, .qgemm_micro = qgemm_micro_avx2_vnni,
+};
+
+/* --------------------------------------------------------------- AVX-512 */
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+#define AVX512_MR 8
+#define AVX512_NR (2 * V5_W)
+
+// lanes [0, r) of one register; r >= V5_W selects all of them
+#define V5_MASK(r) ((r) >= V5_W ? (v5_mask_t) -1 : (v5_mask_t) ((1u << (r)) - 1))
+
+AVX512_TARGET
+static void gemm_micro_avx512(int kc, const real_t *Ap, const real_t *Bp, real_t *C, size_t ldc,
+                              int mr, int nr, double alpha, double beta) {
+    v5_t c00 = v5_zero(), c01 = v5_zero();
+    v5_t c10 = v5_zero(), c11 = v5_zero();
+    v5_t c20 = v5_zero(), c21 = v5_zero();
+    v5_t c30 = v5_zero(), c31 = v5_zero();
+    v5_t c40 = v5_zero(), c41 = v5_zero();
+    v5_t c50 = v5_zero(), c51 = v5_zero();
+    v5_t c60 = v5_zero(), c61 = v5_zero();
+    v5_t c70 = v5_zero(), c71 = v5_zero();
+
+    for(int p = 0; p < kc; p++) {
+        v5_t b0 = v5_load(Bp);
+        v5_t b1 = v5_load(Bp + V5_W);
+        v5_t a;
+        a = v5_set1(Ap[0]); c00 = v5_fma(a, b0, c00); c01 = v5_fma(a, b1, c01);
+        a = v5_set1(Ap[1]); c10 = v5_fma(a, b0, c10); c11 = v5_fma(a, b1, c11);
+        a = v5_set1(Ap[2]); c20 = v5_fma(a, b0, c20); c21 = v5_fma(a, b1, c21);
+        a = v5_set1(Ap[3]); c30 = v5_fma(a, b0, c30); c31 = v5_fma(a, b1, c31);
+        a = v5_set1(Ap[4]); c40 = v5_fma(a, b0, c40); c41 = v5_fma(a, b1, c41);
+        a = v5_set1(Ap[5]); c50 = v5_fma(a, b0, c50); c51 = v5_fma(a, b1, c51);
+        a = v5_set1(Ap[6]); c60 = v5_fma(a, b0, c60); c61 = v5_fma(a, b1, c61);
+        a = v5_set1(Ap[7]); c70 = v5_fma(a, b0, c70); c71 = v5_fma(a, b1, c71);
+        Ap += AVX512_MR;
+        Bp += AVX512_NR;
+    }
+
+    v5_t acc[AVX512_MR][2] = {
+        {c00, c01}, {c10, c11}, {c20, c21}, {c30, c31},
+        {c40, c41}, {c50, c51}, {c60, c61}, {c70, c71},
+    };
+    v5_t va = v5_set1((real_t) alpha);
+    v5_t vb = v5_set1((real_t) beta);
+    // masked stores cover ragged right edges; rows past mr are skipped
+    v5_mask_t m0 = V5_MASK(nr);
+    v5_mask_t m1 = nr > V5_W ? V5_MASK(nr - V5_W) : 0;
+    for(int i = 0; i < mr; i++) {
+        real_t *c = C + i * ldc;
+        v5_t r0 = v5_mul(va, acc[i][0]);
+        v5_t r1 = v5_mul(va, acc[i][1]);
+        if(beta != 0.0) {
+            r0 = v5_fma(vb, v5_maskz_load(m0, c), r0);
+            r1 = v5_fma(vb, v5_maskz_load(m1, c + V5_W), r1);
+        }
+        v5_mask_store(c, m0, r0);
+        v5_mask_store(c + V5_W, m1, r1);
+    }
+}
+
+AVX512_TARGET
+static double dot_avx512(int n, const real_t *x, const real_t *y) {
+    v5_t s0 = v5_zero(), s1 = v5_zero();
+    int i = 0;
+    for(; i + 2 * V5_W <= n; i += 2 * V5_W) {
+        s0 = v5_fma(v5_load(x + i), v5_load(y + i), s0);
+        s1 = v5_fma(v5_load(x + i + V5_W), v5_load(y + i + V5_W), s1);
+    }
+    for(; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        s0 = v5_fma(v5_maskz_load(k, x + i), v5_maskz_load(k, y + i), s0);
+    }
+    return v5_reduce_add(v5_add(s0, s1));
+}
+
+AVX512_TARGET
+static void axpby_avx512(int n, double a, const real_t *x, double b, real_t *y) {
+    v5_t va = v5_set1((real_t) a), vb = v5_set1((real_t) b);
+    for(int i = 0; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        v5_t r = v5_fma(va, v5_maskz_load(k, x + i), v5_mul(vb, v5_maskz_load(k, y + i)));
+        v5_mask_store(y + i, k, r);
+    }
+}
+
+AVX512_TARGET
+static void scal_add_avx512(int n, double a, double b, real_t *x) {
+    v5_t va = v5_set1((real_t) a), vb = v5_set1((real_t) b);
+    for(int i = 0; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        v5_mask_store(x + i, k, v5_fma(va, v5_maskz_load(k, x + i), vb));
+    }
+}
+
+AVX512_TARGET
+static void add_avx512(int n, const real_t *x, real_t *y) {
+    for(int i = 0; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        v5_mask_store(y + i, k, v5_add(v5_maskz_load(k, y + i), v5_maskz_load(k, x + i)));
+    }
+}
+
+AVX512_TARGET
+static void relu_avx512(int n, const real_t *z, real_t *a) {
+    v5_t zero = v5_zero();
+    for(int i = 0; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        v5_mask_store(a + i, k, v5_max(v5_maskz_load(k, z + i), zero));
+    }
+}
+
+AVX512_TARGET
+static void drelu_avx512(int n, const real_t *z, const real_t *dz, real_t *out) {
+    v5_t zero = v5_zero();
+    for(int i = 0; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        v5_mask_t pos = v5_gt(k, v5_maskz_load(k, z + i), zero);
+        v5_mask_store(out + i, k, v5_maskz_load(pos, dz + i));
+    }
+}
+
+AVX512_TARGET
+static void drelu_half_avx512(int n, const uint16_t *z, const real_t *dz, real_t *out) {
+    int i = 0;
+    for(; i + V5_W <= n; i += V5_W) {
+#ifdef NNC_FLOAT32
+        __m512i w = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*) (z + i)));
+        v5_mask_t pos = _mm512_cmpgt_epi32_mask(w, _mm512_setzero_si512());
+#else
+        __m512i w = _mm512_cvtepi16_epi64(_mm_loadu_si128((const __m128i*) (z + i)));
+        v5_mask_t pos = _mm512_cmpgt_epi64_mask(w, _mm512_setzero_si512());
+#endif
+        v5_mask_store(out + i, (v5_mask_t) -1, v5_maskz_load(pos, dz + i));
+    }
+    drelu_half_scalar(n - i, z + i, dz + i, out + i);
+}
+
+AVX512_TARGET
+static void adam_avx512(int n, double lr, double b1, double b2, double eps, double c1, double c2,
+                        const real_t *g, real_t *m, real_t *v, real_t *w) {
+    v5_t vb1 = v5_set1((real_t) b1), vb1c = v5_set1((real_t) (1.0 - b1));
+    v5_t vb2 = v5_set1((real_t) b2), vb2c = v5_set1((real_t) (1.0 - b2));
+    v5_t vic1 = v5_set1((real_t) (1.0 / c1)), vic2 = v5_set1((real_t) (1.0 / c2));
+    v5_t veps = v5_set1((real_t) eps), vlr = v5_set1((real_t) lr);
+    for(int i = 0; i < n; i += V5_W) {
+        v5_mask_t k = V5_MASK(n - i);
+        v5_t vg = v5_maskz_load(k, g + i);
+        v5_t vm = v5_fma(vb1, v5_maskz_load(k, m + i), v5_mul(vb1c, vg));
+        v5_t vv = v5_fma(vb2, v5_maskz_load(k, v + i), v5_mul(vb2c, v5_mul(vg, vg)));
+        v5_mask_store(m + i, k, vm);
+        v5_mask_store(v + i, k, vv);
+        v5_t den = v5_add(v5_sqrt(v5_mul(vv, vic2)), veps);
+        v5_t step = v5_div(v5_mul(vlr, v5_mul(vm, vic1)), den);
+        v5_mask_store(w + i, k, v5_sub(v5_maskz_load(k, w + i), step));
+    }
+}
+
+AVX512_TARGET
+static inline __m512 load_ps16(const real_t *x) {
+#ifdef NNC_FLOAT32
+    return _mm512_loadu_ps(x);
+#else
+    __m512d lo = _mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(_mm512_loadu_pd(x))));
+    __m256d hi = _mm256_castps_pd(_mm512_cvtpd_ps(_mm512_loadu_pd(x + 8)));
+    return _mm512_castpd_ps(_mm512_insertf64x4(lo, hi, 1));
+#endif
+}
+
+AVX512_TARGET
+static inline void store_ps16(real_t *x, __m512 v) {
+#ifdef NNC_FLOAT32
+    _mm512_storeu_ps(x, v);
+#else
+    _mm512_storeu_pd(x, _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+    _mm512_storeu_pd(x + 8, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1))));
+#endif
+}
+
+AVX512_TARGET
+static void to_half_avx512(int n, HalfFormat fmt, const real_t *x, uint16_t *h) {
+    int i = 0;
+    if(fmt == HALF_FP16) {
+        for(; i + 16 <= n; i += 16)
+            _mm256_storeu_si256((__m256i*) (h + i),
+                                _mm512_cvtps_ph(load_ps16(x + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    } else {
+        const __m512i bias = _mm512_set1_epi32(0x7fff), one = _mm512_set1_epi32(1);
+        for(; i + 16 <= n; i += 16) {
+            __m512 v = load_ps16(x + i);
+            __m512i u = _mm512_castps_si512(v);
+            __m512i r = _mm512_add_epi32(u, _mm512_add_epi32(bias, _mm512_and_si512(_mm512_srli_epi32(u, 16), one)));
+            __mmask16 nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+            r = _mm512_mask_or_epi32(r, nan, u, _mm512_set1_epi32(0x400000));
+            _mm256_storeu_si256((__m256i*) (h + i), _mm512_cvtepi32_epi16(_mm512_srli_epi32(r, 16)));
+        }
+    }
+    to_half_scalar(n - i, fmt, x + i, h + i);
+}
+
+AVX512_TARGET
+static void from_half_avx512(int n, HalfFormat fmt, const uint16_t *h, real_t *x) {
+    int i = 0;
+    if(fmt == HALF_FP16) {
+        for(; i + 16 <= n; i += 16)
+            store_ps16(x + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) (h + i))));
+    } else {
+        for(; i + 16 <= n; i += 16) {
+            __m512i u = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) (h + i)));
+            store_ps16(x + i, _mm512_castsi512_ps(_mm512_slli_epi32(u, 16)));
+        }
+    }
+    from_half_scalar(n - i, fmt, h + i, x + i);
+}
+
+// int8 tiles: 8 rows x 32 columns. Byte-granular maddubs needs AVX-512BW; an
+// AVX-512F-only CPU keeps the AVX2 int8 tile.
+#define AVX512_QMR 8
+#define AVX512_QNR 32
+
+// one row of the AVX-512 int8 tile: broadcast its quad and update both accumulators
+#define Q5_ROW(i, mac)                                                                    \
+    a = _mm512_set1_epi32(quad_u8(a##i, q)); c##i##0 = mac(c##i##0, a, b0); c##i##1 = mac(c##i##1, a, b1)
+#define Q5_ROW_PTR(i) const uint8_t *a##i = A + (size_t) (i < mr ? i : mr - 1) * lda
+#define Q5_ROW_ZERO(i) __m512i c##i##0 = _mm512_setzero_si512(), c##i##1 = _mm512_setzero_si512()
+#define Q5_ROW_STORE(i)                                                                   \
+    _mm512_storeu_si512(T + i * AVX512_QNR, c##i##0);                                     \
+    _mm512_storeu_si512(T + i * AVX512_QNR + 16, c##i##1)
+
+#define QGEMM_MICRO_AVX512(name, target, mac)                                                 \
+target                                                                                        \
+static void name(int kq, const uint8_t *A, size_t lda, int mr, const int8_t *Bp, int32_t *T) { \
+    Q5_ROW_PTR(0); Q5_ROW_PTR(1); Q5_ROW_PTR(2); Q5_ROW_PTR(3);                               \
+    Q5_ROW_PTR(4); Q5_ROW_PTR(5); Q5_ROW_PTR(6); Q5_ROW_PTR(7);                               \
+    Q5_ROW_ZERO(0); Q5_ROW_ZERO(1); Q5_ROW_ZERO(2); Q5_ROW_ZERO(3);                           \
+    Q5_ROW_ZERO(4); Q5_ROW_ZERO(5); Q5_ROW_ZERO(6); Q5_ROW_ZERO(7);                           \
+    const __m512i ones = _mm512_set1_epi16(1);                                                \
+    (void) ones;                                                                              \
+    for(int q = 0; q < kq; q++) {                                                             \
+        __m512i b0 = _mm512_loadu_si512(Bp);                                                  \
+        __m512i b1 = _mm512_loadu_si512(Bp + 64);                                             \
+        __m512i a;                                                                            \
+        Q5_ROW(0, mac); Q5_ROW(1, mac); Q5_ROW(2, mac); Q5_ROW(3, mac);                       \
+        Q5_ROW(4, mac); Q5_ROW(5, mac); Q5_ROW(6, mac); Q5_ROW(7, mac);                       \
+        Bp += 4 * AVX512_QNR;                                                                 \
+    }                                                                                         \
+    Q5_ROW_STORE(0); Q5_ROW_STORE(1); Q5_ROW_STORE(2); Q5_ROW_STORE(3);                       \
+    Q5_ROW_STORE(4); Q5_ROW_STORE(5); Q5_ROW_STORE(6); Q5_ROW_STORE(7);                       \
+}
+
+#define MAC_MADDUBS_AVX512(c, a, b) _mm512_add_epi32(c, _mm512_madd_epi16(_mm512_maddubs_epi16(a, b), ones))
+#define MAC_VNNI_AVX512(c, a, b) _mm512_dpbusd_epi32(c, a, b)
+
+QGEMM_MICRO_AVX512(qgemm_micro_avx512, __attribute__((target("avx512f,avx512bw"))), MAC_MADDUBS_AVX512)
+QGEMM_MICRO_AVX512(qgemm_micro_avx512_vnni, __attribute__((target("avx512f,avx512bw,avx512vnni"))),
+                   MAC_VNNI_AVX512)
+
+AVX512_TARGET
+static inline __m512i requant_lanes_avx512(__m512i t, __m512i m, __m512i s) {
+    const __m512i one = _mm512_set1_epi64(1);
+    s = _mm512_and_si512(s, _mm512_set1_epi64(0xffffffff));
+    __m512i half = _mm512_sllv_epi64(one, _mm512_sub_epi64(s, one));
+    __m512i r = _mm512_srlv_epi64(_mm512_add_epi64(_mm512_mul_epu32(t, m), half), s);
+    return _mm512_min_epu64(r, _mm512_set1_epi64(127));
+}
+
+AVX512_TARGET
+static void requant_avx512(int n, const int32_t *t, const int32_t *mult, const int *shift, uint8_t *out) {
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_max_epi32(_mm512_loadu_si512(t + i), _mm512_setzero_si512());
+        __m512i m = _mm512_loadu_si512(mult + i);
+        __m512i s = _mm512_loadu_si512(shift + i);
+        __m512i even = requant_lanes_avx512(v, m, s);
+        __m512i odd = requant_lanes_avx512(_mm512_srli_epi64(v, 32), _mm512_srli_epi64(m, 32),
+                                           _mm512_srli_epi64(s, 32));
+        __m512i r = _mm512_or_si512(even, _mm512_slli_epi64(odd, 32));
+        _mm_storeu_si128((__m128i*) (out + i), _mm512_cvtepi32_epi8(r));
+    }
+    requant_scalar(n - i, t + i, mult + i, shift + i, out + i);
+}
+
+// 8 x 8 doubles: interleave row pairs, then gather 128-bit lanes twice. For floats
+// the AVX2 8 x 8 tile already fills a cache line per row, so it is reused.
+#ifdef NNC_FLOAT32
+#define AVX512_TR AVX2_TR
+#define transpose_avx512 transpose_avx2
+#else
+#define AVX512_TR 8
+
+AVX512_TARGET
+static void transpose_avx512(const real_t *A, size_t lda, real_t *B, size_t ldb) {
+    __m512d r[8], t[8];
+    for(int i = 0; i < 8; i++)
+        r[i] = _mm512_loadu_pd(A + i * lda);
+    for(int i = 0; i < 8; i += 2) {
+        t[i] = _mm512_unpacklo_pd(r[i], r[i + 1]); // a0 b0 a2 b2 a4 b4 a6 b6
+        t[i + 1] = _mm512_unpackhi_pd(r[i], r[i + 1]); // a1 b1 a3 b3 ...
+    }
+    for(int h = 0; h < 8; h += 4) {
+        r[h + 0] = _mm512_shuffle_f64x2(t[h + 0], t[h + 2], 0x88); // a0b0 a4b4 c0d0 c4d4
+        r[h + 1] = _mm512_shuffle_f64x2(t[h + 1], t[h + 3], 0x88);
+        r[h + 2] = _mm512_shuffle_f64x2(t[h + 0], t[h + 2], 0xDD);
+        r[h + 3] = _mm512_shuffle_f64x2(t[h + 1], t[h + 3], 0xDD);
+    }
+    for(int j = 0; j < 4; j++) {
+        _mm512_storeu_pd(B + j * ldb, _mm512_shuffle_f64x2(r[j], r[j + 4], 0x88));
+        _mm512_storeu_pd(B + (j + 4) * ldb, _mm512_shuffle_f64x2(r[j], r[j + 4], 0xDD));
+    }
+}
+#endif
+
+#define AVX512_KERNELS                                                                        \
+    .isa = ISA_AVX512,                                                                        \
+    .mr = AVX512_MR, .nr = AVX512_NR, .mc = 128,                                              \
+    .gemm_micro = gemm_micro_avx512,                                                          \
+    .dot = dot_avx512, .axpby = axpby_avx512, .scal_add = scal_add_avx512, .add = add_avx512, \
+    .relu = relu_avx512, .drelu = drelu_avx512, .drelu_half = drelu_half_avx512,              \
+    .adam = adam_avx512,                                                                      \
+    .tr = AVX512_TR, .transpose = transpose_avx512,                                           \
+    .to_half = to_half_avx512, .from_half = from_half_avx512,                                 \
+    .requant = requant_avx512
+
+static const SimdKernels kernels_avx512f = {
+    AVX512_KERNELS, .name = "avx512",
+    .qmr = AVX2_QMR, .qnr = AVX2_QNR, .qgemm_micro = qgemm_micro_avx2,
+};
+
+static const SimdKernels kernels_avx512 = {
+    AVX512_KERNELS, .name = "avx512",
+    .qmr = AVX512_QMR, .qnr = AVX512_QNR, .qgemm_micro = qgemm_micro_avx512,
+};
+
+static const SimdKernels kernels_avx512_vnni = {
+    AVX512_KERNELS, .name = "avx512+vnni",
+    .qmr = AVX512_QMR, .qnr = AVX512_QNR, .qgemm_micro = qgemm_micro_avx512_vnni,
+};
+
+#endif // SIMD_X86
+
+/* -------------------------------------------------------------- dispatch */
+
+#ifdef SIMD_X86
+static int cpu_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+           __builtin_cpu_supports("f16c");
+}
+#endif
+
+const SimdKernels* simd_kernels_for(SimdIsa isa) {
+    switch(isa) {
+    case ISA_SCALAR:
+        return &kernels_scalar;
+#ifdef SIMD_X86
+    case ISA_AVX2:
+        if(cpu_has_avx2())
+            return __builtin_cpu_supports("avxvnni") ? &kernels_avx2_vnni : &kernels_avx2;
+        return NULL;
+    case ISA_AVX512:
+        // the AVX-512 tables borrow AVX2 kernels (qgemm without avx512bw, float
+        // transpose), so AVX2 is required as well
+        if(!cpu_has_avx2() || !__builtin_cpu_supports("avx512f"))
+            return NULL;
+        if(!__builtin_cpu_supports("avx512bw"))
+            return &kernels_avx512f;
+        return __builtin_cpu_supports("avx512vnni") ? &kernels_avx512_vnni : &kernels_avx512;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static const SimdKernels *selected = NULL;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void simd_select(void) {
+    const char *env = getenv("NNC_ISA");
+    if(env) {
+        SimdIsa want = ISA_SCALAR;
+        if(strcmp(env, "avx512") == 0) want = ISA_AVX512;
+        else if(strcmp(env, "avx2") == 0) want = ISA_AVX2;
+        else if(strcmp(env, "scalar") != 0)
+            fprintf(stderr, "NNC_ISA=%s not recognized, using scalar\n", env);
+        selected = simd_kernels_for(want);
+        if(!selected) {
+            fprintf(stderr, "NNC_ISA=%s not supported on this CPU, using scalar\n", env);
+            selected = &kernels_scalar;
+        }
+        return;
+    }
+
+    selected = simd_kernels_for(ISA_AVX512);
+    if(!selected) selected = simd_kernels_for(ISA_AVX2);
+    if(!selected) selected = &kernels_scalar;
+}
+
+const SimdKernels* simd_kernels(void) {
+    pthread_once(&select_once, simd_select);
+    return selected;
+}
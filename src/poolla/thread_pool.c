@@ -1,65 +1,383 @@
+#define _GNU_SOURCE
 #include "poolla/thread_pool.h"
 #include <stdlib.h>
 #include <stdio.h> 
+#include <sched.h>
+#include <time.h>
 
-// function for each worker thread
-static void* tp_worker (void* arg) {
-    ThreadPool *pool = (ThreadPool*) arg;
+// identity of the current thread when it is a pool worker
+static _Thread_local ThreadPool *tp_self_pool = NULL;
+static _Thread_local int tp_self_id = -1;
+// children of the task running on this thread; threadpool_submit adds to it
+static _Thread_local TaskGroup *tp_children = NULL;
+static _Thread_local ThreadPool *tp_children_pool = NULL;
+
+static long tp_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static inline void tp_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// publish timestamp, only taken while latency tracking is on
+static long tp_stamp(ThreadPool *pool) {
+    return atomic_load_explicit(&pool->track_latency, memory_order_relaxed) ? tp_now_ns() : 0;
+}
+
+// record publish-to-pickup latency for work found by a thread that was idle
+static void tp_record_wake(ThreadPool *pool, long published_ns) {
+    if(published_ns == 0)
+        return;
+    long dt = tp_now_ns() - published_ns;
+    if(dt < 0) dt = 0;
+    atomic_fetch_add_explicit(&pool->wakes, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->wake_ns_total, dt, memory_order_relaxed);
+    long max = atomic_load_explicit(&pool->wake_ns_max, memory_order_relaxed);
+    while(dt > max && !atomic_compare_exchange_weak_explicit(&pool->wake_ns_max, &max, dt,
+            memory_order_relaxed, memory_order_relaxed));
+}
+
+typedef int (*tp_ready_fn) (ThreadPool *pool, void *arg);
 
+// adaptive wait: spin with pause, then yield, until ready() holds or the budget is spent.
+// Returns ready()'s final answer; on 0 the caller parks on a condition variable.
+static int tp_spin(ThreadPool *pool, tp_ready_fn ready, void *arg) {
+    if(ready(pool, arg))
+        return 1;
+    if(atomic_load_explicit(&pool->wait_policy, memory_order_relaxed) == TP_WAIT_PARK)
+        return 0;
+
+    int spins = atomic_load_explicit(&pool->spin_count, memory_order_relaxed);
+    for(int i = 0; i < spins; i++) {
+        tp_cpu_relax();
+        if((i & 15) == 15 && ready(pool, arg))
+            return 1;
+    }
+    int yields = atomic_load_explicit(&pool->yield_count, memory_order_relaxed);
+    for(int i = 0; i < yields; i++) {
+        sched_yield();
+        if(ready(pool, arg))
+            return 1;
+    }
+    return ready(pool, arg);
+}
+
+// claim and run chunks until the index space is exhausted
+static void tp_run_job(ParallelJob *job) {
     while(1) {
-        pthread_mutex_lock(&(pool->lock)); // lock the pool
-        // Wait until there's actually a task in the queue
-        while(pool->head == NULL && !pool->shutdown) {
-            pthread_cond_wait(&(pool->notify), &(pool->lock));
-        }
+        int start = atomic_fetch_add_explicit(&job->next, job->grain, memory_order_relaxed);
+        if(start >= job->n)
+            break;
+        int end = (start > job->n - job->grain) ? job->n : start + job->grain;
+        job->fn(job->ctx, start, end);
+    }
+}
 
-        if(pool->shutdown) {
-            pthread_mutex_unlock(&(pool->lock));
-            pthread_exit(NULL);
-        }
+// join the published parallel job; called with the lock held, returns with it released
+static void tp_join_job(ThreadPool *pool, unsigned long *seen, int woke) {
+    // take a reference under the lock so the owner can't retire the job under us
+    ParallelJob *job = pool->job;
+    *seen = atomic_load_explicit(&pool->job_seq, memory_order_relaxed);
+    atomic_fetch_add_explicit(&job->refs, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&(pool->lock));
 
-        // dequeue a task
-        Task* task = pool->head;
+    if(woke)
+        tp_record_wake(pool, job->publish_ns);
+    tp_run_job(job);
+
+    // last one out wakes the owner
+    if(atomic_fetch_sub_explicit(&job->refs, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_lock(&(pool->lock));
+        pthread_cond_broadcast(&(pool->working));
+        pthread_mutex_unlock(&(pool->lock));
+    }
+}
+
+// pop the shared queue; caller holds the lock
+static Task* tp_dequeue(ThreadPool *pool) {
+    Task *task = pool->head;
+    if(task) {
         pool->head = task->next;
         if(pool->head == NULL) {
             pool->tail = NULL;
         }
+        atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+    }
+    return task;
+}
 
-        pthread_mutex_unlock(&(pool->lock)); // unlock the pool
+static void tp_execute(ThreadPool *pool, Task *task) {
+    // anything the task submits becomes its child and is joined before it completes
+    TaskGroup children;
+    threadpool_group_init(&children);
+    TaskGroup *outer = tp_children;
+    ThreadPool *outer_pool = tp_children_pool;
+    tp_children = &children;
+    tp_children_pool = pool;
+
+    (*(task->function))(task->args);
+    if(atomic_load_explicit(&children.pending, memory_order_acquire) > 0)
+        threadpool_group_wait(pool, &children);
+
+    tp_children = outer;
+    tp_children_pool = outer_pool;
 
-        // Execute the task
-        (*(task->function))(task->args);
+    // a caller-owned task may go away as soon as its group is released
+    TaskGroup *group = task->group;
+    if(task->heap)
         free(task);
+    atomic_fetch_add_explicit(&pool->executed, 1, memory_order_relaxed);
 
-        // signal task completion
+    // signal task completion
+    int last_in_group = group &&
+        atomic_fetch_sub_explicit(&group->pending, 1, memory_order_acq_rel) == 1;
+    int last_in_pool = atomic_fetch_sub_explicit(&pool->active, 1, memory_order_acq_rel) == 1;
+    if(last_in_group || last_in_pool) {
         pthread_mutex_lock(&(pool->lock));
-        pool->active--;
-        if(pool->active == 0) {
-            pthread_cond_signal(&(pool->working));
+        pthread_cond_broadcast(&(pool->working));
+        pthread_mutex_unlock(&(pool->lock));
+    }
+}
+
+// own deque first (LIFO, cache-warm), then steal from the others (FIFO), then the shared queue
+static Task* tp_find_task(ThreadPool *pool, int self) {
+    Task *task = ws_deque_take(&pool->deques[self]);
+    if(task) return task;
+
+    int retry = 1;
+    while(retry) {
+        retry = 0;
+        for(int i = 1; i < pool->tcount; i++) {
+            int victim = (self + i) % pool->tcount;
+            void *x = ws_deque_steal(&pool->deques[victim]);
+            if(x == WS_ABORT) {
+                retry = 1;
+            } else if(x) {
+                atomic_fetch_add_explicit(&pool->steals, 1, memory_order_relaxed);
+                return (Task*) x;
+            }
         }
+    }
+
+    if(atomic_load_explicit(&pool->queued, memory_order_acquire) > 0) {
+        pthread_mutex_lock(&(pool->lock));
+        task = tp_dequeue(pool);
         pthread_mutex_unlock(&(pool->lock));
     }
-    return NULL;
+    return task;
+}
+
+static int tp_has_stealable(ThreadPool *pool) {
+    for(int i = 0; i < pool->tcount; i++) {
+        if(ws_deque_size(&pool->deques[i]) > 0)
+            return 1;
+    }
+    return 0;
+}
+
+// any task the calling thread could pick up, checked without the lock
+static int tp_has_work(ThreadPool *pool) {
+    return atomic_load_explicit(&pool->queued, memory_order_seq_cst) > 0 ||
+           (pool->deques && tp_has_stealable(pool));
+}
+
+// something for an idle worker to do; arg is the last job sequence it joined
+static int tp_worker_ready(ThreadPool *pool, void *arg) {
+    unsigned long seen = *(unsigned long*) arg;
+    return atomic_load_explicit(&pool->shutdown, memory_order_relaxed) ||
+           atomic_load_explicit(&pool->job_seq, memory_order_relaxed) != seen ||
+           tp_has_work(pool);
+}
+
+// a task for a thread that is waiting on a group, whether or not it is a worker
+static Task* tp_help_task(ThreadPool *pool) {
+    if(pool->mode == TP_MODE_STEAL) {
+        if(tp_self_pool == pool)
+            return tp_find_task(pool, tp_self_id);
+        // outsiders own no deque but may steal from any
+        for(int i = 0; i < pool->tcount; i++) {
+            void *x = ws_deque_steal(&pool->deques[i]);
+            if(x && x != WS_ABORT) {
+                atomic_fetch_add_explicit(&pool->steals, 1, memory_order_relaxed);
+                return (Task*) x;
+            }
+        }
+    }
+
+    Task *task = NULL;
+    if(atomic_load_explicit(&pool->queued, memory_order_acquire) > 0) {
+        pthread_mutex_lock(&(pool->lock));
+        task = tp_dequeue(pool);
+        pthread_mutex_unlock(&(pool->lock));
+    }
+    return task;
+}
+
+static void* tp_steal_worker(ThreadPool *pool, int self) {
+    unsigned long seen = 0; // last parallel job this worker joined
+    int woke = 0; // went idle since the last task
+
+    while(1) {
+        Task *task = tp_find_task(pool, self);
+        if(task) {
+            if(woke)
+                tp_record_wake(pool, task->submit_ns);
+            woke = 0;
+            tp_execute(pool, task);
+            continue;
+        }
+
+        woke = 1;
+        if(!tp_spin(pool, tp_worker_ready, &seen)) {
+            pthread_mutex_lock(&(pool->lock));
+            // announce we're about to park, then re-check so a concurrent push can't be missed
+            atomic_fetch_add_explicit(&pool->idle, 1, memory_order_seq_cst);
+            if(!tp_worker_ready(pool, &seen))
+                atomic_fetch_add_explicit(&pool->parks, 1, memory_order_relaxed);
+            while(!tp_worker_ready(pool, &seen)) {
+                pthread_cond_wait(&(pool->notify), &(pool->lock));
+            }
+            atomic_fetch_sub_explicit(&pool->idle, 1, memory_order_relaxed);
+            pthread_mutex_unlock(&(pool->lock));
+        }
+
+        if(atomic_load_explicit(&pool->shutdown, memory_order_relaxed))
+            return NULL;
+
+        pthread_mutex_lock(&(pool->lock));
+        if(pool->job && atomic_load_explicit(&pool->job_seq, memory_order_relaxed) != seen) {
+            tp_join_job(pool, &seen, woke);
+            woke = 0;
+            continue;
+        }
+        // the job we were woken for is already retired
+        seen = atomic_load_explicit(&pool->job_seq, memory_order_relaxed);
+        pthread_mutex_unlock(&(pool->lock));
+    }
+}
+
+static void* tp_fifo_worker(ThreadPool *pool) {
+    unsigned long seen = 0; // last parallel job this worker joined
+
+    while(1) {
+        int woke = 0;
+        if(!tp_worker_ready(pool, &seen)) {
+            woke = 1;
+            tp_spin(pool, tp_worker_ready, &seen);
+        }
+
+        pthread_mutex_lock(&(pool->lock)); // lock the pool
+        // Wait until there's a task in the queue or a parallel job we haven't joined
+        if(!tp_worker_ready(pool, &seen))
+            atomic_fetch_add_explicit(&pool->parks, 1, memory_order_relaxed);
+        while(!tp_worker_ready(pool, &seen)) {
+            pthread_cond_wait(&(pool->notify), &(pool->lock));
+        }
+
+        if(atomic_load_explicit(&pool->shutdown, memory_order_relaxed)) {
+            pthread_mutex_unlock(&(pool->lock));
+            return NULL;
+        }
+
+        if(pool->job && atomic_load_explicit(&pool->job_seq, memory_order_relaxed) != seen) {
+            tp_join_job(pool, &seen, woke);
+            continue;
+        }
+        seen = atomic_load_explicit(&pool->job_seq, memory_order_relaxed);
+
+        // dequeue a task
+        Task* task = tp_dequeue(pool);
+        pthread_mutex_unlock(&(pool->lock)); // unlock the pool
+
+        if(task) {
+            if(woke)
+                tp_record_wake(pool, task->submit_ns);
+            tp_execute(pool, task);
+        }
+    }
+}
+
+// function for each worker thread
+static void* tp_worker (void* arg) {
+    ThreadPool *pool = (ThreadPool*) arg;
+    int self = atomic_fetch_add_explicit(&pool->next_id, 1, memory_order_relaxed);
+    tp_self_pool = pool;
+    tp_self_id = self;
+
+    if(pool->mode == TP_MODE_STEAL)
+        return tp_steal_worker(pool, self);
+    return tp_fifo_worker(pool);
 }
 
 ThreadPool* threadpool_init(int nthreads) {
+    return threadpool_init_mode(nthreads, TP_MODE_FIFO);
+}
+
+ThreadPool* threadpool_init_mode(int nthreads, ThreadPoolMode mode) {
     ThreadPool *pool = (ThreadPool*) malloc(sizeof(ThreadPool));
     if(pool == NULL) {
         return NULL;
     }
 
     pool->tcount = nthreads;
-    pool->active = 0;
-    pool->shutdown = 0;
     pool->head = NULL;
     pool->tail = NULL;
+    pool->mode = mode;
+    pool->deques = NULL;
+    pool->job = NULL;
+    atomic_init(&pool->shutdown, 0);
+    atomic_init(&pool->active, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->idle, 0);
+    atomic_init(&pool->waiters, 0);
+    atomic_init(&pool->next_id, 0);
+    atomic_init(&pool->wait_policy, TP_WAIT_PARK);
+    atomic_init(&pool->spin_count, 0);
+    atomic_init(&pool->yield_count, 0);
+    atomic_init(&pool->track_latency, 0);
+    atomic_init(&pool->executed, 0);
+    atomic_init(&pool->steals, 0);
+    atomic_init(&pool->wakes, 0);
+    atomic_init(&pool->parks, 0);
+    atomic_init(&pool->wake_ns_total, 0);
+    atomic_init(&pool->wake_ns_max, 0);
+    atomic_init(&pool->job_seq, 0);
+
+    if(mode == TP_MODE_STEAL) {
+        pool->deques = (WSDeque*) malloc(sizeof(WSDeque) * (nthreads > 0 ? nthreads : 1));
+        if(pool->deques == NULL) {
+            free(pool);
+            return NULL;
+        }
+        for(int i=0; i<nthreads; i++) {
+            if(ws_deque_init(&pool->deques[i], 64) != 0) {
+                for(int j=0; j<i; j++)
+                    ws_deque_destroy(&pool->deques[j]);
+                free(pool->deques);
+                free(pool);
+                return NULL;
+            }
+        }
+    }
 
     pthread_mutex_init(&(pool->lock), NULL);
     pthread_cond_init(&(pool->notify), NULL);
     pthread_cond_init(&(pool->working), NULL);
 
-    pool->threads = (pthread_t*) malloc(sizeof(pthread_t) * nthreads);
+    pool->threads = (pthread_t*) malloc(sizeof(pthread_t) * (nthreads > 0 ? nthreads : 1));
     if(pool->threads == NULL) {
+        if(pool->deques) {
+            for(int i=0; i<nthreads; i++)
+                ws_deque_destroy(&pool->deques[i]);
+            free(pool->deques);
+        }
         free(pool);
         return NULL;
     }
@@ -70,13 +388,59 @@ ThreadPool* threadpool_init(int nthreads) {
     return pool;
 }
 
-void threadpool_submit(ThreadPool *pool, void (*function)(void*), void *arg) {
-    Task *task = (Task*) malloc(sizeof(Task));
-    if(task == NULL) return;
+void threadpool_set_wait(ThreadPool *pool, ThreadPoolWait policy, int spins, int yields) {
+    atomic_store_explicit(&pool->spin_count, spins > 0 ? spins : 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->yield_count, yields > 0 ? yields : 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->wait_policy, policy, memory_order_relaxed);
+}
 
+int threadpool_pin(ThreadPool *pool, const int *cpus, int ncpus) {
+    if(ncpus <= 0) return -1;
+    int rc = 0;
+    for(int i=0; i<pool->tcount; i++) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % ncpus], &set);
+        if(pthread_setaffinity_np(pool->threads[i], sizeof(set), &set) != 0)
+            rc = -1;
+    }
+    return rc;
+}
+
+void threadpool_track_latency(ThreadPool *pool, int on) {
+    atomic_store_explicit(&pool->track_latency, on != 0, memory_order_relaxed);
+}
+
+void threadpool_group_init(TaskGroup *group) {
+    atomic_init(&group->pending, 0);
+}
+
+// queue a filled-in task: on the submitting worker's deque when stealing, else on the shared queue
+static void tp_submit(ThreadPool *pool, TaskGroup *group, Task *task, void (*function)(void*), void *arg) {
     task->function = function;
     task->args = arg;
+    task->group = group;
+    task->submit_ns = tp_stamp(pool);
     task->next = NULL;
+
+    if(group)
+        atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->active, 1, memory_order_relaxed);
+
+    // workers of a stealing pool keep their own tasks local
+    if(pool->mode == TP_MODE_STEAL && tp_self_pool == pool &&
+       ws_deque_push(&pool->deques[tp_self_id], task) == 0) {
+        atomic_thread_fence(memory_order_seq_cst);
+        int waiters = atomic_load_explicit(&pool->waiters, memory_order_relaxed);
+        if(atomic_load_explicit(&pool->idle, memory_order_relaxed) > 0 || waiters > 0) {
+            pthread_mutex_lock(&(pool->lock));
+            pthread_cond_signal(&(pool->notify));
+            if(waiters > 0)
+                pthread_cond_broadcast(&(pool->working));
+            pthread_mutex_unlock(&(pool->lock));
+        }
+        return;
+    }
     
     pthread_mutex_lock(&(pool->lock));
     
@@ -88,22 +452,172 @@ void threadpool_submit(ThreadPool *pool, void (*function)(void*), void *arg) {
         pool->tail = task;
     }
 
-    pool->active++;
+    atomic_fetch_add_explicit(&pool->queued, 1, memory_order_seq_cst);
     pthread_cond_signal(&(pool->notify));
+    if(atomic_load_explicit(&pool->waiters, memory_order_relaxed) > 0)
+        pthread_cond_broadcast(&(pool->working));
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+void threadpool_submit_group(ThreadPool *pool, TaskGroup *group, void (*function)(void*), void *arg) {
+    Task *task = (Task*) malloc(sizeof(Task));
+    if(task == NULL) return;
+    task->heap = 1;
+    tp_submit(pool, group, task, function, arg);
+}
+
+void threadpool_submit_task(ThreadPool *pool, TaskGroup *group, Task *task, void (*function)(void*), void *arg) {
+    task->heap = 0;
+    tp_submit(pool, group, task, function, arg);
+}
+
+void threadpool_submit(ThreadPool *pool, void (*function)(void*), void *arg) {
+    // inside a task, new work is a child of that task
+    TaskGroup *group = (tp_children_pool == pool) ? tp_children : NULL;
+    threadpool_submit_group(pool, group, function, arg);
+}
+
+// a group waiter can stop waiting, or has a task to help with
+static int tp_group_ready(ThreadPool *pool, void *arg) {
+    TaskGroup *group = (TaskGroup*) arg;
+    return atomic_load_explicit(&group->pending, memory_order_acquire) == 0 || tp_has_work(pool);
+}
+
+void threadpool_group_wait(ThreadPool *pool, TaskGroup *group) {
+    while(atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+        // help instead of blocking: the task we run may be one we're waiting on
+        Task *task = tp_help_task(pool);
+        if(task) {
+            tp_execute(pool, task);
+            continue;
+        }
+        if(tp_spin(pool, tp_group_ready, group))
+            continue;
+
+        pthread_mutex_lock(&(pool->lock));
+        atomic_fetch_add_explicit(&pool->waiters, 1, memory_order_seq_cst);
+        if(!tp_group_ready(pool, group))
+            atomic_fetch_add_explicit(&pool->parks, 1, memory_order_relaxed);
+        while(!tp_group_ready(pool, group)) {
+            pthread_cond_wait(&(pool->working), &(pool->lock));
+        }
+        atomic_fetch_sub_explicit(&pool->waiters, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&(pool->lock));
+    }
+}
+
+static int tp_job_done(ThreadPool *pool, void *arg) {
+    (void) pool;
+    ParallelJob *job = (ParallelJob*) arg;
+    return atomic_load_explicit(&job->refs, memory_order_acquire) == 0;
+}
+
+void threadpool_parallel_for(ThreadPool *pool, int n, int grain, parallel_fn fn, void *ctx) {
+    if(n <= 0)
+        return;
+    if(grain < 1)
+        grain = 1;
+
+    // split into a few chunks per participant so ragged chunks even out
+    int participants = pool->tcount + 1;
+    int auto_grain = (n + 4 * participants - 1) / (4 * participants);
+    if(auto_grain > grain)
+        grain = auto_grain;
+
+    if(pool->tcount < 1 || n <= grain) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    ParallelJob job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.n = n;
+    job.grain = grain;
+    job.publish_ns = tp_stamp(pool);
+    atomic_init(&job.next, 0);
+    atomic_init(&job.refs, 0);
+
+    pthread_mutex_lock(&(pool->lock));
+    if(pool->job != NULL) {
+        // another loop owns the workers (nested or concurrent caller): run inline
+        pthread_mutex_unlock(&(pool->lock));
+        fn(ctx, 0, n);
+        return;
+    }
+    pool->job = &job;
+    atomic_fetch_add_explicit(&pool->job_seq, 1, memory_order_seq_cst);
+    pthread_cond_broadcast(&(pool->notify));
+    pthread_mutex_unlock(&(pool->lock));
+
+    tp_run_job(&job);
+
+    // retire the job so no late worker joins, then wait for the ones inside
+    pthread_mutex_lock(&(pool->lock));
+    pool->job = NULL;
     pthread_mutex_unlock(&(pool->lock));
+    if(tp_spin(pool, tp_job_done, &job))
+        return;
+
+    pthread_mutex_lock(&(pool->lock));
+    while(atomic_load_explicit(&job.refs, memory_order_acquire) > 0) {
+        pthread_cond_wait(&(pool->working), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+static int tp_all_done(ThreadPool *pool, void *arg) {
+    (void) arg;
+    return atomic_load_explicit(&pool->active, memory_order_acquire) == 0;
 }
 
 void threadpool_wait(ThreadPool *pool) {
+    // a task can't wait for the whole pool (it is part of it), only for its children
+    if(tp_children_pool == pool) {
+        threadpool_group_wait(pool, tp_children);
+        return;
+    }
+    // without workers the caller runs whatever is queued
+    Task *task;
+    while(pool->tcount < 1 && (task = tp_help_task(pool)) != NULL)
+        tp_execute(pool, task);
+    if(tp_spin(pool, tp_all_done, NULL))
+        return;
+
     pthread_mutex_lock(&(pool->lock));
-    while(pool->active > 0) {
+    while(atomic_load_explicit(&pool->active, memory_order_acquire) > 0) {
         pthread_cond_wait(&(pool->working), &(pool->lock));
     }
     pthread_mutex_unlock(&(pool->lock));
 }
 
+void threadpool_stats(ThreadPool *pool, ThreadPoolStats *stats) {
+    stats->executed = atomic_load_explicit(&pool->executed, memory_order_relaxed);
+    stats->steals = atomic_load_explicit(&pool->steals, memory_order_relaxed);
+    stats->wakes = atomic_load_explicit(&pool->wakes, memory_order_relaxed);
+    stats->parks = atomic_load_explicit(&pool->parks, memory_order_relaxed);
+    stats->wake_ns_total = atomic_load_explicit(&pool->wake_ns_total, memory_order_relaxed);
+    stats->wake_ns_max = atomic_load_explicit(&pool->wake_ns_max, memory_order_relaxed);
+}
+
+void threadpool_print_stats(ThreadPool *pool, FILE *fp) {
+    ThreadPoolStats st;
+    threadpool_stats(pool, &st);
+    double mean_us = st.wakes ? (double) st.wake_ns_total / st.wakes / 1000.0 : 0.0;
+    fprintf(fp, "pool: %d threads, %s, wait=%s (spin %d, yield %d)\n",
+            pool->tcount, pool->mode == TP_MODE_STEAL ? "steal" : "fifo",
+            atomic_load(&pool->wait_policy) == TP_WAIT_ADAPTIVE ? "adaptive" : "park",
+            atomic_load(&pool->spin_count), atomic_load(&pool->yield_count));
+    fprintf(fp, "  tasks %ld, steals %ld, parks %ld\n", st.executed, st.steals, st.parks);
+    if(atomic_load(&pool->track_latency)) {
+        fprintf(fp, "  wakes %ld, latency mean %.2f us, max %.2f us\n",
+                st.wakes, mean_us, st.wake_ns_max / 1000.0);
+    }
+}
+
 void threadpool_destroy(ThreadPool *pool) {
     pthread_mutex_lock(&(pool->lock));
-    pool->shutdown = 1;
+    atomic_store(&pool->shutdown, 1);
     pthread_cond_broadcast(&(pool->notify));
     pthread_mutex_unlock(&(pool->lock));
 
@@ -114,7 +628,18 @@ void threadpool_destroy(ThreadPool *pool) {
     while(pool->head) {
         Task *tmp = pool->head;
         pool->head = pool->head->next;
-        free(tmp);
+        if(tmp->heap)
+            free(tmp);
+    }
+    if(pool->deques) {
+        for(int i=0; i<pool->tcount; i++) {
+            Task *tmp;
+            while((tmp = ws_deque_take(&pool->deques[i])) != NULL)
+                if(tmp->heap)
+                    free(tmp);
+            ws_deque_destroy(&pool->deques[i]);
+        }
+        free(pool->deques);
     }
 
     pthread_mutex_destroy(&(pool->lock));
@@ -122,4 +647,4 @@ void threadpool_destroy(ThreadPool *pool) {
     pthread_cond_destroy(&(pool->working));
     free(pool->threads);
     free(pool);
-}
\ No newline at end of file
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include "poolla/topology.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+static int read_int(const char *path, int fallback) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) return fallback;
+    int v;
+    if(fscanf(fp, "%d", &v) != 1) v = fallback;
+    fclose(fp);
+    return v;
+}
+
+// NUMA node of a CPU from its nodeN link, 0 if there is none
+static int cpu_node(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if(!dir) return 0;
+
+    int node = 0;
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL) {
+        if(strncmp(ent->d_name, "node", 4) == 0 && ent->d_name[4] >= '0' && ent->d_name[4] <= '9') {
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+typedef struct {
+    int cpu, core, package, node;
+    int rank; // SMT sibling index within its core
+} CpuInfo;
+
+static int count_distinct(const int *v, int n) {
+    int count = 0;
+    for(int i = 0; i < n; i++) {
+        int seen = 0;
+        for(int j = 0; j < i && !seen; j++)
+            seen = (v[j] == v[i]);
+        if(!seen) count++;
+    }
+    return count;
+}
+
+int topology_discover(CpuTopology *topo) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+
+    int ncpus = CPU_COUNT(&set);
+    if(ncpus <= 0) return -1;
+
+    CpuInfo *info = malloc(sizeof(CpuInfo) * ncpus);
+    int *keys = calloc(ncpus, sizeof(int));
+    topo->order = malloc(sizeof(int) * ncpus);
+    if(!info || !keys || !topo->order) {
+        free(info);
+        free(keys);
+        free(topo->order);
+        topo->order = NULL;
+        return -1;
+    }
+
+    char path[128];
+    int n = 0;
+    for(int cpu = 0; cpu < CPU_SETSIZE && n < ncpus; cpu++) {
+        if(!CPU_ISSET(cpu, &set)) continue;
+        info[n].cpu = cpu;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+        info[n].core = read_int(path, cpu);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+        info[n].package = read_int(path, 0);
+        info[n].node = cpu_node(cpu);
+        n++;
+    }
+
+    // sibling rank: how many earlier CPUs share this (package, core)
+    int max_rank = 0;
+    for(int i = 0; i < n; i++) {
+        info[i].rank = 0;
+        for(int j = 0; j < i; j++) {
+            if(info[j].core == info[i].core && info[j].package == info[i].package)
+                info[i].rank++;
+        }
+        if(info[i].rank > max_rank) max_rank = info[i].rank;
+        keys[i] = info[i].package * 65536 + info[i].core;
+    }
+    topo->ncpus = n;
+    topo->ncores = count_distinct(keys, n);
+    for(int i = 0; i < n; i++) keys[i] = info[i].package;
+    topo->npackages = count_distinct(keys, n);
+    for(int i = 0; i < n; i++) keys[i] = info[i].node;
+    topo->nnodes = count_distinct(keys, n);
+
+    // rank 0 of every core first; within a rank, pass p takes the p-th CPU of each package
+    int k = 0;
+    for(int rank = 0; rank <= max_rank; rank++) {
+        for(int pass = 0; ; pass++) {
+            int added = 0;
+            for(int i = 0; i < n; i++) {
+                if(info[i].rank != rank) continue;
+                int pos = 0;
+                for(int j = 0; j < i; j++) {
+                    if(info[j].rank == rank && info[j].package == info[i].package) pos++;
+                }
+                if(pos == pass) {
+                    topo->order[k++] = info[i].cpu;
+                    added++;
+                }
+            }
+            if(!added) break;
+        }
+    }
+
+    free(info);
+    free(keys);
+    return 0;
+}
+
+void topology_free(CpuTopology *topo) {
+    if(topo) {
+        free(topo->order);
+        topo->order = NULL;
+    }
+}
+
+int topology_pin_self(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+}
@@ -0,0 +1,109 @@
+#include "poolla/ws_deque.h"
+#include <stdlib.h>
+
+// Follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+
+static WSArray* ws_array_new(long size) {
+    WSArray *a = malloc(sizeof(WSArray) + (size_t) size * sizeof(void*));
+    if(!a) return NULL;
+    a->size = size;
+    a->prev = NULL;
+    return a;
+}
+
+static WSArray* ws_array_grow(WSDeque *dq, WSArray *a, long top, long bottom) {
+    WSArray *bigger = ws_array_new(a->size * 2);
+    if(!bigger) return NULL;
+    for(long i = top; i < bottom; i++) {
+        void *x = atomic_load_explicit(&a->buf[i & (a->size - 1)], memory_order_relaxed);
+        atomic_store_explicit(&bigger->buf[i & (bigger->size - 1)], x, memory_order_relaxed);
+    }
+    // thieves may still be reading the old buffer, keep it until destroy
+    bigger->prev = a;
+    atomic_store_explicit(&dq->array, bigger, memory_order_release);
+    return bigger;
+}
+
+int ws_deque_init(WSDeque *dq, long capacity) {
+    long size = 1;
+    while(size < capacity) size <<= 1;
+
+    WSArray *a = ws_array_new(size);
+    if(!a) return -1;
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+    atomic_init(&dq->array, a);
+    return 0;
+}
+
+int ws_deque_push(WSDeque *dq, void *item) {
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    WSArray *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+    if(b - t > a->size - 1) {
+        a = ws_array_grow(dq, a, t, b);
+        if(!a) return -1;
+    }
+    atomic_store_explicit(&a->buf[b & (a->size - 1)], item, memory_order_relaxed);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+    return 0;
+}
+
+void* ws_deque_take(WSDeque *dq) {
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    WSArray *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    void *x = NULL;
+    if(t <= b) {
+        x = atomic_load_explicit(&a->buf[b & (a->size - 1)], memory_order_relaxed);
+        if(t == b) {
+            // last item: race against thieves for it
+            if(!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+                x = NULL;
+            }
+            atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+    return x;
+}
+
+void* ws_deque_steal(WSDeque *dq) {
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if(t >= b)
+        return NULL;
+
+    WSArray *a = atomic_load_explicit(&dq->array, memory_order_acquire);
+    void *x = atomic_load_explicit(&a->buf[t & (a->size - 1)], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return WS_ABORT;
+    }
+    return x;
+}
+
+long ws_deque_size(WSDeque *dq) {
+    long b = atomic_load_explicit(&dq->bottom, memory_order_seq_cst);
+    long t = atomic_load_explicit(&dq->top, memory_order_seq_cst);
+    return b > t ? b - t : 0;
+}
+
+void ws_deque_destroy(WSDeque *dq) {
+    WSArray *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+    while(a) {
+        WSArray *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    atomic_store_explicit(&dq->array, NULL, memory_order_relaxed);
+}
@@ -0,0 +1,288 @@
+#include "quant.h"
+#include "train.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+// input codes for layer 1 are centred here, since z-scored features are signed
+#define QUANT_INPUT_ZERO 64
+
+// smallest chunk of input rows worth shipping to another thread, in elements
+#define QUANT_MIN_GRAIN 8192
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// largest |x| over a matrix held at either precision
+static double max_abs(const Matrix *m, const HalfMatrix *h) {
+    double mx = 0.0;
+    if(m) {
+        for(int i = 0; i < m->row; i++) {
+            for(int j = 0; j < m->col; j++)
+                mx = fmax(mx, fabs(mat_row(m, i)[j]));
+        }
+    } else {
+        for(int i = 0; i < h->row * h->col; i++)
+            mx = fmax(mx, fabs(half_get(h->fmt, h->data[i])));
+    }
+    return mx;
+}
+
+// biases stay within ±2^30 so adding them to a sum can't overflow int32
+static int32_t sat_bias(double x) {
+    if(x >= 1073741824.0) return 1 << 30;
+    if(x <= -1073741824.0) return -(1 << 30);
+    return (int32_t) lrint(x);
+}
+
+// x ≈ mult * 2^-shift with mult in [2^30, 2^31); tiny scales flush to zero
+static void fixed_point(double x, int32_t *mult, int *shift) {
+    int e;
+    double f = frexp(x, &e);
+    int64_t m = llrint(f * 2147483648.0);
+    if(m == 2147483648LL) {
+        m /= 2;
+        e++;
+    }
+    int s = 31 - e;
+    if(x <= 0.0 || s > 62) {
+        *mult = 0;
+        *shift = 1;
+        return;
+    }
+    if(s < 1) {
+        // the scale grew past 2^30: any non-zero sum saturates anyway
+        m = INT32_MAX;
+        s = 1;
+    }
+    *mult = (int32_t) m;
+    *shift = s;
+}
+
+static int quant_layer(QLayer *l, const Matrix *W, const Matrix *b, double in_scale, int in_zero) {
+    int in = W->row, out = W->col;
+    l->in = in;
+    l->out = out;
+    l->ld = (size_t) ((in + 3) / 4) * 4;
+    l->in_scale = in_scale;
+    l->in_zero = in_zero;
+    l->w_scale = malloc(out * sizeof(double));
+    l->bias = malloc(out * sizeof(int32_t));
+    int8_t *Wq = malloc((size_t) out * in);
+    if(!l->w_scale || !l->bias || !Wq) {
+        free(Wq);
+        return -1;
+    }
+
+    // per-output-channel symmetric scales; Wq is stored output-major for packing
+    for(int j = 0; j < out; j++) {
+        double mx = 0.0;
+        for(int p = 0; p < in; p++)
+            mx = fmax(mx, fabs(mat_row(W, p)[j]));
+        double s = mx > 0.0 ? mx / 127.0 : 1.0;
+        long wsum = 0;
+        for(int p = 0; p < in; p++) {
+            long q = lrint(mat_row(W, p)[j] / s);
+            q = q < -127 ? -127 : q > 127 ? 127 : q;
+            Wq[(size_t) j * in + p] = (int8_t) q;
+            wsum += q;
+        }
+        l->w_scale[j] = s;
+        l->bias[j] = sat_bias(b->data[j] / (in_scale * s) - (double) in_zero * wsum);
+    }
+    l->W = qgemm_pack(in, out, Wq, (size_t) in);
+    free(Wq);
+    return l->W ? 0 : -1;
+}
+
+// requantize layer l's ReLU output onto the next layer's input codes
+static int quant_requant(QLayer *l, double next_scale) {
+    l->mult = malloc(l->out * sizeof(int32_t));
+    l->shift = malloc(l->out * sizeof(int));
+    if(!l->mult || !l->shift)
+        return -1;
+    for(int j = 0; j < l->out; j++)
+        fixed_point(l->in_scale * l->w_scale[j] / next_scale, &l->mult[j], &l->shift[j]);
+    return 0;
+}
+
+QNN* quant_create(NN *net, const Dataset *calib, int n_samples) {
+    // u8 codes can only carry ReLU outputs between layers
+    int L = net->n_layers;
+    for(int l = 0; l < L; l++) {
+        if(net->layer[l].act != (l + 1 < L ? ACT_RELU : ACT_NONE))
+            return NULL;
+    }
+
+    QNN *q = calloc(1, sizeof(QNN));
+    if(!q)
+        return NULL;
+    q->n_layers = L;
+    q->layer = calloc(L, sizeof(QLayer));
+    double *range = malloc(L * sizeof(double));
+    double *scale = malloc(L * sizeof(double));
+    if(!q->layer || !range || !scale) {
+        free(range);
+        free(scale);
+        quant_free(q);
+        return NULL;
+    }
+
+    // calibration: run the reference forward on evenly spaced rows
+    int n = calib->n_samples;
+    if(n_samples <= 0 || n_samples > n)
+        n_samples = n;
+    int d = calib->n_features;
+    Matrix *S = create_matrix(n_samples, d);
+    if(!S) {
+        free(range);
+        free(scale);
+        quant_free(q);
+        return NULL;
+    }
+    for(int i = 0; i < n_samples; i++) {
+        int src = (int) ((long) i * n / n_samples);
+        if(calib->Xs)
+            csr_row_dense(calib->Xs, src, mat_row(S, i));
+        else
+            memcpy(mat_row(S, i), mat_row(calib->X, src), d * sizeof(real_t));
+    }
+    Cache *c = forward(net, S);
+    range[0] = max_abs(S, NULL);
+    for(int l = 1; l < L; l++)
+        range[l] = max_abs(c->A[l - 1], c->Ah[l - 1]);
+    cache_free(c);
+    free_matrix(S);
+
+    scale[0] = range[0] > 0.0 ? range[0] / (127 - QUANT_INPUT_ZERO) : 1.0;
+    for(int l = 1; l < L; l++)
+        scale[l] = range[l] > 0.0 ? range[l] / 127.0 : 1.0;
+
+    int ok = 1;
+    for(int l = 0; l < L && ok; l++) {
+        QLayer *ql = &q->layer[l];
+        ok = quant_layer(ql, net->layer[l].W, net->layer[l].b, scale[l], l == 0 ? QUANT_INPUT_ZERO : 0) == 0 &&
+             (l + 1 == L || quant_requant(ql, scale[l + 1]) == 0);
+    }
+    free(range);
+    free(scale);
+    if(!ok) {
+        quant_free(q);
+        return NULL;
+    }
+
+    // the output layer is dequantized instead of requantized
+    QLayer *last = &q->layer[L - 1];
+    last->out_scale = malloc(last->out * sizeof(double));
+    if(!last->out_scale) {
+        quant_free(q);
+        return NULL;
+    }
+    for(int j = 0; j < last->out; j++)
+        last->out_scale[j] = last->in_scale * last->w_scale[j];
+    return q;
+}
+
+typedef struct {
+    const Matrix *X;
+    const QLayer *l;
+    uint8_t *out;
+} QuantInputArgs;
+
+static void quant_input_task(void *arg, int start, int end) {
+    QuantInputArgs *a = (QuantInputArgs*) arg;
+    int d = a->X->col;
+    double inv = 1.0 / a->l->in_scale;
+    for(int i = start; i < end; i++) {
+        const real_t *x = mat_row(a->X, i);
+        uint8_t *o = a->out + (size_t) i * a->l->ld;
+        for(int p = 0; p < d; p++) {
+            long v = lrint(x[p] * inv) + a->l->in_zero;
+            o[p] = (uint8_t) (v < 0 ? 0 : v > 127 ? 127 : v);
+        }
+    }
+}
+
+Matrix* quant_forward(const QNN *q, const Matrix *X) {
+    ThreadPool *tp = get_la_pool();
+    int m = X->row;
+    const QLayer *first = &q->layer[0];
+    const QLayer *last = &q->layer[q->n_layers - 1];
+    assert(X->col == first->in && "input width != quantized layer 1 width");
+
+    // calloc keeps the padding bytes of each row at zero
+    uint8_t *a = calloc((size_t) m * first->ld, 1);
+    if(!a)
+        return NULL;
+    QuantInputArgs qa = { .X = X, .l = first, .out = a };
+    threadpool_parallel_for(tp, m, (QUANT_MIN_GRAIN + X->col - 1) / X->col, quant_input_task, &qa);
+
+    for(int l = 0; l + 1 < q->n_layers; l++) {
+        const QLayer *ql = &q->layer[l];
+        size_t ld = q->layer[l + 1].ld;
+        uint8_t *next = calloc((size_t) m * ld, 1);
+        if(!next) {
+            free(a);
+            return NULL;
+        }
+        QgemmEpilogue ep = {
+            .bias = ql->bias,
+            .mult = ql->mult, .shift = ql->shift, .out = next, .ldo = ld,
+        };
+        qgemm(tp, m, a, ql->ld, ql->W, NULL, 0, &ep);
+        free(a);
+        a = next;
+    }
+
+    Matrix *Y = create_matrix(m, last->out);
+    if(!Y) {
+        free(a);
+        return NULL;
+    }
+    QgemmEpilogue ep = {
+        .bias = last->bias,
+        .scale = last->out_scale, .y = Y->data, .ldy = (size_t) Y->ld,
+    };
+    qgemm(tp, m, a, last->ld, last->W, NULL, 0, &ep);
+    free(a);
+    return Y;
+}
+
+QuantReport quant_evaluate(NN *net, const QNN *q, const Matrix *X, const Matrix *Y) {
+    QuantReport r;
+
+    double t0 = now_ms();
+    Matrix *R = create_matrix_uninit(Y->row, Y->col);
+    predict(net, X, R);
+    r.ms_ref = now_ms() - t0;
+    r.r2_ref = compute_r_squared(R, Y);
+    free_matrix(R);
+
+    t0 = now_ms();
+    Matrix *P = quant_forward(q, X);
+    r.ms_quant = now_ms() - t0;
+    r.r2_quant = P ? compute_r_squared(P, Y) : NAN;
+    free_matrix(P);
+    return r;
+}
+
+void quant_free(QNN *q) {
+    if(!q) return;
+    for(int l = 0; q->layer && l < q->n_layers; l++) {
+        QLayer *ql = &q->layer[l];
+        qpacked_free(ql->W);
+        free(ql->w_scale);
+        free(ql->bias);
+        free(ql->mult);
+        free(ql->shift);
+        free(ql->out_scale);
+    }
+    free(q->layer);
+    free(q);
+}
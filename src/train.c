@@ -67,62 +67,103 @@ double compute_rmse(double mse_loss) {
     return sqrt(mse_loss);
 }
 
-double compute_r_squared(const Matrix *y_pred, const Matrix *y_true) {
-    int n = y_true->row * y_true->col;
-    
-    // Compute mean of y_true
-    double mean = 0.0;
-    for (int i = 0; i < n; i++) {
-        mean += y_true->data[i];
-    }
-    mean /= n;
-    
-    // Compute residual sum of squares and total sum of squares
-    double ss_res = 0.0;
-    double ss_tot = 0.0;
-    for (int i = 0; i < n; i++) {
-        double diff = y_pred->data[i] - y_true->data[i];
-        ss_res += diff * diff;
-        double diff_mean = y_true->data[i] - mean;
-        ss_tot += diff_mean * diff_mean;
+// smallest block worth its own partial in the metric reduction, in elements
+#define METRIC_MIN_GRAIN 4096
+
+typedef struct {
+    const Matrix *pred, *truth;
+    double shift; // first target, subtracted so the sum of squares doesn't cancel
+} MetricArgs;
+
+// acc: squared error, sum of (y - shift), sum of (y - shift)^2
+static void metric_block(void *arg, int start, int end, double *acc) {
+    MetricArgs *a = (MetricArgs*) arg;
+    int col = a->truth->col;
+    // dense operands are one run; padded ones go a row at a time
+    int dense = mat_dense(a->pred) && mat_dense(a->truth);
+    int rows = dense ? 1 : end - start;
+    int len = dense ? (end - start) * col : col;
+    double sq = 0.0, sum = 0.0, sum_sq = 0.0;
+    for (int i = 0; i < rows; i++) {
+        const real_t *p = mat_row(a->pred, start + i), *t = mat_row(a->truth, start + i);
+        for (int j = 0; j < len; j++) {
+            double diff = p[j] - t[j];
+            double d = t[j] - a->shift;
+            sq += diff * diff;
+            sum += d;
+            sum_sq += d * d;
+        }
     }
+    acc[0] += sq;
+    acc[1] += sum;
+    acc[2] += sum_sq;
+}
+
+void compute_metrics(const Matrix *y_pred, const Matrix *y_true, double *mse_loss, double *r_squared) {
+    int n = y_true->row * y_true->col;
+    MetricArgs args = { .pred = y_pred, .truth = y_true, .shift = n > 0 ? y_true->data[0] : 0.0 };
+    double acc[3];
+    int grain = METRIC_MIN_GRAIN / (y_true->col > 0 ? y_true->col : 1);
+    la_reduce_rows(y_true->row, 3, grain, metric_block, &args, acc);
+
+    // residual and total sums of squares; SS_tot = sum (y - s)^2 - (sum (y - s))^2 / n
+    double ss_res = acc[0];
+    double ss_tot = n > 0 ? acc[2] - acc[1] * acc[1] / n : 0.0;
+    if (mse_loss) *mse_loss = ss_res / n;
     
     // R2 = 1 - SS_res / SS_tot
-    if (ss_tot == 0.0) return 0.0;
-    return 1.0 - (ss_res / ss_tot);
+    if (r_squared) *r_squared = ss_tot > 0.0 ? 1.0 - (ss_res / ss_tot) : 0.0;
+}
+
+double compute_r_squared(const Matrix *y_pred, const Matrix *y_true) {
+    double r2;
+    compute_metrics(y_pred, y_true, NULL, &r2);
+    return r2;
 }
 
-TrainResult train_epoch(NN *net, const Matrix *X_train, const Matrix *y_train, double lr) {
+// one step on X (dense) or Xs (sparse), in ws when given
+static TrainResult train_step(NN *net, const Matrix *X_train, const CsrMatrix *Xs_train,
+                              const Matrix *y_train, double lr, Workspace *ws) {
     TrainResult result;
+    int m = y_train->row;
     
     // Forward pass
-    Cache *cache = forward(net, X_train);
+    Cache *cache = ws ? workspace_cache(ws, m) : cache_create();
+    if (Xs_train) forward_sparse_into(net, Xs_train, cache);
+    else forward_into(net, X_train, cache);
     
-    // Compute loss and metrics
-    result.loss = mse(cache->A4, y_train);
+    // Compute loss and metrics in one pass
+    compute_metrics(cache_output(cache), y_train, &result.loss, &result.r_squared);
     result.rmse = compute_rmse(result.loss);
-    result.r_squared = compute_r_squared(cache->A4, y_train);
     
     // Backward pass
-    Grad *grads = backward(net, X_train, y_train, cache);
+    Grad *grads = ws ? ws->grad : grad_create();
+    if (ws) workspace_backward(net, X_train, Xs_train, y_train, ws);
+    else if (Xs_train) backward_sparse_into(net, Xs_train, y_train, cache, grads);
+    else backward_into(net, X_train, y_train, cache, grads);
     
     // Update weights
     sgd_update(net, grads, lr);
     
     // Cleanup
-    cache_free(cache);
-    grad_free(grads);
+    if (!ws) {
+        cache_free(cache);
+        grad_free(grads);
+    }
     
     return result;
 }
 
-void generate_synthetic_data(Matrix **X, Matrix **Y, int n_samples, int n_features) {
-    static int seeded = 0;
-    if (!seeded) {
-        srand((unsigned int)time(NULL));
-        seeded = 1;
-    }
-    
+TrainResult train_epoch(NN *net, const Matrix *X_train, const Matrix *y_train, double lr, Workspace *ws) {
+    return train_step(net, X_train, NULL, y_train, lr, ws);
+}
+
+TrainResult train_epoch_sparse(NN *net, const CsrMatrix *X_train, const Matrix *y_train, double lr,
+                               Workspace *ws) {
+    return train_step(net, NULL, X_train, y_train, lr, ws);
+}
+
+static void synthetic_fill(Matrix **X, Matrix **Y, int n_samples, int n_features) {
     *X = create_matrix(n_samples, n_features);
     *Y = create_matrix(n_samples, 1);
     
@@ -148,3 +189,18 @@ void generate_synthetic_data(Matrix **X, Matrix **Y, int n_samples, int n_featur
     
     free(true_weights);
 }
+
+void generate_synthetic_data(Matrix **X, Matrix **Y, int n_samples, int n_features) {
+    static int seeded = 0;
+    if (!seeded) {
+        srand((unsigned int)time(NULL));
+        seeded = 1;
+    }
+    synthetic_fill(X, Y, n_samples, n_features);
+}
+
+void generate_synthetic_data_seeded(Matrix **X, Matrix **Y, int n_samples, int n_features,
+                                    unsigned seed) {
+    srand(seed);
+    synthetic_fill(X, Y, n_samples, n_features);
+}
@@ -3,23 +3,31 @@
 #include <stdio.h>
 #include <string.h>
 
-ValResult validate(NN *net, const Matrix *X_val, const Matrix *Y_val) {
+static ValResult metrics(Matrix *Y_pred, const Matrix *Y_val) {
     ValResult result;
     
-    // Forward pass
-    Cache *cache = forward(net, X_val);
-    
     // Compute metrics
-    result.loss = mse(cache->A4, Y_val);
+    compute_metrics(Y_pred, Y_val, &result.loss, &result.r_squared);
     result.rmse = compute_rmse(result.loss);
-    result.r_squared = compute_r_squared(cache->A4, Y_val);
     
     // Cleanup
-    cache_free(cache);
+    free_matrix(Y_pred);
     
     return result;
 }
 
+ValResult validate(NN *net, const Matrix *X_val, const Matrix *Y_val) {
+    Matrix *Y_pred = create_matrix_uninit(Y_val->row, Y_val->col);
+    predict(net, X_val, Y_pred);
+    return metrics(Y_pred, Y_val);
+}
+
+ValResult validate_sparse(NN *net, const CsrMatrix *X_val, const Matrix *Y_val) {
+    Matrix *Y_pred = create_matrix_uninit(Y_val->row, Y_val->col);
+    predict_sparse(net, X_val, Y_pred);
+    return metrics(Y_pred, Y_val);
+}
+
 void train_val_split(const Matrix *X, const Matrix *Y,
                      Matrix **X_train, Matrix **Y_train,
                      Matrix **X_val, Matrix **Y_val,
@@ -31,19 +39,11 @@ void train_val_split(const Matrix *X, const Matrix *Y,
     int n_val = (int)(n_samples * val_ratio);
     int n_train = n_samples - n_val;
     
-    // Allocate matrices
-    *X_train = create_matrix(n_train, n_features);
-    *Y_train = create_matrix(n_train, n_outputs);
-    *X_val = create_matrix(n_val, n_features);
-    *Y_val = create_matrix(n_val, n_outputs);
-    
-    // Copy training data
-    memcpy((*X_train)->data, X->data, n_train * n_features * sizeof(double));
-    memcpy((*Y_train)->data, Y->data, n_train * n_outputs * sizeof(double));
-    
-    // Copy validation data
-    memcpy((*X_val)->data, X->data + n_train * n_features, n_val * n_features * sizeof(double));
-    memcpy((*Y_val)->data, Y->data + n_train * n_outputs, n_val * n_outputs * sizeof(double));
+    // Training rows first, validation rows after them
+    *X_train = matrix_view(X, 0, n_train, 0, n_features);
+    *Y_train = matrix_view(Y, 0, n_train, 0, n_outputs);
+    *X_val = matrix_view(X, n_train, n_val, 0, n_features);
+    *Y_val = matrix_view(Y, n_train, n_val, 0, n_outputs);
 }
 
 void print_val_result(const ValResult *result, int epoch) {